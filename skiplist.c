@@ -13,298 +13,2997 @@
 #include <strings.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <time.h>
 
 #include "skiplist.h"
 
-static void __free_node(node_t* n)
+#ifdef SKIPLIST_STATS
+/* gets may run on several threads at once, so counters are bumped
+ * atomically. Relaxed, since nothing is ordered by them */
+#define __STAT(me, field) \
+    ((void) __atomic_add_fetch(&(me)->stats.field, 1, __ATOMIC_RELAXED))
+#define __STAT_ADD(me, field, n) \
+    ((void) __atomic_add_fetch(&(me)->stats.field, (n), __ATOMIC_RELAXED))
+#define __STAT_LOAD(me, field) \
+    __atomic_load_n(&(me)->stats.field, __ATOMIC_RELAXED)
+#else
+#define __STAT(me, field) ((void)(me))
+#endif
+
+static inline long __cmp(skiplist_t * me, const void *k1, const void *k2)
+{
+    __STAT(me, cmps);
+    return me->cmp(k1, k2, me->udata);
+}
+
+/**
+ * @return key's order preserving prefix; 0 if there's no prefix function */
+static inline uint64_t __prefix(skiplist_t * me, const void *key)
+{
+    return me->prefix ? me->prefix(key, me->udata) : 0;
+}
+
+/**
+ * Compare key, whose prefix is kp, against n's key. Unequal prefixes settle
+ * it inline; the comparator is only called on a tie */
+static inline long __cmpn(
+    skiplist_t * me,
+    const void *key,
+    uint64_t kp,
+    const node_t* n)
+{
+    if (kp != n->prefix)
+        return kp < n->prefix ? -1 : 1;
+    return __cmp(me, key, n->ety.k);
+}
+
+static inline long __cmp_nodes(skiplist_t * me, const node_t* a, const node_t* b)
+{
+    return __cmpn(me, a->ety.k, a->prefix, b);
+}
+
+static void *__alloc(skiplist_t * me, size_t size)
+{
+    return me->pool ? skiplist_pool_alloc(me->pool, size) : calloc(1, size);
+}
+
+static void __release_mem(skiplist_t * me, void *p, size_t size)
+{
+    if (me->pool)
+        skiplist_pool_release(me->pool, p, size);
+    else
+        free(p);
+}
+
+static void __free_node(skiplist_t * me, node_t* n)
+{
+    __STAT(me, frees);
+    if (n == me->compact_next)
+        me->compact_next = n->next[0];
+    __release_mem(me, n->next, sizeof(node_t*) * n->capacity);
+    __release_mem(me, n, sizeof(node_t));
+}
+
+static node_t* __allocnode(skiplist_t * me, unsigned int levels)
+{
+    node_t* n;
+
+    __STAT(me, allocs);
+    if (!(n = __alloc(me, sizeof(node_t))))
+        return NULL;
+    if (!(n->next = __alloc(me, sizeof(node_t*) * levels)))
+    {
+        __release_mem(me, n, sizeof(node_t));
+        return NULL;
+    }
+    n->levels = levels;
+    n->capacity = levels;
+    return n;
+}
+
+/**
+ * Make n's tower this many lines tall. The node itself doesn't move
+ * @return 0 on success, otherwise -1 if out of memory */
+static int __grow_tower(skiplist_t * me, node_t *n, unsigned int levels)
+{
+    node_t **next;
+
+    /* it's been lowered before, and still has the room */
+    if (levels <= n->capacity)
+    {
+        n->levels = levels;
+        return 0;
+    }
+
+    if (!me->pool)
+    {
+        if (!(next = realloc(n->next, sizeof(node_t*) * levels)))
+            return -1;
+    }
+    else
+    {
+        if (!(next = skiplist_pool_alloc(me->pool, sizeof(node_t*) * levels)))
+            return -1;
+        memcpy(next, n->next, sizeof(node_t*) * n->levels);
+        skiplist_pool_release(me->pool, n->next,
+                              sizeof(node_t*) * n->capacity);
+    }
+    n->next = next;
+    n->levels = levels;
+    n->capacity = levels;
+    return 0;
+}
+
+/**
+ * @return floor(log2(n)) + 1, or 1 for n == 0 */
+static unsigned int __log2_levels(unsigned int n)
+{
+    unsigned int levels = 1;
+    while (n >>= 1)
+        levels++;
+    return levels;
+}
+
+/**
+ * n's successor on the bottom line has changed; point it back at n */
+static void __backlink(node_t* n)
+{
+#ifdef SKIPLIST_BACKLINKS
+    if (n->next[0])
+        n->next[0]->prev = n;
+#else
+    (void)n;
+#endif
+}
+
+/**
+ * Free nil and every node after it */
+static void __free_nodes(skiplist_t * me, node_t *nil)
+{
+    node_t *n = nil;
+
+    while (n)
+    {
+        node_t *next = n->next[0];
+        __free_node(me, n);
+        n = next;
+    }
+}
+
+static void __bloom_add(skiplist_t * me, const void *key)
+{
+    if (me->bloom)
+        skiplist_bloom_add(me->bloom, me->hash(key, me->udata));
+}
+
+static void __bloom_remove(skiplist_t * me, const void *key)
+{
+    if (me->bloom)
+        skiplist_bloom_remove(me->bloom, me->hash(key, me->udata));
+}
+
+/**
+ * Start the Bloom filter over, sized for twice the population, and add every
+ * key to it.
+ * @return 0 on success, otherwise -1 if out of memory; the old filter is kept
+ *  */
+static int __bloom_fill(skiplist_t * me)
+{
+    skiplist_bloom_t *bloom;
+    node_t *n;
+
+    if (!(bloom = skiplist_bloom_new(me->count * 2)))
+        return -1;
+    for (n = me->nil->next[0]; n; n = n->next[0])
+        skiplist_bloom_add(bloom, me->hash(n->ety.k, me->udata));
+    skiplist_bloom_free(me->bloom);
+    me->bloom = bloom;
+    return 0;
+}
+
+/**
+ * Refill the filter. A filter that's missing keys would turn away gets for
+ * them, so if we run out of memory the list goes without one */
+static void __bloom_refill(skiplist_t * me)
+{
+    if (me->bloom && __bloom_fill(me))
+    {
+        skiplist_bloom_free(me->bloom);
+        me->bloom = NULL;
+    }
+}
+
+/**
+ * Past its capacity the filter's false positive rate climbs, so swap it for a
+ * bigger one. Doubling keeps this O(1) per put, amortised. If we're out of
+ * memory the old filter still works, only less well */
+static void __bloom_grow(skiplist_t * me)
+{
+    if (me->bloom && me->bloom->capacity < me->count &&
+        me->bloom->nblocks < SKIPLIST_BLOOM_MAX_BLOCKS)
+        __bloom_fill(me);
+}
+
+static uint64_t __clock_ms(const void *udata)
+{
+    struct timespec ts;
+
+    (void)udata;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @return 1 if n's item has expired, otherwise 0 */
+static int __expired(skiplist_t * me, const node_t *n)
+{
+#ifdef SKIPLIST_TTL
+    return n->expires && n->expires <= me->clock(me->expire_udata);
+#else
+    (void)me;
+    (void)n;
+    return 0;
+#endif
+}
+
+#ifdef SKIPLIST_TTL
+static long __expiry_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused)))
+{
+    return (uintptr_t)k1 < (uintptr_t)k2 ? -1 : (uintptr_t)k1 > (uintptr_t)k2;
+}
+
+/**
+ * File key under this expiry time in the expiry index
+ * @return 0 on success, otherwise -1 if out of memory */
+static int __index(skiplist_t * me, uint64_t expires, void *key)
+{
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    unsigned int count;
+
+    if (!me->expiry &&
+        !(me->expiry = skiplist_new_opts(__expiry_compare, NULL, &opts)))
+        return -1;
+    count = me->expiry->count;
+    skiplist_put(me->expiry, (void *)(uintptr_t)expires, key);
+    return count == me->expiry->count ? -1 : 0;
+}
+
+static void __unindex(skiplist_t * me, node_t *n)
+{
+    if (n->expires && me->expiry)
+        skiplist_remove_item(me->expiry, (void *)(uintptr_t)n->expires,
+                             n->ety.k);
+}
+#endif
+
+/**
+ * n's item is leaving the list; forget when it expires */
+static void __forget_expiry(skiplist_t * me, node_t *n)
+{
+#ifdef SKIPLIST_TTL
+    __unindex(me, n);
+    n->expires = 0;
+#else
+    (void)me;
+    (void)n;
+#endif
+}
+
+/**
+ * Give n's item a new expiry time, 0 for none */
+static void __set_expiry(skiplist_t * me, node_t *n, uint64_t expires)
+{
+#ifdef SKIPLIST_TTL
+    __forget_expiry(me, n);
+    if (expires && 0 == __index(me, expires, n->ety.k))
+        n->expires = expires;
+#else
+    (void)me;
+    (void)n;
+    (void)expires;
+#endif
+}
+
+/**
+ * Swap the items two nodes hold */
+static void __swap_items(node_t *a, node_t *b)
+{
+    skiplist_entry_t ety = a->ety;
+    uint64_t prefix = a->prefix;
+
+    a->ety = b->ety;
+    b->ety = ety;
+    a->prefix = b->prefix;
+    b->prefix = prefix;
+#ifdef SKIPLIST_TTL
+    uint64_t expires = a->expires;
+    a->expires = b->expires;
+    b->expires = expires;
+#endif
+}
+
+/**
+ * Make sure no other version shares our nodes, so that we can change them.
+ * The last version left holding the nodes simply takes them over.
+ * @param copy 0 if we're about to drop every item anyway, in which case we
+ *  start over with an empty list instead of copying
+ * @return 0 on success, otherwise -1 if out of memory */
+static int __unshare(skiplist_t * me, int copy)
+{
+    node_t *tail[SKIPLIST_MAX_LEVELS], *nil, *old = me->nil, *n;
+    skiplist_bloom_t *bloom = NULL, *old_bloom = me->bloom;
+    unsigned int lvl;
+
+    /* everything that changes the list comes through here first */
+    me->version++;
+
+    if (!me->shared)
+        return 0;
+
+    if (1 == __atomic_load_n(me->shared, __ATOMIC_ACQUIRE))
+    {
+        free(me->shared);
+        me->shared = NULL;
+        return 0;
+    }
+
+    if (old_bloom && !(bloom = copy ? skiplist_bloom_copy(old_bloom) :
+                                      skiplist_bloom_new(0)))
+        return -1;
+    if (!(nil = __allocnode(me, me->max_levels)))
+    {
+        if (bloom)
+            skiplist_bloom_free(bloom);
+        return -1;
+    }
+    for (lvl = 0; lvl < me->max_levels; lvl++)
+        tail[lvl] = nil;
+
+    /* same towers, so the copy searches exactly like the original */
+    for (n = copy ? old->next[0] : NULL; n; n = n->next[0])
+    {
+        node_t *c = __allocnode(me, n->levels);
+        if (!c)
+        {
+            __free_nodes(me, nil);
+            if (bloom)
+                skiplist_bloom_free(bloom);
+            return -1;
+        }
+        c->ety = n->ety;
+        c->prefix = n->prefix;
+#ifdef SKIPLIST_TTL
+        c->expires = n->expires;
+#endif
+        for (lvl = 0; lvl < c->levels; lvl++)
+        {
+            tail[lvl]->next[lvl] = c;
+            if (0 == lvl)
+                __backlink(tail[0]);
+            tail[lvl] = c;
+        }
+    }
+
+    me->nil = nil;
+    me->bloom = bloom;
+    me->compact_next = NULL;
+    if (!copy)
+    {
+        me->levels = 1;
+        me->count = 0;
+    }
+
+    /* everyone else may have let go while we were copying */
+    if (0 == __atomic_sub_fetch(me->shared, 1, __ATOMIC_ACQ_REL))
+    {
+        __free_nodes(me, old);
+        if (old_bloom)
+            skiplist_bloom_free(old_bloom);
+        free(me->shared);
+    }
+    me->shared = NULL;
+    return 0;
+}
+
+/**
+ * @return a different xorshift64 seed for each list, but the same ones from
+ *  run to run */
+static uint64_t __new_seed(void)
+{
+    static uint64_t lists;
+
+    /* splitmix64 of the count of lists so far */
+    uint64_t z = __atomic_add_fetch(&lists, 1, __ATOMIC_RELAXED) *
+        0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (z ^ (z >> 31)) | 1;
+}
+
+skiplist_t *skiplist_clone(skiplist_t * me)
+{
+    skiplist_t *clone;
+
+    if (!me->shared)
+    {
+        if (!(me->shared = malloc(sizeof(unsigned int))))
+            return NULL;
+        *me->shared = 1;
+    }
+    if (!(clone = malloc(sizeof(skiplist_t))))
+        return NULL;
+    memcpy(clone, me, sizeof(skiplist_t));
+    clone->seed = __new_seed();
+#ifdef SKIPLIST_STATS
+    memset(&clone->stats, 0, sizeof(skiplist_stats_t));
+#endif
+
+    /* the expiry index is a list too, so it gets a version of its own */
+    if (me->expiry && !(clone->expiry = skiplist_clone(me->expiry)))
+    {
+        free(clone);
+        return NULL;
+    }
+    __atomic_add_fetch(me->shared, 1, __ATOMIC_ACQ_REL);
+    return clone;
+}
+
+skiplist_t *skiplist_new_opts(
+    func_longcmp_f cmp,
+    const void* userdata,
+    const skiplist_opts_t* opts)
+{
+    skiplist_t *me;
+
+    if (!(me = calloc(1, sizeof(skiplist_t))))
+        return NULL;
+    me->udata = userdata;
+    me->cmp = cmp;
+    me->levels = 1;
+    me->seed = __new_seed();
+    me->max_levels = SKIPLIST_MAX_LEVELS;
+    if (opts)
+    {
+        me->flags = opts->flags;
+        me->pool = opts->pool;
+        me->prefix = opts->prefix;
+        me->hash = opts->hash;
+        me->clock = opts->clock;
+        me->on_expire = opts->on_expire;
+        me->expire_udata = opts->expire_udata;
+    }
+    if (!me->clock)
+        me->clock = __clock_ms;
+
+    if (opts && opts->max_levels)
+        me->max_levels = opts->max_levels;
+    else if (opts && opts->capacity)
+        me->max_levels = __log2_levels(opts->capacity);
+    if (SKIPLIST_MAX_LEVELS < me->max_levels)
+        me->max_levels = SKIPLIST_MAX_LEVELS;
+
+    if (me->hash && !(me->bloom = skiplist_bloom_new(opts->capacity)))
+    {
+        free(me);
+        return NULL;
+    }
+
+    if (!(me->nil = __allocnode(me, me->max_levels)))
+    {
+        if (me->bloom)
+            skiplist_bloom_free(me->bloom);
+        free(me);
+        return NULL;
+    }
+    return me;
+}
+
+skiplist_t *skiplist_new(func_longcmp_f cmp, const void* userdata)
+{
+    return skiplist_new_opts(cmp, userdata, NULL);
+}
+
+int skiplist_count(const skiplist_t * me)
+{
+    return me->count;
+}
+
+void skiplist_clear_cb(
+    skiplist_t * me,
+    func_entry_f cb,
+    void *udata
+)
+{
+    node_t *n;
+    unsigned int i;
+
+    /* other versions still need the nodes, so we start over with new ones */
+    if (__unshare(me, 0))
+        return;
+
+    n = me->nil->next[0];
+    while (n)
+    {
+        node_t *next = n->next[0];
+        if (cb)
+            cb(&n->ety, udata);
+        __free_node(me, n);
+        n = next;
+    }
+
+    for (i=0; i<me->levels; i++)
+        me->nil->next[i] = NULL;
+    me->levels = 1;
+    me->count = 0;
+    if (me->bloom)
+        skiplist_bloom_clear(me->bloom);
+    if (me->expiry)
+        skiplist_clear(me->expiry);
+}
+
+void skiplist_clear(
+    skiplist_t * me
+)
+{
+    skiplist_clear_cb(me, NULL, NULL);
+}
+
+void skiplist_free(
+    skiplist_t * me
+)
+{
+    /* the last version out frees the nodes */
+    if (!me->shared || 0 == __atomic_sub_fetch(me->shared, 1, __ATOMIC_ACQ_REL))
+    {
+        free(me->shared);
+        __free_nodes(me, me->nil);
+        if (me->bloom)
+            skiplist_bloom_free(me->bloom);
+    }
+    if (me->expiry)
+        skiplist_freeall(me->expiry);
+    me->shared = NULL;
+    me->nil = NULL;
+    me->bloom = NULL;
+    me->expiry = NULL;
+    me->count = 0;
+}
+
+void skiplist_freeall(
+    skiplist_t * me
+)
+{
+    skiplist_free(me);
+    free(me);
+}
+
+void skiplist_drop(
+    skiplist_t * me
+)
+{
+    if (!me->pool || me->shared)
+    {
+        skiplist_freeall(me);
+        return;
+    }
+
+    /* every node is in the pool's slabs */
+    skiplist_pool_reset(me->pool);
+    if (me->bloom)
+        skiplist_bloom_free(me->bloom);
+    if (me->expiry)
+        skiplist_freeall(me->expiry);
+    free(me);
+}
+
+/**
+ * Choose the height of a new node.
+ * Heights are capped at log2(count) + 1; any taller and the extra lines would
+ * only add descent steps */
+static unsigned int __flip_coins(skiplist_t * me)
+{
+    unsigned int max = __log2_levels(me->count + 1);
+    unsigned int depth;
+    uint64_t x = me->seed;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    me->seed = x;
+
+    if (me->max_levels < max)
+        max = me->max_levels;
+    for (depth=1; depth < max && (x & 1); depth++, x >>= 1);
+    return depth;
+}
+
+static void __swap(node_t* a, node_t* b, unsigned int lvl)
+{
+    node_t* swp = a->next[lvl];
+    a->next[lvl] = b;
+    b->next[lvl] = swp;
+}
+
+/**
+ * Drop lines that have emptied out */
+static void __trim_levels(skiplist_t * me)
+{
+    while (1 < me->levels && !me->nil->next[me->levels - 1])
+        me->levels--;
+}
+
+int skiplist_contains_key(
+    skiplist_t * me,
+    const void *key
+)
+{
+    return (NULL != skiplist_get(me, key));
+}
+
+/**
+ * @param inclusive Also step past nodes with a key equal to key
+ * @return last node on the bottom line with a key less than key (or equal,
+ *  if inclusive); nil if there isn't one */
+static node_t *__last_before(skiplist_t * me, const void *key, int inclusive)
+{
+    uint64_t kp = __prefix(me, key);
+    node_t *n = me->nil;
+    int lvl;
+
+    for (lvl = me->levels - 1; 0 <= lvl; lvl--)
+        while (n->next[lvl])
+        {
+            long c = __cmpn(me, key, kp, n->next[lvl]);
+            if (c < 0 || (0 == c && !inclusive))
+                break;
+            __STAT(me, visits);
+            n = n->next[lvl];
+        }
+    return n;
+}
+
+/**
+ * @return first node on the bottom line whose key isn't less than key */
+static node_t *__lower_bound(skiplist_t * me, const void *key)
+{
+    return __last_before(me, key, 0)->next[0];
+}
+
+static skiplist_entry_t *__entry(skiplist_t * me, node_t *n)
+{
+    return n && n != me->nil ? &n->ety : NULL;
+}
+
+skiplist_entry_t *skiplist_floor(skiplist_t * me, const void *key)
+{
+    return key ? __entry(me, __last_before(me, key, 1)) : NULL;
+}
+
+skiplist_entry_t *skiplist_ceiling(skiplist_t * me, const void *key)
+{
+    return key ? __entry(me, __last_before(me, key, 0)->next[0]) : NULL;
+}
+
+skiplist_entry_t *skiplist_lower(skiplist_t * me, const void *key)
+{
+    return key ? __entry(me, __last_before(me, key, 0)) : NULL;
+}
+
+skiplist_entry_t *skiplist_higher(skiplist_t * me, const void *key)
+{
+    return key ? __entry(me, __last_before(me, key, 1)->next[0]) : NULL;
+}
+
+/**
+ * Record the last node with a key less than key on every line */
+static void __find_preds(skiplist_t * me, const void *key, node_t **pred)
+{
+    uint64_t kp = __prefix(me, key);
+    node_t *n = me->nil;
+    int lvl;
+
+    for (lvl = me->max_levels - 1; 0 <= lvl; lvl--)
+    {
+        if (lvl < (int)me->levels)
+            while (n->next[lvl] &&
+                   0 < __cmpn(me, key, kp, n->next[lvl]))
+            {
+                __STAT(me, visits);
+                n = n->next[lvl];
+            }
+        pred[lvl] = n;
+    }
+}
+
+/**
+ * @return first node with a key equal to key, otherwise NULL */
+static node_t *__get(skiplist_t * me, const void *key)
+{
+    __STAT(me, ops);
+
+    if (0 == skiplist_count(me) || !key)
+        return NULL;
+
+    if (me->bloom && !skiplist_bloom_maybe(me->bloom, me->hash(key, me->udata)))
+    {
+        __STAT(me, filtered);
+        return NULL;
+    }
+
+    uint64_t kp = __prefix(me, key);
+
+    /* an equal key found on an express line might not be the first one */
+    if (me->flags & SKIPLIST_MULTIMAP)
+    {
+        node_t *n = __lower_bound(me, key);
+        return n && 0 == __cmpn(me, key, kp, n) ? n : NULL;
+    }
+
+    int lvl = me->levels - 1;
+    node_t *n = me->nil;
+
+    while (0 <= lvl)
+    {
+        node_t *r = n->next[lvl];
+        long c = r ? __cmpn(me, key, kp, r) : -1;
+
+        if (c < 0)
+        {
+            lvl -= 1;
+        }
+        else if (0 < c)
+        {
+            __STAT(me, visits);
+            n = r;
+        }
+        else
+        {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Remove the item at this place in key's run of equal keys
+ * @return 0 on success, otherwise -1 if out of memory */
+static int __remove_at(skiplist_t * me, const void *key, unsigned int at)
+{
+    node_t *first, *n, *m;
+
+    if (__unshare(me, 1))
+        return -1;
+    first = __lower_bound(me, key);
+    for (n = first; at; at--)
+        n = n->next[0];
+
+    /* remove only knows how to take out the first of a run of equal keys.
+     * So shift the items before this one up a node, and this item into the
+     * first node */
+    for (m = first->next[0]; m != n->next[0]; m = m->next[0])
+        __swap_items(first, m);
+    skiplist_remove(me, key);
+    return 0;
+}
+
+/**
+ * Remove n's expired item, and hand it to on_expire.
+ * Items with equal keys can have equal values but expire at different times,
+ * so this goes by n's place rather than by its value.
+ * @return 0 on success, otherwise -1 if out of memory */
+static int __evict(skiplist_t * me, node_t *n)
+{
+    skiplist_entry_t ety = n->ety;
+    unsigned int at = 0;
+    node_t *m;
+
+    for (m = __lower_bound(me, ety.k); m != n; m = m->next[0])
+        at++;
+    if (__remove_at(me, ety.k, at))
+        return -1;
+    __STAT(me, expired);
+    if (me->on_expire)
+        me->on_expire(&ety, me->expire_udata);
+    return 0;
+}
+
+/**
+ * @return 1 if another version still holds our nodes, otherwise 0 */
+static int __shared(skiplist_t * me)
+{
+    return me->shared && 1 < __atomic_load_n(me->shared, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Step over expired items without removing them, for gets on a version that
+ * shares its nodes: evicting would copy every node first.
+ * @param n first item with a key equal to key
+ * @return first item from n on with an equal key that hasn't expired,
+ *  otherwise NULL */
+static node_t *__skip_expired(skiplist_t * me, const void *key, node_t *n)
+{
+    for (; n && __expired(me, n); n = n->next[0])
+        if (n->next[0] && 0 != __cmp(me, key, n->next[0]->ety.k))
+            return NULL;
+    return n;
+}
+
+void *skiplist_get(skiplist_t * me, const void *key)
+{
+    node_t *n;
+
+    /* with a multimap, the next item with an equal key may not have expired */
+    while ((n = __get(me, key)) && __expired(me, n))
+    {
+        if (__shared(me))
+        {
+            n = __skip_expired(me, key, n);
+            break;
+        }
+        if (__evict(me, n))
+            return NULL;
+    }
+    return n ? n->ety.v : NULL;
+}
+
+#ifdef SKIPLIST_TTL
+int skiplist_expire(skiplist_t * me, unsigned int max)
+{
+    uint64_t now = me->clock(me->expire_udata);
+    unsigned int evicted = 0;
+
+    while (evicted < max && me->expiry && 0 < me->expiry->count)
+    {
+        node_t *e = me->expiry->nil->next[0], *n;
+        uint64_t expires = (uintptr_t)e->ety.k;
+        void *key = e->ety.v;
+
+        if (now < expires)
+            break;
+
+        /* the index only knows the key; find which of its run of equal
+         * keys this is */
+        for (n = __lower_bound(me, key);
+             n && 0 == __cmp(me, key, n->ety.k) &&
+             !(n->ety.k == key && n->expires == expires);
+             n = n->next[0]);
+
+        if (!n || n->ety.k != key)
+            skiplist_pop_min(me->expiry);
+        else if (__evict(me, n))
+            break;
+        else
+            evicted++;
+    }
+    return evicted;
+}
+#endif
+
+void skiplist_finger_init(skiplist_finger_t * finger)
+{
+    finger->pred[0] = NULL;
+}
+
+/**
+ * Bring the finger's path round to key: afterwards pred[lvl] is the last node
+ * with a key less than key on every line lvl.
+ * The old path's nodes get further left on higher lines, and the nodes after
+ * them further right. So we climb only until the path's line brackets key,
+ * and the lines above that are already right */
+static void __finger_search(
+    skiplist_t * me,
+    skiplist_finger_t * finger,
+    const void *key,
+    uint64_t kp)
+{
+    node_t **pred = finger->pred, *n, *r;
+    int lvl = 0, top = me->levels - 1;
+
+    if (!pred[0] || finger->version != me->version)
+    {
+        for (lvl = 0; lvl < (int)me->max_levels; lvl++)
+            pred[lvl] = me->nil;
+        finger->version = me->version;
+        lvl = top;
+    }
+    /* key is ahead of the path; climb while the next line up overshoots */
+    else if (pred[0] == me->nil || 0 < __cmpn(me, key, kp, pred[0]))
+    {
+        while (lvl < top && (r = pred[lvl + 1]->next[lvl + 1]) &&
+               0 < __cmpn(me, key, kp, r))
+            lvl++;
+    }
+    /* key is behind the path; climb until the path is before key */
+    else
+    {
+        for (lvl = 1; lvl <= top && pred[lvl] != me->nil &&
+             0 >= __cmpn(me, key, kp, pred[lvl]); lvl++);
+
+        /* even the top line's node is too far on */
+        if (top < lvl)
+            pred[lvl = top] = me->nil;
+    }
+
+    for (n = pred[lvl]; 0 <= lvl; lvl--)
+    {
+        while ((r = n->next[lvl]) && 0 < __cmpn(me, key, kp, r))
+        {
+            __STAT(me, visits);
+            n = r;
+        }
+        pred[lvl] = n;
+    }
+}
+
+void *skiplist_finger_get(
+    skiplist_t * me,
+    skiplist_finger_t * finger,
+    const void *key)
+{
+    __STAT(me, ops);
+
+    if (0 == skiplist_count(me) || !key)
+        return NULL;
+
+    if (me->bloom && !skiplist_bloom_maybe(me->bloom, me->hash(key, me->udata)))
+    {
+        __STAT(me, filtered);
+        return NULL;
+    }
+
+    uint64_t kp = __prefix(me, key);
+    node_t *r;
+
+    while (1)
+    {
+        __finger_search(me, finger, key, kp);
+
+        /* the path stops short of equal keys, so this is the first of them */
+        r = finger->pred[0]->next[0];
+        if (!r || 0 != __cmpn(me, key, kp, r))
+            return NULL;
+        if (!__expired(me, r))
+            return r->ety.v;
+        if (__shared(me))
+            return (r = __skip_expired(me, key, r)) ? r->ety.v : NULL;
+        if (__evict(me, r))
+            return NULL;
+    }
+}
+
+void *skiplist_get_min(skiplist_t * me)
+{
+    node_t *n = me->nil->next[0];
+    return n ? n->ety.v : NULL;
+}
+
+/**
+ * @return last node on the bottom line, otherwise nil if empty */
+static node_t *__last(skiplist_t * me)
+{
+    node_t *n = me->nil;
+    int lvl;
+
+    for (lvl = me->levels - 1; 0 <= lvl; lvl--)
+        while (n->next[lvl])
+            n = n->next[lvl];
+    return n;
+}
+
+void *skiplist_get_max(skiplist_t * me)
+{
+    node_t *n = __last(me);
+    return n == me->nil ? NULL : n->ety.v;
+}
+
+static node_t* __place(
+    skiplist_t * me,
+    void *key,
+    uint64_t kp,
+    void *val,
+    uint64_t expires,
+    node_t *prev,
+    unsigned int *put_depth)
+{
+    *put_depth = __flip_coins(me);
+    node_t* new = __allocnode(me, *put_depth);
+    if (!new)
+    {
+        *put_depth = 0;
+        return NULL;
+    }
+    __swap(prev, new, 0);
+    __backlink(prev);
+    __backlink(new);
+    new->ety.k = key;
+    new->ety.v = val;
+    new->prefix = kp;
+    __set_expiry(me, new, expires);
+
+    /* make sure nil is included in the new line(s). nil's tower is already
+     * max_levels tall so there's nothing to allocate */
+    unsigned int i;
+    for (i = me->levels; i < *put_depth; i++)
+        me->nil->next[i] = new;
+    if (me->levels < *put_depth)
+        me->levels = *put_depth;
+
+    me->count++;
+    return new;
+}
+
+/**
+ * We're doing this call recursively since it allows us to use the stack as a 
+ * workspace. This means we don't need a doubly linked list */
+static node_t *__put(
+    skiplist_t * me,
+    void *key,
+    uint64_t kp,
+    void *val,
+    uint64_t expires,
+    unsigned int lvl,
+    node_t *prev,
+    unsigned int *put_depth,
+    void **v_old
+)
+{
+    node_t *n = prev;
+
+    while (1)
+    {
+        node_t *r = n->next[lvl];
+        long c = r ? __cmpn(me, key, kp, r) : -1;
+
+        /* we are smaller, move down a lane */
+        if (c < 0)
+        {
+            /* if we're on the bottom lane, we've found our spot */
+            if (lvl == 0)
+                return __place(me, key, kp, val, expires, n, put_depth);
+
+            node_t* placed =  __put(me, key, kp, val, expires, lvl-1, n,
+                                    put_depth, v_old);
+
+            /* while the stack is rolling back up, we can use the stack to
+             * make sure the previous nodes point to the new node correctly. */
+            if (placed && (lvl < *put_depth))
+                __swap(n, placed, lvl);
+
+            return placed;
+        }
+        /* we are larger, move onwards */
+        else if (0 < c)
+        {
+            __STAT(me, visits);
+            n = r;
+        }
+        /* equal keys keep insertion order */
+        else if (me->flags & SKIPLIST_MULTIMAP)
+        {
+            __STAT(me, visits);
+            n = r;
+        }
+        /* straight swap */
+        else
+        {
+            *v_old = r->ety.v;
+            r->ety.v = val;
+            __set_expiry(me, r, expires);
+            return NULL;
+        }
+    }
+}
+
+/* Deterministic 1-2-3 mode.
+ *
+ * Instead of flipping coins, towers are raised and lowered so that every gap
+ * (the run of nodes on line j between two neighbouring nodes of line j + 1)
+ * holds at most 3 nodes, and at least 1 while we're only putting and
+ * removing. A search then makes at most 4 comparisons per line over at most
+ * log2(count) + 1 lines, so get, put and remove are O(log n) in the worst
+ * case, not just the expected case.
+ *
+ * Both put and remove fix gaps top-down on their way to the bottom line
+ * (Munro, Papadakis & Sedgewick), so no stack of predecessors is needed. */
+
+/**
+ * Put n on line lvl, right after prev. n's top line must be lvl - 1 */
+static int __raise(
+    skiplist_t * me,
+    node_t *n,
+    node_t *prev,
+    unsigned int lvl)
+{
+    if (__grow_tower(me, n, lvl + 1))
+        return -1;
+    __swap(prev, n, lvl);
+    return 0;
+}
+
+/**
+ * Take n off its top line. prev is n's predecessor on that line. The tower
+ * keeps its capacity, so a later raise can reuse it */
+static void __lower(node_t *n, node_t *prev)
+{
+    unsigned int top = n->levels - 1;
+    prev->next[top] = n->next[top];
+    n->levels--;
+}
+
+/**
+ * @return number of nodes on line lvl after n and before bound, counting no
+ *  further than max */
+static unsigned int __gap(
+    node_t *n,
+    node_t *bound,
+    unsigned int lvl,
+    unsigned int max)
+{
+    unsigned int g = 0;
+    for (n = n->next[lvl]; n != bound && g < max; n = n->next[lvl])
+        g++;
+    return g;
+}
+
+static node_t *__det_put(
+    skiplist_t * me,
+    void *key,
+    uint64_t kp,
+    void *val,
+    uint64_t expires,
+    void **v_old)
+{
+    node_t *n = me->nil, *new;
+    int lvl;
+
+    for (lvl = me->levels - 1; 0 <= lvl; lvl--)
+    {
+        unsigned int up = lvl + 1;
+        node_t *bound = up < me->levels ? n->next[up] : NULL;
+
+        /* split a full gap by raising its middle node. The gap above us has
+         * room, because we split it on the way down if it was full */
+        if (3 <= __gap(n, bound, lvl, 3) && up < me->max_levels &&
+            0 == __raise(me, n->next[lvl]->next[lvl], n, up) &&
+            up == me->levels)
+            me->levels++;
+
+        while (1)
+        {
+            node_t *r = n->next[lvl];
+            long c = r ? __cmpn(me, key, kp, r) : -1;
+
+            if (c < 0)
+                break;
+            if (0 == c && !(me->flags & SKIPLIST_MULTIMAP))
+            {
+                *v_old = r->ety.v;
+                r->ety.v = val;
+                __set_expiry(me, r, expires);
+                return NULL;
+            }
+            __STAT(me, visits);
+            n = r;
+        }
+    }
+
+    if (!(new = __allocnode(me, 1)))
+        return NULL;
+    new->ety.k = key;
+    new->ety.v = val;
+    new->prefix = kp;
+    __set_expiry(me, new, expires);
+    __swap(n, new, 0);
+    __backlink(n);
+    __backlink(new);
+    me->count++;
+    return new;
+}
+
+/**
+ * We're at n on line lvl + 1 and about to drop into the gap below it. If the
+ * gap has less than 2 nodes, widen it by borrowing a node from a neighbouring
+ * gap, or by merging with the neighbour.
+ * @param prev n's predecessor on line lvl + 1, otherwise NULL
+ * @return node to carry on from */
+static node_t *__det_widen(
+    skiplist_t * me,
+    node_t *n,
+    node_t *prev,
+    unsigned int lvl)
+{
+    unsigned int up = lvl + 1;
+    node_t *s = n->next[up];
+
+    if (1 < __gap(n, s, lvl, 2))
+        return n;
+
+    /* s separates us from the gap on our right */
+    if (s && s->levels == up + 1)
+    {
+        node_t *first = s->next[lvl];
+        unsigned int g = __gap(s, s->next[up], lvl, 2);
+
+        __lower(s, n);
+        if (2 <= g)
+            __raise(me, first, n, up);
+        return n;
+    }
+
+    /* we're the last gap under our parent; use the gap on our left */
+    if (prev && n->levels == up + 1)
+    {
+        node_t *last = prev;
+        unsigned int g = __gap(prev, n, lvl, 2);
+
+        while (last->next[lvl] != n)
+            last = last->next[lvl];
+
+        __lower(n, prev);
+        if (2 <= g && 0 == __raise(me, last, prev, up))
+            return last;
+        return prev;
+    }
+    return n;
+}
+
+static node_t *__det_remove(skiplist_t * me, const void *key)
+{
+    uint64_t kp = __prefix(me, key);
+    node_t *n = me->nil, *prev = NULL, *z;
+    int lvl;
+
+    for (lvl = me->levels - 1; 0 <= lvl; lvl--)
+    {
+        if (lvl + 1 < (int)me->levels)
+            n = __det_widen(me, n, prev, lvl);
+
+        prev = NULL;
+        while (n->next[lvl] && 0 < __cmpn(me, key, kp, n->next[lvl]))
+        {
+            __STAT(me, visits);
+            prev = n;
+            n = n->next[lvl];
+        }
+    }
+
+    z = n->next[0];
+    if (!z || 0 != __cmpn(me, key, kp, z))
+    {
+        z = NULL;
+    }
+    else if (1 == z->levels)
+    {
+        n->next[0] = z->next[0];
+        __backlink(n);
+    }
+    /* z is holding up express lines. Widening made sure its predecessor is
+     * only on the bottom line, so swap items with it and remove that instead */
+    else if (prev && 1 == n->levels)
+    {
+        __swap_items(z, n);
+        prev->next[0] = z;
+        __backlink(prev);
+        z = n;
+    }
+    /* only reachable if we ran out of memory while raising a node */
+    else
+    {
+        node_t *pred[SKIPLIST_MAX_LEVELS];
+        __find_preds(me, key, pred);
+        for (lvl = 0; lvl < (int)z->levels; lvl++)
+            if (pred[lvl]->next[lvl] == z)
+                pred[lvl]->next[lvl] = z->next[lvl];
+        __backlink(pred[0]);
+    }
+
+    __trim_levels(me);
+    return z;
+}
+
+static void *__put_item(
+    skiplist_t *me,
+    void *key,
+    void *val,
+    uint64_t expires
+)
+{
+    __STAT(me, ops);
+
+    if (!key || __unshare(me, 1))
+        return NULL;
+
+    unsigned int put_depth = 0, count = me->count;
+    uint64_t kp = __prefix(me, key);
+    void* v = NULL;
+    if (me->flags & SKIPLIST_DETERMINISTIC)
+        __det_put(me, key, kp, val, expires, &v);
+    else
+        __put(me, key, kp, val, expires, me->levels - 1, me->nil, &put_depth,
+              &v);
+
+    /* a replaced value doesn't add a key */
+    if (count != me->count)
+    {
+        __bloom_add(me, key);
+        __bloom_grow(me);
+    }
+    return v;
+}
+
+void *skiplist_put(
+    skiplist_t *me,
+    void *key,
+    void *val
+)
+{
+    return __put_item(me, key, val, 0);
+}
+
+/**
+ * Find key's item in one descent and let fn update it. Without one, fn makes
+ * the value for a new item, which is put on the path the descent took
+ * @param insert 0 to leave a missing item missing
+ * @return 1 if put, 0 if updated; otherwise -1 if not there (and not to be
+ *  put) or out of memory */
+static int __upsert(
+    skiplist_t * me,
+    void *key,
+    func_upsert_f fn,
+    void *udata,
+    int insert)
+{
+    node_t *pred[SKIPLIST_MAX_LEVELS], *r, *new;
+    unsigned int lvl, levels, put_depth, count;
+    skiplist_entry_t ety;
+    uint64_t kp;
+    void *v = NULL;
+
+    __STAT(me, ops);
+
+    if (!key)
+        return -1;
+    if (!insert && me->bloom &&
+        !skiplist_bloom_maybe(me->bloom, me->hash(key, me->udata)))
+    {
+        __STAT(me, filtered);
+        return -1;
+    }
+    if (__unshare(me, 1))
+        return -1;
+
+    kp = __prefix(me, key);
+
+    /* an expired item is as good as gone */
+    while (1)
+    {
+        if (me->flags & SKIPLIST_DETERMINISTIC)
+            r = __lower_bound(me, key);
+        else
+        {
+            __find_preds(me, key, pred);
+            r = pred[0]->next[0];
+        }
+        if (r && 0 != __cmpn(me, key, kp, r))
+            r = NULL;
+        if (!r || !__expired(me, r))
+            break;
+        if (__evict(me, r))
+            return -1;
+    }
+
+    ety.k = key;
+    if (r)
+    {
+        ety.v = r->ety.v;
+        fn(&ety, 1, udata);
+        r->ety.v = ety.v;
+        return 0;
+    }
+    if (!insert)
+        return -1;
+
+    ety.v = NULL;
+    fn(&ety, 0, udata);
+
+    /* 1-2-3 lists keep their shape by widening gaps on the way down, which
+     * the path we have didn't do */
+    if (me->flags & SKIPLIST_DETERMINISTIC)
+    {
+        count = me->count;
+        __det_put(me, key, kp, ety.v, 0, &v);
+        if (count == me->count)
+            return -1;
+    }
+    else
+    {
+        levels = me->levels;
+        if (!(new = __place(me, key, kp, ety.v, 0, pred[0], &put_depth)))
+            return -1;
+        for (lvl = 1; lvl < put_depth && lvl < levels; lvl++)
+            __swap(pred[lvl], new, lvl);
+    }
+
+    __bloom_add(me, key);
+    __bloom_grow(me);
+    return 1;
+}
+
+int skiplist_upsert(
+    skiplist_t * me,
+    void *key,
+    func_upsert_f fn,
+    void *udata)
+{
+    return __upsert(me, key, fn, udata, 1);
+}
+
+/**
+ * Keep the item that's there, and tell the caller what it holds */
+static void __if_absent(skiplist_entry_t *ety, int found, void *udata)
+{
+    void **val = udata;
+
+    if (found)
+        *val = ety->v;
+    else
+    {
+        ety->v = *val;
+        *val = NULL;
+    }
+}
+
+void *skiplist_put_if_absent(skiplist_t * me, void *key, void *val)
+{
+    if (-1 == __upsert(me, key, __if_absent, &val, 1))
+        return NULL;
+    return val;
+}
+
+typedef struct {
+    void *expected, *val;
+    int replaced;
+} cas_t;
+
+static void __cas(skiplist_entry_t *ety, int found, void *udata)
+{
+    cas_t *c = udata;
+
+    if (found && ety->v == c->expected)
+    {
+        ety->v = c->val;
+        c->replaced = 1;
+    }
+}
+
+int skiplist_compare_and_replace(
+    skiplist_t * me,
+    void *key,
+    void *expected,
+    void *val)
+{
+    cas_t c = { .expected = expected, .val = val, .replaced = 0 };
+
+    __upsert(me, key, __cas, &c, 0);
+    return c.replaced ? 0 : -1;
+}
+
+#ifdef SKIPLIST_TTL
+void *skiplist_put_expiry(
+    skiplist_t * me,
+    void *key,
+    void *val,
+    uint64_t expires)
+{
+    return __put_item(me, key, val, expires);
+}
+#endif
+
+void *skiplist_finger_put(
+    skiplist_t * me,
+    skiplist_finger_t * finger,
+    void *key,
+    void *val)
+{
+    if (me->flags & (SKIPLIST_MULTIMAP | SKIPLIST_DETERMINISTIC))
+        return skiplist_put(me, key, val);
+
+    __STAT(me, ops);
+
+    /* taking a copy of shared nodes leaves the path on the old ones */
+    int stale = finger->version != me->version || me->shared;
+    if (!key || __unshare(me, 1))
+        return NULL;
+    if (stale)
+        finger->pred[0] = NULL;
+    finger->version = me->version;
+
+    uint64_t kp = __prefix(me, key);
+    node_t **pred = finger->pred, *r, *new;
+    unsigned int lvl, levels = me->levels, put_depth;
+
+    __finger_search(me, finger, key, kp);
+    r = pred[0]->next[0];
+    if (r && 0 == __cmpn(me, key, kp, r))
+    {
+        void *v = r->ety.v;
+        r->ety.v = val;
+        __set_expiry(me, r, 0);
+        return v;
+    }
+
+    if (!(new = __place(me, key, kp, val, 0, pred[0], &put_depth)))
+        return NULL;
+    for (lvl = 1; lvl < put_depth; lvl++)
+        if (lvl < levels)
+            __swap(pred[lvl], new, lvl);
+        else
+            pred[lvl] = me->nil;
+
+    __bloom_add(me, key);
+    __bloom_grow(me);
+    return NULL;
+}
+
+static node_t *__remove(
+    skiplist_t * me,
+    const void *key,
+    uint64_t kp,
+    unsigned int lvl,
+    node_t *prev)
+{
+    node_t *n = prev;
+
+    while (1)
+    {
+        node_t *r = n->next[lvl];
+        long c = r ? __cmpn(me, key, kp, r) : -1;
+
+        if (0 < c)
+        {
+            __STAT(me, visits);
+            n = r;
+            continue;
+        }
+
+        node_t* removed;
+        if (0 == lvl)
+            removed = c == 0 ? r : NULL;
+        else
+            removed = __remove(me, key, kp, lvl-1, n);
+
+        if (removed && r == removed)
+        {
+            n->next[lvl] = removed->next[lvl];
+            if (0 == lvl)
+                __backlink(n);
+        }
+        return removed;
+    }
+}
+
+static void __release(skiplist_t * me, node_t* removed)
+{
+    __forget_expiry(me, removed);
+    __free_node(me, removed);
+    me->count--;
+    __trim_levels(me);
+}
+
+void *skiplist_remove(
+    skiplist_t * me,
+    const void *key
+)
+{
+    __STAT(me, ops);
+
+    if (0 == skiplist_count(me) || !key)
+        return NULL;
+
+    /* no need to search, or to take a copy of shared nodes, for nothing */
+    if (me->bloom && !skiplist_bloom_maybe(me->bloom, me->hash(key, me->udata)))
+    {
+        __STAT(me, filtered);
+        return NULL;
+    }
+
+    if (__unshare(me, 1))
+        return NULL;
+
+    node_t* removed = me->flags & SKIPLIST_DETERMINISTIC ?
+        __det_remove(me, key) :
+        __remove(me, key, __prefix(me, key), me->levels - 1, me->nil);
+    if (removed)
+    {
+        void* v = removed->ety.v;
+        __bloom_remove(me, removed->ety.k);
+        __release(me, removed);
+        return v;
+    }
+    return NULL;
+}
+
+void *skiplist_pop_min(skiplist_t * me)
+{
+    node_t *n;
+    unsigned int lvl;
+
+    __STAT(me, ops);
+
+    if (0 == skiplist_count(me) || __unshare(me, 1))
+        return NULL;
+    n = me->nil->next[0];
+
+    /* the balancing rules need a search from the top to rebalance on */
+    if (me->flags & SKIPLIST_DETERMINISTIC)
+        return skiplist_remove(me, n->ety.k);
+
+    /* the head is first on every line it's on, so no search is needed */
+    for (lvl = 0; lvl < n->levels; lvl++)
+        me->nil->next[lvl] = n->next[lvl];
+    __backlink(me->nil);
+
+    void* v = n->ety.v;
+    __bloom_remove(me, n->ety.k);
+    __release(me, n);
+    return v;
+}
+
+int skiplist_remove_item(
+    skiplist_t * me,
+    const void *key,
+    const void *val
+)
+{
+    node_t *n;
+    unsigned int at = 0;
+    uint64_t kp;
+
+    if (0 == skiplist_count(me) || !key)
+        return 0;
+
+    kp = __prefix(me, key);
+    for (n = __lower_bound(me, key); n && 0 == __cmpn(me, key, kp, n);
+         n = n->next[0], at++)
+        if (n->ety.v == val)
+            return 0 == __remove_at(me, key, at);
+    return 0;
+}
+
+int skiplist_change_key(
+    skiplist_t * me,
+    const void *key,
+    void *val,
+    void *newkey
+)
+{
+    if (!newkey || !skiplist_remove_item(me, key, val))
+        return -1;
+    skiplist_put(me, newkey, val);
+    return 0;
+}
+
+int skiplist_remove_all(
+    skiplist_t * me,
+    const void *key
+)
+{
+    return skiplist_remove_range(me, key, key, NULL, NULL);
+}
+
+int skiplist_count_equal(
+    skiplist_t * me,
+    const void *key
+)
+{
+    skiplist_iterator_t iter;
+    int n = 0;
+
+    skiplist_iterator_equal(me, key, &iter);
+    for (; skiplist_iterator_next(me, &iter); n++);
+    return n;
+}
+
+void skiplist_iterator(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    iter->current = me->nil->next[0];
+    iter->last = NULL;
+    iter->end = NULL;
+}
+
+void skiplist_iterator_from(
+    skiplist_t * me,
+    const void *key,
+    skiplist_iterator_t * iter
+)
+{
+    iter->current = key ? __lower_bound(me, key) : me->nil->next[0];
+    iter->last = NULL;
+    iter->end = NULL;
+}
+
+void skiplist_iterator_equal(
+    skiplist_t * me,
+    const void *key,
+    skiplist_iterator_t * iter
+)
+{
+    iter->current = key ? __lower_bound(me, key) : NULL;
+    iter->last = key;
+    iter->end = NULL;
+}
+
+int skiplist_iterator_has_next(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    /* step over expired items, but leave evicting them to get */
+    while (iter->current && iter->current != iter->end &&
+           __expired(me, iter->current))
+        iter->current = iter->current->next[0];
+    if (!iter->current || iter->current == iter->end)
+        return 0;
+    if (iter->last && 0 < __cmp(me, iter->current->ety.k, iter->last))
+        return 0;
+    return 1;
+}
+
+static node_t *__iterator_next(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    node_t *n;
+
+    /* has_next may step over expired items, so look after it */
+    if (!skiplist_iterator_has_next(me, iter))
+        return NULL;
+    n = iter->current;
+
+    /* move on now, in case the caller removes this item */
+    iter->current = n->next[0];
+    return n;
+}
+
+void *skiplist_iterator_next(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    node_t *n = __iterator_next(me, iter);
+    return n ? n->ety.k : NULL;
+}
+
+void *skiplist_iterator_next_value(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    node_t *n = __iterator_next(me, iter);
+    return n ? n->ety.v : NULL;
+}
+
+/**
+ * @return node before n on the bottom line, otherwise NULL */
+static node_t *__prev(skiplist_t * me, node_t *n)
+{
+#ifdef SKIPLIST_BACKLINKS
+    node_t *p = n->prev;
+#else
+    node_t *p = __last_before(me, n->ety.k, 0);
+
+    /* step over equal keys that came before n */
+    while (p->next[0] != n)
+        p = p->next[0];
+#endif
+    return p == me->nil ? NULL : p;
+}
+
+void skiplist_iterator_reverse(
+    skiplist_t * me,
+    const void *hi,
+    const void *lo,
+    skiplist_iterator_t * iter
+)
+{
+    node_t *n = hi ? __last_before(me, hi, 1) : __last(me);
+
+    iter->current = n == me->nil ? NULL : n;
+    iter->last = lo;
+    iter->end = NULL;
+}
+
+int skiplist_iterator_has_prev(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    while (iter->current && __expired(me, iter->current))
+        iter->current = __prev(me, iter->current);
+    if (!iter->current)
+        return 0;
+    if (iter->last && __cmp(me, iter->current->ety.k, iter->last) < 0)
+        return 0;
+    return 1;
+}
+
+static node_t *__iterator_prev(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    node_t *n;
+
+    /* has_prev may step over expired items, so look after it */
+    if (!skiplist_iterator_has_prev(me, iter))
+        return NULL;
+    n = iter->current;
+
+    /* move on now, in case the caller removes this item */
+    iter->current = __prev(me, n);
+    return n;
+}
+
+void *skiplist_iterator_prev(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    node_t *n = __iterator_prev(me, iter);
+    return n ? n->ety.k : NULL;
+}
+
+void *skiplist_iterator_prev_value(
+    skiplist_t * me,
+    skiplist_iterator_t * iter
+)
+{
+    node_t *n = __iterator_prev(me, iter);
+    return n ? n->ety.v : NULL;
+}
+
+/**
+ * Record the last node on every line
+ * @return last node on the bottom line, otherwise NULL if empty */
+static node_t *__find_tails(skiplist_t * me, node_t **tail)
+{
+    node_t *n = me->nil;
+    int lvl;
+
+    for (lvl = me->max_levels - 1; 0 <= lvl; lvl--)
+    {
+        if (lvl < (int)me->levels)
+            while (n->next[lvl])
+                n = n->next[lvl];
+        tail[lvl] = n;
+    }
+    return n == me->nil ? NULL : n;
+}
+
+/**
+ * Other's items are moving to us, so their expiry times come too
+ * @return 0 on success, otherwise -1 if out of memory */
+static int __take_expiry(skiplist_t * me, skiplist_t * other)
+{
+    if (!other->expiry)
+        return 0;
+    if (!me->expiry)
+    {
+        me->expiry = other->expiry;
+        other->expiry = NULL;
+        return 0;
+    }
+    return skiplist_merge(me->expiry, other->expiry);
+}
+
+/**
+ * Forget every item without freeing it; they've been moved elsewhere */
+static void __disown(skiplist_t * me)
+{
+    unsigned int i;
+    for (i=0; i<me->levels; i++)
+        me->nil->next[i] = NULL;
+    me->levels = 1;
+    me->count = 0;
+    me->compact_next = NULL;
+    if (me->bloom)
+        skiplist_bloom_clear(me->bloom);
+    if (me->expiry)
+        skiplist_clear(me->expiry);
+}
+
+int skiplist_remove_range(
+    skiplist_t * me,
+    const void *lo,
+    const void *hi,
+    func_entry_f cb,
+    void *udata)
+{
+    node_t *pred[SKIPLIST_MAX_LEVELS];
+    node_t *n;
+    unsigned int lvl;
+    uint64_t hp;
+    int removed = 0;
+
+    __STAT(me, ops);
+
+    if (0 == skiplist_count(me) || !lo || !hi || __unshare(me, 1))
+        return 0;
+    hp = __prefix(me, hi);
+
+    /* one at a time, so that every gap stays in shape */
+    if (me->flags & SKIPLIST_DETERMINISTIC)
+    {
+        while ((n = __lower_bound(me, lo)) && 0 <= __cmpn(me, hi, hp, n))
+        {
+            n = __det_remove(me, n->ety.k);
+            __bloom_remove(me, n->ety.k);
+            if (cb)
+                cb(&n->ety, udata);
+            __release(me, n);
+            removed++;
+        }
+        return removed;
+    }
+
+    __find_preds(me, lo, pred);
+
+    /* cut the run out of each express line in one go. The bottom line is
+     * left until last; we need it to visit the removed nodes */
+    for (lvl = me->levels - 1; 0 < lvl; lvl--)
+    {
+        for (n = pred[lvl]->next[lvl];
+             n && 0 <= __cmpn(me, hi, hp, n);
+             n = n->next[lvl]);
+        pred[lvl]->next[lvl] = n;
+    }
+
+    n = pred[0]->next[0];
+    while (n && 0 <= __cmpn(me, hi, hp, n))
+    {
+        node_t *next = n->next[0];
+        __bloom_remove(me, n->ety.k);
+        __forget_expiry(me, n);
+        if (cb)
+            cb(&n->ety, udata);
+        __free_node(me, n);
+        n = next;
+        removed++;
+    }
+    pred[0]->next[0] = n;
+    __backlink(pred[0]);
+
+    me->count -= removed;
+    __trim_levels(me);
+    return removed;
+}
+
+skiplist_t *skiplist_split(skiplist_t * me, const void *key)
+{
+    node_t *pred[SKIPLIST_MAX_LEVELS];
+    skiplist_opts_t opts = {
+        .max_levels = me->max_levels,
+        .flags = me->flags,
+        .pool = me->pool,
+        .prefix = me->prefix,
+        .hash = me->hash,
+        .clock = me->clock,
+        .on_expire = me->on_expire,
+        .expire_udata = me->expire_udata
+    };
+    skiplist_t *upper;
+    unsigned int lvl, n = 0;
+
+    if (!key || __unshare(me, 1) ||
+        !(upper = skiplist_new_opts(me->cmp, me->udata, &opts)))
+        return NULL;
+
+    __find_preds(me, key, pred);
+
+    for (lvl = 0; lvl < me->levels; lvl++)
+    {
+        upper->nil->next[lvl] = pred[lvl]->next[lvl];
+        pred[lvl]->next[lvl] = NULL;
+    }
+    __backlink(upper->nil);
+    upper->levels = me->levels;
+    me->compact_next = NULL;
+    __trim_levels(me);
+    __trim_levels(upper);
+
+    /* walk both halves together, so counting costs the smaller half */
+    node_t *a = me->nil->next[0], *b = upper->nil->next[0];
+    for (; a && b; a = a->next[0], b = b->next[0], n++);
+    upper->count = b ? me->count - n : n;
+    me->count -= upper->count;
+
+    /* the upper half's keys go with it. Without a filter of its own, upper
+     * makes do with none */
+    if (me->bloom)
+    {
+        for (b = upper->nil->next[0]; b; b = b->next[0])
+            __bloom_remove(me, b->ety.k);
+        __bloom_refill(upper);
+    }
+
+#ifdef SKIPLIST_TTL
+    /* so do their expiry times */
+    if (me->expiry)
+        for (b = upper->nil->next[0]; b; b = b->next[0])
+            if (b->expires)
+            {
+                skiplist_remove_item(me->expiry, (void *)(uintptr_t)b->expires,
+                                     b->ety.k);
+                if (__index(upper, b->expires, b->ety.k))
+                    b->expires = 0;
+            }
+#endif
+
+    /* the cut leaves ragged gaps at the ends of both halves */
+    if (me->flags & SKIPLIST_DETERMINISTIC)
+    {
+        skiplist_rebuild(me, 0);
+        skiplist_rebuild(upper, 0);
+    }
+    return upper;
+}
+
+/**
+ * Hang other's towers off the end of me's. Every key in other must sort after
+ * every key in me */
+static void __splice(skiplist_t * me, skiplist_t * other, node_t **tail)
+{
+    unsigned int lvl, levels = other->levels;
+
+    /* other may allow taller towers than we do. Lowering them leaves their
+     * capacity, so they're still freed whole */
+    if (me->max_levels < levels)
+    {
+        node_t *n;
+        for (n = other->nil->next[me->max_levels]; n; n = n->next[me->max_levels])
+            n->levels = me->max_levels;
+        levels = me->max_levels;
+    }
+
+    for (lvl = 0; lvl < levels; lvl++)
+        tail[lvl]->next[lvl] = other->nil->next[lvl];
+    __backlink(tail[0]);
+    if (me->levels < levels)
+        me->levels = levels;
+    me->count += other->count;
+    __disown(other);
+}
+
+int skiplist_join(skiplist_t * me, skiplist_t * other)
+{
+    node_t *tail[SKIPLIST_MAX_LEVELS];
+    node_t *last, *first;
+
+    if (me->pool != other->pool || me->prefix != other->prefix ||
+        me->hash != other->hash || __unshare(me, 1) || __unshare(other, 1))
+        return -1;
+
+    last = __find_tails(me, tail);
+    first = other->nil->next[0];
+
+    if (last && first)
+    {
+        long c = __cmp_nodes(me, last, first);
+        if (0 < c || (0 == c && !(me->flags & SKIPLIST_MULTIMAP)))
+            return -1;
+    }
+
+    if (__take_expiry(me, other))
+        return -1;
+    __splice(me, other, tail);
+    if (me->bloom)
+    {
+        node_t *n;
+        for (n = first; n; n = n->next[0])
+            __bloom_add(me, n->ety.k);
+        __bloom_grow(me);
+    }
+    if (me->flags & SKIPLIST_DETERMINISTIC)
+        skiplist_rebuild(me, 0);
+    return 0;
+}
+
+int skiplist_merge(skiplist_t * me, skiplist_t * other)
+{
+    node_t *tail[SKIPLIST_MAX_LEVELS];
+    node_t *a, *b;
+    unsigned int lvl, levels = 1, count = 0;
+
+    /* disjoint lists only need their towers spliced */
+    if (0 == skiplist_join(me, other))
+        return 0;
+    if (me->pool != other->pool || me->prefix != other->prefix ||
+        me->hash != other->hash || __unshare(me, 1) || __unshare(other, 1) ||
+        __take_expiry(me, other))
+        return -1;
+
+    a = me->nil->next[0];
+    b = other->nil->next[0];
+    for (lvl = 0; lvl < me->max_levels; lvl++)
+        tail[lvl] = me->nil;
+
+    /* relink both bottom lines into one, rebuilding the express lines from
+     * the towers as we go. Each node's successor is read before it's linked,
+     * so relinking never gets in the way of the walk */
+    while (a || b)
+    {
+        node_t *n;
+        long c = !a ? 1 : !b ? -1 : __cmp_nodes(me, a, b);
+
+        if (c < 0 || (0 == c && (me->flags & SKIPLIST_MULTIMAP)))
+        {
+            n = a;
+            a = a->next[0];
+        }
+        else if (0 < c)
+        {
+            n = b;
+            b = b->next[0];
+            __bloom_add(me, n->ety.k);
+        }
+        /* equal keys: other's value wins, as if it had been put */
+        else
+        {
+            node_t *dup = b;
+            uint64_t expires = 0;
+            b = b->next[0];
+            a->ety.v = dup->ety.v;
+#ifdef SKIPLIST_TTL
+            expires = dup->expires;
+#endif
+            /* dup's expiry time came over with the rest of other's */
+            __forget_expiry(me, dup);
+            __set_expiry(me, a, expires);
+            __free_node(me, dup);
+            n = a;
+            a = a->next[0];
+        }
+
+        if (me->max_levels < n->levels)
+            n->levels = me->max_levels;
+        for (lvl = 0; lvl < n->levels; lvl++)
+        {
+            tail[lvl]->next[lvl] = n;
+            if (0 == lvl)
+                __backlink(tail[0]);
+            tail[lvl] = n;
+        }
+        if (levels < n->levels)
+            levels = n->levels;
+        count++;
+    }
+
+    for (lvl = 0; lvl < levels; lvl++)
+        tail[lvl]->next[lvl] = NULL;
+    me->levels = levels;
+    me->count = count;
+    __disown(other);
+    __bloom_grow(me);
+    if (me->flags & SKIPLIST_DETERMINISTIC)
+        skiplist_rebuild(me, 0);
+    return 0;
+}
+
+int skiplist_stats(skiplist_t * me, skiplist_stats_t * stats)
+{
+    node_t *n;
+    unsigned int lvl;
+
+#ifdef SKIPLIST_STATS
+    stats->cmps = __STAT_LOAD(me, cmps);
+    stats->visits = __STAT_LOAD(me, visits);
+    stats->ops = __STAT_LOAD(me, ops);
+    stats->filtered = __STAT_LOAD(me, filtered);
+    stats->expired = __STAT_LOAD(me, expired);
+    stats->allocs = __STAT_LOAD(me, allocs);
+    stats->frees = __STAT_LOAD(me, frees);
+#else
+    memset(stats, 0, sizeof(skiplist_stats_t));
+#endif
+
+    /* the tower histograms are cheap to keep up to date on put and remove,
+     * but not on split and join, so they're worked out here instead */
+    memset(stats->heights, 0, sizeof(stats->heights));
+    memset(stats->nodes_per_level, 0, sizeof(stats->nodes_per_level));
+    for (n = me->nil->next[0]; n; n = n->next[0])
+        stats->heights[n->levels - 1]++;
+    for (lvl = me->max_levels; 0 < lvl; lvl--)
+        stats->nodes_per_level[lvl - 1] = stats->heights[lvl - 1] +
+            (lvl < me->max_levels ? stats->nodes_per_level[lvl] : 0);
+
+#ifdef SKIPLIST_STATS
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void skiplist_stats_reset(skiplist_t * me)
+{
+#ifdef SKIPLIST_STATS
+    memset(&me->stats, 0, sizeof(skiplist_stats_t));
+#else
+    (void)me;
+#endif
+}
+
+/**
+ * @return bytes that an allocation of size takes up */
+static size_t __footprint(skiplist_t * me, size_t size)
+{
+    if (!me->pool)
+        return size;
+    return (size + SKIPLIST_POOL_GRAIN - 1) & ~(size_t)(SKIPLIST_POOL_GRAIN - 1);
+}
+
+void skiplist_memory_usage(skiplist_t * me, skiplist_memory_t * mem)
+{
+    node_t *n;
+
+    memset(mem, 0, sizeof(skiplist_memory_t));
+    for (n = me->nil->next[0]; n; n = n->next[0])
+    {
+        mem->nodes += __footprint(me, sizeof(node_t));
+        mem->towers += __footprint(me, sizeof(node_t*) * n->capacity);
+    }
+    mem->sentinel = sizeof(skiplist_t) +
+        __footprint(me, sizeof(node_t)) +
+        __footprint(me, sizeof(node_t*) * me->nil->capacity);
+    if (me->bloom)
+        mem->bloom = skiplist_bloom_bytes(me->bloom);
+    if (me->expiry)
+    {
+        skiplist_memory_t index;
+        skiplist_memory_usage(me->expiry, &index);
+        mem->expiry = index.total;
+    }
+    if (me->pool)
+        mem->pool_slack = skiplist_pool_slack(me->pool);
+    mem->total = mem->nodes + mem->towers + mem->sentinel + mem->bloom +
+        mem->expiry + mem->pool_slack;
+}
+
+/**
+ * @return 1 if n sits right after the end of p's tower, as it would if
+ *  they'd been carved from the pool one after the other */
+static int __follows(skiplist_t * me, node_t *p, node_t *n)
+{
+    uintptr_t end = (uintptr_t)(p->next + p->capacity);
+    return (uintptr_t)n - end < __footprint(me, 1);
+}
+
+/**
+ * Move n to the end of the pool's newest slab, with its tower right after it.
+ * pred holds the last node before n on each of its lines
+ * @return n's new home, otherwise NULL if out of memory */
+static node_t *__relocate(skiplist_t * me, node_t *n, node_t **pred)
 {
-    free(n->next);
-    free(n);
+    node_t *c, **next;
+    unsigned int lvl;
+
+    if (!(c = skiplist_pool_carve(me->pool, sizeof(node_t))))
+        return NULL;
+    if (!(next = skiplist_pool_carve(me->pool, sizeof(node_t*) * n->levels)))
+    {
+        skiplist_pool_release(me->pool, c, sizeof(node_t));
+        return NULL;
+    }
+    __STAT(me, allocs);
+    *c = *n;
+    c->next = next;
+    c->capacity = n->levels;
+    memcpy(next, n->next, sizeof(node_t*) * n->levels);
+    for (lvl = 0; lvl < n->levels; lvl++)
+        pred[lvl]->next[lvl] = c;
+    __backlink(c);
+    __free_node(me, n);
+    return c;
+}
+
+int skiplist_compact(skiplist_t * me, unsigned int max)
+{
+    node_t *pred[SKIPLIST_MAX_LEVELS];
+    node_t *n, *m;
+    unsigned int lvl;
+
+    if (!me->pool || __unshare(me, 1))
+        return -1;
+
+    /* the path to where the pass left off. With equal keys, that's somewhere
+     * in the run after the preds of the run's first node */
+    if ((n = me->compact_next))
+    {
+        __find_preds(me, n->ety.k, pred);
+        for (m = pred[0]->next[0]; m != n; m = m->next[0])
+            for (lvl = 0; lvl < m->levels; lvl++)
+                pred[lvl] = m;
+    }
+    else
+    {
+        n = me->nil->next[0];
+        for (lvl = 0; lvl < me->max_levels; lvl++)
+            pred[lvl] = me->nil;
+    }
+
+    for (; n && 0 < max; max--)
+    {
+        /* a node heading a packed run stays put, so that a second pass over
+         * a packed list doesn't move everything again */
+        if (!__follows(me, pred[0], n) &&
+            !(n->next[0] && __follows(me, n, n->next[0])))
+        {
+            node_t *c = __relocate(me, n, pred);
+            if (!c)
+            {
+                me->compact_next = n;
+                return -1;
+            }
+            n = c;
+        }
+        for (lvl = 0; lvl < n->levels; lvl++)
+            pred[lvl] = n;
+        n = n->next[0];
+    }
+
+    me->compact_next = n;
+    return n ? 0 : 1;
+}
+
+/**
+ * Average comparisons a get makes to find each item. Worked out in one walk of
+ * the bottom line: run[j] counts the nodes on line j since the last node that
+ * was also on line j + 1, which is exactly how far a search steps along line
+ * j before it either drops down or finds its key */
+static double __search_cost(skiplist_t * me)
+{
+    unsigned int run[SKIPLIST_MAX_LEVELS] = { 0 };
+    unsigned int lvl;
+    double total = 0;
+    node_t *n;
+
+    if (0 == me->count)
+        return 0;
+
+    for (n = me->nil->next[0]; n; n = n->next[0])
+    {
+        unsigned int top = n->levels - 1;
+
+        for (lvl = top; lvl < me->levels; lvl++)
+            total += run[lvl] + 1;
+
+        run[top]++;
+        for (lvl = 0; lvl < top; lvl++)
+            run[lvl] = 0;
+    }
+    return total / me->count;
 }
 
-static node_t* __allocnode(unsigned int levels)
+/**
+ * Check the lines nil's tower is on */
+static int __validate_shape(skiplist_t * me)
 {
-    node_t* n;
+    unsigned int lvl;
 
-    if (!(n = calloc(1, sizeof(node_t))))
-        return NULL;
-    if (!(n->next = calloc(1, sizeof(node_t*) * levels)))
-        return NULL;
-    return n;
+    if (0 == me->levels || me->max_levels < me->levels ||
+        SKIPLIST_MAX_LEVELS < me->max_levels)
+        return -1;
+
+    /* lines above the top are empty, and the top line isn't */
+    for (lvl = me->levels; lvl < me->max_levels; lvl++)
+        if (me->nil->next[lvl])
+            return -1;
+    if (1 < me->levels && !me->nil->next[me->levels - 1])
+        return -1;
+    return 0;
 }
 
-skiplist_t *skiplist_new(func_longcmp_f cmp, const void* userdata)
+/**
+ * Check lines from up to (not including) to, for the nodes after start up to
+ * and including end. Both start and end must be on each of those lines; end
+ * may be NULL to carry on to the end of the line.
+ * @param count Nodes checked on the bottom line are added to this
+ * @return 0 if intact; otherwise -1 */
+static int __validate_lines(
+    skiplist_t * me,
+    node_t *start,
+    node_t *end,
+    unsigned int from,
+    unsigned int to,
+    unsigned int *count)
 {
-    skiplist_t *me;
+    unsigned int lvl;
+    node_t *n;
 
-    me = calloc(1, sizeof(skiplist_t));
-    me->udata = userdata;
-    me->cmp = cmp;
-    me->levels = 1;
-    me->nil = __allocnode(me->levels);
-    return me;
-}
+    /* bottom line up, so each line can be checked against the one below */
+    for (lvl = from; lvl < to; lvl++)
+    {
+        node_t *prev = start == me->nil ? NULL : start;
+        node_t *below = lvl ? start->next[lvl - 1] : NULL;
+        unsigned int gap = 0;
 
-int skiplist_count(const skiplist_t * me)
-{
-    return me->count;
-}
+        for (n = start->next[lvl];
+             end ? prev != end : NULL != n;
+             prev = n, n = n->next[lvl])
+        {
+            if (!n || n->levels <= lvl || me->max_levels < n->levels)
+                return -1;
 
-void skiplist_clear(
-    skiplist_t * me
-)
-{
-    unsigned int i;
-    for (i=0; i<me->levels; i++)
-        me->nil->next[i] = NULL;
-    me->count = 0;
+            /* deterministic lists promise no more than 3 nodes per gap. The
+             * top line can only grow past that once out of lines */
+            gap = n->levels == lvl + 1 ? gap + 1 : 0;
+            if ((me->flags & SKIPLIST_DETERMINISTIC) && 3 < gap &&
+                (lvl + 1 < me->levels || me->levels < me->max_levels))
+                return -1;
+
+            if (prev)
+            {
+                long c = __cmp_nodes(me, prev, n);
+                if (0 < c || (0 == c && !(me->flags & SKIPLIST_MULTIMAP)))
+                    return -1;
+            }
+
+            if (0 == lvl)
+            {
+                if (n->prefix != __prefix(me, n->ety.k))
+                    return -1;
+                if (me->bloom && !skiplist_bloom_maybe(me->bloom,
+                                                       me->hash(n->ety.k, me->udata)))
+                    return -1;
+#ifdef SKIPLIST_BACKLINKS
+                if (n->prev != (prev ? prev : me->nil))
+                    return -1;
+#endif
+                (*count)++;
+                continue;
+            }
+
+            /* an express line may only contain nodes from the line below */
+            for (; below != n; below = below->next[lvl - 1])
+                if (!below)
+                    return -1;
+        }
+    }
+    return 0;
 }
 
-void skiplist_free(
-    skiplist_t * me
-)
+/**
+ * @return 0 if the expiry index holds as many items as have an expiry time,
+ *  otherwise -1 */
+static int __validate_expiry(skiplist_t * me)
 {
-    skiplist_clear(me);
+#ifdef SKIPLIST_TTL
+    node_t *n;
+    unsigned int expiring = 0;
+
+    for (n = me->nil->next[0]; n; n = n->next[0])
+        expiring += 0 != n->expires;
+    if (expiring != (me->expiry ? me->expiry->count : 0))
+        return -1;
+#else
+    (void)me;
+#endif
+    return 0;
 }
 
-void skiplist_freeall(
-    skiplist_t * me
-)
+int skiplist_validate(skiplist_t * me, skiplist_health_t * health)
 {
-    skiplist_free(me);
-    free(me);
+    unsigned int count = 0;
+
+    if (__validate_shape(me) ||
+        __validate_lines(me, me->nil, NULL, 0, me->levels, &count) ||
+        count != me->count || __validate_expiry(me))
+        return -1;
+
+    if (health)
+    {
+        health->search_cost = __search_cost(me);
+
+        /* Pugh's bound for p = 1/2: log2(n)/p + 1/(1-p) */
+        health->expected_cost = me->count ? 2 * log2(me->count) + 2 : 0;
+    }
+    return 0;
 }
 
-static unsigned int __flip_coins()
+int skiplist_rebuild(skiplist_t * me, double threshold)
 {
-    int depth;
-    for (depth=0; rand() % 2; depth++);
-    return depth;
+    node_t *tail[SKIPLIST_MAX_LEVELS];
+    unsigned int lvl, i, levels = __log2_levels(me->count);
+    node_t *n;
+
+    if (me->max_levels < levels)
+        levels = me->max_levels;
+
+    if (0 < threshold)
+    {
+        skiplist_health_t health;
+        if (skiplist_validate(me, &health))
+            return -1;
+        if (health.search_cost <= threshold * health.expected_cost)
+            return 0;
+    }
+
+    if (__unshare(me, 1))
+        return -1;
+
+    /* grow towers first. If we run out of memory the list is still intact */
+    for (n = me->nil->next[0], i = 1; n; n = n->next[0], i++)
+    {
+        unsigned int h = __builtin_ctz(i) + 1;
+        if (levels < h)
+            h = levels;
+        if (n->levels < h && __grow_tower(me, n, h))
+            return -1;
+    }
+
+    for (lvl = 0; lvl < me->max_levels; lvl++)
+        tail[lvl] = me->nil;
+
+    /* every 2nd node is on line 1, every 4th on line 2, and so on. The
+     * bottom line keeps its order, so it can be walked while relinking */
+    for (n = me->nil->next[0], i = 1; n; n = n->next[0], i++)
+    {
+        unsigned int h = __builtin_ctz(i) + 1;
+        if (levels < h)
+            h = levels;
+        n->levels = h;
+        for (lvl = 0; lvl < h; lvl++)
+        {
+            tail[lvl]->next[lvl] = n;
+            tail[lvl] = n;
+        }
+    }
+
+    for (lvl = 0; lvl < me->levels || lvl < levels; lvl++)
+        tail[lvl]->next[lvl] = NULL;
+    me->levels = levels;
+    return 1;
 }
 
-static void __swap(node_t* a, node_t* b, unsigned int lvl)
+/**
+ * Make a copy of the list for a worker thread to search with, so that it
+ * runs up its own counters */
+static void __view(skiplist_t * me, skiplist_t * view)
 {
-    node_t* swp = a->next[lvl];
-    a->next[lvl] = b;
-    b->next[lvl] = swp;
+    memcpy(view, me, sizeof(skiplist_t));
+#ifdef SKIPLIST_STATS
+    memset(&view->stats, 0, sizeof(skiplist_stats_t));
+#endif
 }
 
-int skiplist_contains_key(
-    skiplist_t * me,
-    const void *key
-)
+/**
+ * Add a worker's counters to ours */
+static void __unview(skiplist_t * me, skiplist_t * view)
 {
-    return (NULL != skiplist_get(me, key));
+#ifdef SKIPLIST_STATS
+    __STAT_ADD(me, cmps, view->stats.cmps);
+    __STAT_ADD(me, visits, view->stats.visits);
+    __STAT_ADD(me, allocs, view->stats.allocs);
+    __STAT_ADD(me, frees, view->stats.frees);
+#else
+    (void)me;
+    (void)view;
+#endif
 }
 
-void *skiplist_get(skiplist_t * me, const void *key)
-{
-    if (0 == skiplist_count(me) || !key)
-        return NULL;
+typedef struct {
+    skiplist_t view;
 
-    int lvl = me->levels - 1;
-    node_t *n = me->nil;
+    const skiplist_entry_t *items;
+
+    /* items[lo] up to items[hi] */
+    unsigned int lo, hi;
+
+    /* tallest tower */
+    unsigned int levels;
+
+    /* ends of each line of this segment; NULL if the line is empty */
+    node_t *first[SKIPLIST_MAX_LEVELS];
+    node_t *last[SKIPLIST_MAX_LEVELS];
+
+    int err;
+} load_seg_t;
+
+/**
+ * Build one segment's nodes and link them up, without touching the list */
+static void __load_seg(void *arg)
+{
+    load_seg_t *s = arg;
+    skiplist_t *me = &s->view;
+    node_t *prev = NULL;
+    unsigned int i, lvl;
 
-    while (0 <= lvl && n != me->head)
+    for (i = s->lo; i < s->hi; i++)
     {
-        node_t *r = n->next[lvl] ? n->next[lvl] : me->head;
-        long c = me->cmp(key, r->ety.k, me->udata);
+        /* the same heights skiplist_rebuild gives, so segments fit together
+         * without any touching up */
+        unsigned int h = __builtin_ctz(i + 1) + 1;
+        node_t *n;
 
-        if (c < 0)
+        if (s->levels < h)
+            h = s->levels;
+        if (!s->items[i].k || !(n = __allocnode(me, h)))
         {
-            lvl -= 1;
+            s->err = -1;
+            return;
         }
-        else if (0 < c)
+        n->ety = s->items[i];
+        n->prefix = __prefix(me, n->ety.k);
+        for (lvl = 0; lvl < h; lvl++)
         {
-            n = r;
+            if (s->last[lvl])
+                s->last[lvl]->next[lvl] = n;
+            else
+                s->first[lvl] = n;
+            s->last[lvl] = n;
         }
-        else
+        if (prev)
         {
-            return r->ety.v;
+            long c;
+            __backlink(prev);
+            c = __cmp_nodes(me, prev, n);
+            if (0 < c || (0 == c && !(me->flags & SKIPLIST_MULTIMAP)))
+            {
+                s->err = -1;
+                return;
+            }
         }
+        prev = n;
     }
-    return NULL;
 }
 
-static node_t* __place(
+int skiplist_load(
     skiplist_t * me,
-    void *key,
-    void *val,
-    node_t *prev,
-    unsigned int *put_depth)
+    const skiplist_entry_t * items,
+    unsigned int n,
+    skiplist_tpool_t * tp)
 {
-    *put_depth = __flip_coins();
-    node_t* new = __allocnode(*put_depth);
-    __swap(prev, new, 0);
-    new->ety.k = key;
-    new->ety.v = val;
+    node_t *tail[SKIPLIST_MAX_LEVELS];
+    load_seg_t *segs;
+    unsigned int lvl, i, nsegs = 1, levels = __log2_levels(n);
+    int err = 0;
 
-    /* make sure nil is included in the new line(s) */
-    if (me->levels < *put_depth)
+    if (me->count || __unshare(me, 1))
+        return -1;
+    if (0 == n)
+        return 0;
+    if (me->max_levels < levels)
+        levels = me->max_levels;
+
+    /* a pool isn't thread safe. Otherwise a few segments per thread leaves
+     * room for stealing */
+    if (me->pool)
+        tp = NULL;
+    if (tp)
+        nsegs = skiplist_tpool_threads(tp) * 4;
+    if (n < nsegs)
+        nsegs = n;
+
+    if (!(segs = calloc(nsegs, sizeof(load_seg_t))))
+        return -1;
+    for (i = 0; i < nsegs; i++)
     {
-        me->nil->next = realloc(me->nil->next, sizeof(node_t*) * *put_depth);
-        me->head->next = realloc(me->head->next, sizeof(node_t*) * *put_depth);
+        __view(me, &segs[i].view);
+        segs[i].items = items;
+        segs[i].lo = (unsigned long)n * i / nsegs;
+        segs[i].hi = (unsigned long)n * (i + 1) / nsegs;
+        segs[i].levels = levels;
+    }
+
+    if (tp)
+        skiplist_tpool_run(tp, __load_seg, segs, sizeof(load_seg_t), nsegs);
+    else
+        for (i = 0; i < nsegs; i++)
+            __load_seg(&segs[i]);
 
-        unsigned int i;
-        for (i=*put_depth - 1; me->levels - 1 < i; i--)
+    /* segments are in order inside; check where they meet */
+    for (i = 0; i < nsegs && !err; i++)
+    {
+        err = segs[i].err;
+        if (!err && 0 < i)
         {
-            me->nil->next[i] = new;
-            if (me->head != new)
-                new->next[i] = me->head;
-            me->head->next[i] = NULL;
+            long c = __cmp_nodes(me, segs[i - 1].last[0], segs[i].first[0]);
+            if (0 < c || (0 == c && !(me->flags & SKIPLIST_MULTIMAP)))
+                err = -1;
         }
+    }
 
-        me->levels = *put_depth;
+    for (i = 0; i < nsegs; i++)
+        __unview(me, &segs[i].view);
+
+    if (err)
+    {
+        for (i = 0; i < nsegs; i++)
+        {
+            node_t *m = segs[i].first[0];
+            while (m)
+            {
+                node_t *next = m->next[0];
+                __free_node(me, m);
+                m = next;
+            }
+        }
+        free(segs);
+        return -1;
     }
 
-    me->count++;
-    return new;
+    /* stitch the segments' lines end to end */
+    for (lvl = 0; lvl < levels; lvl++)
+        tail[lvl] = me->nil;
+    for (i = 0; i < nsegs; i++)
+        for (lvl = 0; lvl < levels; lvl++)
+            if (segs[i].first[lvl])
+            {
+                tail[lvl]->next[lvl] = segs[i].first[lvl];
+                if (0 == lvl)
+                    __backlink(tail[0]);
+                tail[lvl] = segs[i].last[lvl];
+            }
+    free(segs);
+
+    me->levels = levels;
+    me->count = n;
+    __bloom_refill(me);
+    return 0;
 }
 
-/**
- * We're doing this call recursively since it allows us to use the stack as a 
- * workspace. This means we don't need a doubly linked list */
-static void *__put(
-    skiplist_t * me,
-    void *key,
-    void *val,
-    unsigned int lvl,
-    node_t *prev,
-    unsigned int *put_depth,
-    void **v_old
-)
+typedef struct {
+    skiplist_t *me;
+
+    /* walk from start up to end */
+    node_t *start, *end;
+
+    /* the last run also stops past hi */
+    const void *hi;
+
+    uint64_t hp;
+
+    func_entry_f cb;
+
+    void *udata;
+} scan_run_t;
+
+static void __scan_run(void *arg)
 {
-    node_t *n = prev;
+    scan_run_t *r = arg;
+    node_t *n;
 
-    while (1)
-    {
-        node_t *r = n->next[lvl];
-        long c = me->cmp(key, r->ety.k, me->udata);
+    for (n = r->start;
+         n != r->end && (!r->hi || 0 <= __cmpn(r->me, r->hi, r->hp, n));
+         n = n->next[0])
+        if (!__expired(r->me, n))
+            r->cb(&n->ety, r->udata);
+}
 
-        /* we are smaller, move down a lane */
-        if (c < 0)
-        {
-            /* if we're on the bottom lane, we've found our spot */
-            if (lvl == 0)
-                return __place(me, key, val, n, put_depth);
+/* the gaps between nodes on a line vary a lot, so each part spans a few of
+ * them to even the parts out */
+#define SPLIT_SAMPLES 8
 
-            node_t* placed =  __put(me, key, val, lvl-1, n, put_depth, v_old);
+/**
+ * Cut the items from first (whose predecessors are in pred) up to hi into
+ * parts of about the same length. Parts start at nodes on the highest line
+ * with SPLIT_SAMPLES nodes per part in range. Each line has about twice the
+ * nodes of the one above, so finding that line costs O(nparts + log n).
+ * @param starts Receives the first node of each part, in key order
+ * @return number of parts, at most nparts; otherwise -1 if out of memory */
+static int __split_range(
+    skiplist_t * me,
+    node_t **pred,
+    node_t *first,
+    const void *hi,
+    uint64_t hp,
+    unsigned int nparts,
+    node_t **starts)
+{
+    node_t **bounds = NULL;
+    unsigned int nb = 0, size = 0, i, lvl;
 
-            /* while the stack is rolling back up, we can use the stack to
-             * make sure the previous nodes point to the new node correctly. */
-            if (placed && (lvl < *put_depth))
-                __swap(n, placed, lvl);
+    for (lvl = me->levels; 1 < nparts && 0 < lvl; lvl--)
+    {
+        node_t *n;
 
-            return placed;
-        }
-        /* we are larger, move onwards */
-        else if (0 < c)
+        nb = 0;
+        for (n = pred[lvl - 1]->next[lvl - 1];
+             n && (!hi || 0 <= __cmpn(me, hi, hp, n));
+             n = n->next[lvl - 1])
         {
-            if (r == me->head)
+            if (n == first)
+                continue;
+            if (nb == size)
             {
-                /* head get's placed instead */
-                n = __place(me, r->ety.k, r->ety.v, n, put_depth);
-                r->ety.k = key;
-                r->ety.v = val;
-                return n;
+                node_t **b = realloc(bounds, (size = size * 2 + 16) * sizeof(node_t*));
+                if (!b)
+                {
+                    free(bounds);
+                    return -1;
+                }
+                bounds = b;
             }
-            n = r;
-        }
-        /* straight swap */
-        else if (c == 0)
-        {
-            *v_old = r->ety.v;
-            r->ety.v = val;
-            return NULL;
+            bounds[nb++] = n;
         }
+        if (nparts * SPLIT_SAMPLES <= nb + 1)
+            break;
     }
+
+    /* a range shorter than nparts gets a part per item */
+    if (nb + 1 < nparts)
+        nparts = nb + 1;
+
+    starts[0] = first;
+    for (i = 1; i < nparts; i++)
+        starts[i] = bounds[(unsigned long)i * (nb + 1) / nparts - 1];
+    free(bounds);
+    return nparts;
 }
 
-void *skiplist_put(
-    skiplist_t *me,
-    void *key,
-    void *val
-)
+int skiplist_scan(
+    skiplist_t * me,
+    const void *lo,
+    const void *hi,
+    func_entry_f cb,
+    void **udata,
+    unsigned int nruns,
+    skiplist_tpool_t * tp)
 {
-    if (!key)
-        return NULL;
+    node_t *pred[SKIPLIST_MAX_LEVELS], *first, **starts;
+    scan_run_t *runs;
+    unsigned int lvl;
+    uint64_t hp = hi ? __prefix(me, hi) : 0;
+    int i, n;
 
-    node_t *n = me->nil;
-    unsigned int lvl = me->levels - 1;
+    if (0 == skiplist_count(me) || 0 == nruns)
+        return 0;
 
-    if (!me->nil->next[lvl])
+    if (lo)
+        __find_preds(me, lo, pred);
+    else
+        for (lvl = 0; lvl < me->levels; lvl++)
+            pred[lvl] = me->nil;
+    first = pred[0]->next[0];
+    if (!first || (hi && __cmpn(me, hi, hp, first) < 0))
+        return 0;
+    if (!tp)
+        nruns = 1;
+
+    if (!(starts = malloc(nruns * sizeof(node_t*))))
+        return -1;
+    if (-1 == (n = __split_range(me, pred, first, hi, hp, nruns, starts)) ||
+        !(runs = calloc(n, sizeof(scan_run_t))))
     {
-        n = me->head = me->nil->next[lvl] = __allocnode(me->levels);
-        n->ety.k = key;
-        n->ety.v = val;
-        me->count++;
-        return NULL;
+        free(starts);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        runs[i].me = me;
+        runs[i].cb = cb;
+        runs[i].udata = udata[i];
+        runs[i].start = starts[i];
+        runs[i].end = i + 1 < n ? starts[i + 1] : NULL;
     }
+    runs[n - 1].hi = hi;
+    runs[n - 1].hp = hp;
+    free(starts);
 
-    unsigned int put_depth;
-    void* v = NULL;
-    __put(me, key, val, lvl, n, &put_depth, &v);
-    return v;
+    if (tp)
+        skiplist_tpool_run(tp, __scan_run, runs, sizeof(scan_run_t), n);
+    else
+        __scan_run(runs);
+    free(runs);
+    return n;
 }
 
-static node_t *__remove(
+int skiplist_partition(
     skiplist_t * me,
-    const void *key,
-    unsigned int lvl,
-    node_t *prev)
+    unsigned int k,
+    skiplist_iterator_t * cursors)
 {
-    node_t *n = prev;
+    node_t *pred[SKIPLIST_MAX_LEVELS], **starts;
+    unsigned int lvl;
+    int i, n;
 
-    while (1)
+    if (0 == skiplist_count(me) || 0 == k)
+        return 0;
+    for (lvl = 0; lvl < me->levels; lvl++)
+        pred[lvl] = me->nil;
+
+    if (!(starts = malloc(k * sizeof(node_t*))))
+        return -1;
+    if (-1 == (n = __split_range(me, pred, me->nil->next[0], NULL, 0, k, starts)))
     {
-        node_t *r = n->next[lvl];
-        long c = me->cmp(key, r->ety.k, me->udata);
+        free(starts);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        cursors[i].current = starts[i];
+        cursors[i].last = NULL;
+        cursors[i].end = i + 1 < n ? starts[i + 1] : NULL;
+    }
+    free(starts);
+    return n;
+}
 
-        if (0 < c)
-        {
-            n = r;
-        }
-        else
-        {
-            if (0 == lvl)
-            {
-                if (c == 0)
-                {
-                    n->next[lvl] = r->next[lvl];
-                    return r;
-                }
-                break;
-            }
+typedef struct {
+    skiplist_t view;
 
-            node_t* removed = __remove(me, key, lvl-1, prev);
-            if (removed && r == removed)
-                n->next[lvl] = removed->next[lvl];
-            return removed;
-        }
+    node_t *start, *end;
 
-        if (!n->next[lvl])
-            break;
-    }
-    return NULL;
+    /* lines below this one */
+    unsigned int to;
+
+    unsigned int count;
+
+    int err;
+} validate_run_t;
+
+static void __validate_run(void *arg)
+{
+    validate_run_t *r = arg;
+
+    r->err = __validate_lines(&r->view, r->start, r->end, 0, r->to, &r->count);
 }
 
-void *skiplist_remove(
-    skiplist_t * me,
-    const void *key
-)
+int skiplist_validate_par(skiplist_t * me, skiplist_tpool_t * tp)
 {
-    if (0 == skiplist_count(me) || !key)
-        return NULL;
+    validate_run_t *runs;
+    unsigned int lvl, nruns = 0, want, i, count = 0, top = 0;
+    node_t *n;
+    int err = 0;
 
-    node_t* removed = __remove(me, key, me->levels - 1, me->nil);
-    if (removed)
+    if (__validate_shape(me))
+        return -1;
+    want = tp ? skiplist_tpool_threads(tp) * 4 : 1;
+
+    /* the highest line with enough nodes to cut the lines below it into runs.
+     * A node on that line is on every line below it, so each run can be
+     * checked on its own. The lines from there up are short, so they're
+     * checked as a whole */
+    for (lvl = me->levels - 1; 1 < want && 0 < lvl; lvl--)
     {
-        void* v = removed->ety.v;
-        __free_node(removed);
-        me->count--;
-        return v;
+        for (nruns = 1, n = me->nil->next[lvl]; n; n = n->next[lvl])
+            nruns++;
+        if (want <= nruns)
+            break;
     }
-    return NULL;
+    if (1 >= want || 0 == lvl)
+        return skiplist_validate(me, NULL);
+
+    if (!(runs = calloc(nruns, sizeof(validate_run_t))))
+        return -1;
+    for (i = 0, n = me->nil; i < nruns; i++, n = n->next[lvl])
+    {
+        __view(me, &runs[i].view);
+        runs[i].start = n;
+        runs[i].end = n->next[lvl];
+        runs[i].to = lvl;
+    }
+    skiplist_tpool_run(tp, __validate_run, runs, sizeof(validate_run_t), nruns);
+
+    for (i = 0; i < nruns; i++)
+    {
+        err |= runs[i].err;
+        count += runs[i].count;
+        __unview(me, &runs[i].view);
+    }
+    free(runs);
+
+    if (err || __validate_lines(me, me->nil, NULL, lvl, me->levels, &top) ||
+        count != me->count || __validate_expiry(me))
+        return -1;
+    return 0;
 }
 
 #if 0
@@ -1,15 +1,54 @@
 #ifndef SKIPLIST_H
 #define SKIPLIST_H
 
+#include <stdint.h>
+
+#include "skiplist_pool.h"
+#include "skiplist_bloom.h"
+#include "skiplist_tpool.h"
+
 typedef long (*func_longcmp_f) (
         const void *k1,
         const void *k2,
         const void *udata);
 
+/**
+ * Map a key to an order preserving prefix: if cmp(k1, k2) < 0 then
+ * prefix(k1) <= prefix(k2), and equal keys have equal prefixes. eg. the
+ * integer itself for integer keys, or the first 8 bytes big-endian for
+ * strings */
+typedef uint64_t (*func_prefix_f) (
+        const void *key,
+        const void *udata);
+
+/**
+ * Hash a key. Equal keys must have equal hashes */
+typedef uint64_t (*func_hash_f) (
+        const void *key,
+        const void *udata);
+
 typedef struct {
     void *k, *v;
 } skiplist_entry_t;
 
+typedef void (*func_entry_f) (
+        skiplist_entry_t *ety,
+        void *udata);
+
+/**
+ * Work out an item's value in place. Change ety->v only.
+ * @param found 1 if the item was already there; 0 if it's new, in which case
+ *  ety->v starts out NULL */
+typedef void (*func_upsert_f) (
+        skiplist_entry_t *ety,
+        int found,
+        void *udata);
+
+/**
+ * @return the time now, in whatever units expiry times are given in */
+typedef uint64_t (*func_clock_f) (
+        const void *udata);
+
 typedef struct node_s node_t;
 
 struct node_s
@@ -17,19 +56,84 @@ struct node_s
     skiplist_entry_t ety;
 
     /* array of pointers as this node could be on a higher express line level.
-     * The current node's line level is determined by remembering the line
-     * level of the node which points to this node. That's why we don't record
-     * the line level in this struct.
-     *
      * We don't record a "left" node because the put() operation backtracks
      * using the * stack via a recursive call */
     node_t **next;
+
+    /* height of the tower; ie. the number of lines this node is on */
+    unsigned int levels;
+
+    /* lines the tower has room for; at least levels. Taking a node off its
+     * top lines leaves the tower as it was, so that it's freed at the size it
+     * was allocated at */
+    unsigned int capacity;
+
+    /* key's prefix, from skiplist_opts_t.prefix; otherwise 0 */
+    uint64_t prefix;
+
+#ifdef SKIPLIST_BACKLINKS
+    /* predecessor on the bottom line; nil for the first node. Only compiled in
+     * with SKIPLIST_BACKLINKS, which makes stepping backwards O(1) instead of
+     * a search */
+    node_t *prev;
+#endif
+
+#ifdef SKIPLIST_TTL
+    /* time from which the item counts as gone; 0 if it never expires. Only
+     * compiled in with SKIPLIST_TTL */
+    uint64_t expires;
+#endif
 };
 
 
+/* Lines are never taller than this. The population is an unsigned int, so
+ * with a coin flip per line there is no use for more */
+#define SKIPLIST_MAX_LEVELS 32
+
+enum {
+    /* keep items with equal keys instead of replacing them. Equal keys are
+     * kept in insertion order */
+    SKIPLIST_MULTIMAP = 1 << 0,
+
+    /* keep towers perfectly balanced instead of choosing heights at random,
+     * making get, put and remove O(log n) in the worst case. Split, join and
+     * merge rebuild the towers afterwards, which makes them O(n) */
+    SKIPLIST_DETERMINISTIC = 1 << 1,
+};
+
 typedef struct {
+    /* comparator calls */
+    unsigned long cmps;
+
+    /* nodes stepped onto while searching */
+    unsigned long visits;
+
+    /* gets, puts and removes */
+    unsigned long ops;
+
+    /* gets the Bloom filter answered without a search */
+    unsigned long filtered;
+
+    /* items removed because they expired */
+    unsigned long expired;
+
+    /* node allocations and frees */
+    unsigned long allocs;
+    unsigned long frees;
+
+    /* number of nodes with a tower i + 1 lines tall */
+    unsigned int heights[SKIPLIST_MAX_LEVELS];
+
+    /* number of nodes on line i */
+    unsigned int nodes_per_level[SKIPLIST_MAX_LEVELS];
+} skiplist_stats_t;
+
+typedef struct skiplist_s {
     func_longcmp_f cmp;
 
+    /* compared before cmp is called; NULL to always call cmp */
+    func_prefix_f prefix;
+
     const void* udata;
 
     /* population within data structure */
@@ -38,20 +142,213 @@ typedef struct {
     /* number of lines */
     unsigned int levels;
 
+    /* most lines we'll ever use. nil's tower is allocated this tall up front,
+     * so adding a line never needs a realloc */
+    unsigned int max_levels;
+
+    /* SKIPLIST_MULTIMAP, SKIPLIST_DETERMINISTIC */
+    unsigned int flags;
+
     node_t* nil;
 
-    node_t* head;
+    /* where nodes come from; NULL for the heap */
+    skiplist_pool_t *pool;
+
+    /* number of versions sharing these nodes since skiplist_clone(); NULL if
+     * no other version has them */
+    unsigned int *shared;
+
+    /* hashes every key in the list; NULL if there's no filter */
+    func_hash_f hash;
+
+    /* shared along with the nodes */
+    skiplist_bloom_t *bloom;
+
+    /* bumped by every change to the list, so that a finger can tell that the
+     * path it saved may no longer be there */
+    unsigned long version;
+
+    /* tells the time for expiry; called with expire_udata */
+    func_clock_f clock;
+
+    /* called with each item that expires, and expire_udata; may be NULL */
+    func_entry_f on_expire;
+
+    void *expire_udata;
+
+    /* items that expire, in time order: a multimap from expiry time to key.
+     * NULL until the first item with an expiry is put */
+    struct skiplist_s *expiry;
+
+    /* node skiplist_compact's pass carries on from; NULL to start a new
+     * pass. Freeing this node moves it on to the next */
+    node_t *compact_next;
+
+    /* xorshift64 state that tower heights are drawn from. Each list has its
+     * own, so that puts on different lists don't contend for rand()'s lock */
+    uint64_t seed;
+
+#ifdef SKIPLIST_STATS
+    /* hot path counters. Only compiled in with SKIPLIST_STATS, so that they
+     * cost nothing otherwise. Bumped atomically, so gets on several threads
+     * can share them */
+    skiplist_stats_t stats;
+#endif
 } skiplist_t;
 
+typedef struct {
+    /* expected population. Used to derive max_levels */
+    unsigned int capacity;
+
+    /* overrides the max_levels derived from capacity */
+    unsigned int max_levels;
+
+    /* SKIPLIST_MULTIMAP, SKIPLIST_DETERMINISTIC */
+    unsigned int flags;
+
+    /* allocate nodes from this pool instead of the heap. Lists that are
+     * joined or merged must use the same pool. The pool must outlive the
+     * list */
+    skiplist_pool_t *pool;
+
+    /* worked out once per key and stored in each node. Searches compare
+     * prefixes inline, and only call cmp when two prefixes are equal. Lists
+     * that are joined or merged must use the same function */
+    func_prefix_f prefix;
+
+    /* keep a Bloom filter of the keys, so that a get for a missing key can
+     * usually return without a search. Puts and removes keep it up to date,
+     * and it grows with the list. Lists that are joined or merged must use
+     * the same function */
+    func_hash_f hash;
+
+    /* with SKIPLIST_TTL, tells the time that items expire by; NULL for
+     * milliseconds of CLOCK_MONOTONIC */
+    func_clock_f clock;
+
+    /* with SKIPLIST_TTL, called with each item that expires as it's removed,
+     * eg. to free its key and value */
+    func_entry_f on_expire;
+
+    /* passed to clock and on_expire */
+    void *expire_udata;
+} skiplist_opts_t;
+
+typedef struct {
+    /* node headers: item, prefix and links */
+    size_t nodes;
+
+    /* express and bottom line pointers */
+    size_t towers;
+
+    /* the list itself and nil, whose tower is max_levels tall */
+    size_t sentinel;
+
+    /* Bloom filter counters */
+    size_t bloom;
+
+    /* the expiry index, which is a list of its own */
+    size_t expiry;
+
+    /* slab bytes the pool holds but hasn't handed out. A pool shared by
+     * several lists has its slack counted by each of them */
+    size_t pool_slack;
+
+    /* all of the above */
+    size_t total;
+} skiplist_memory_t;
+
+typedef struct {
+    /* average comparisons a get makes to find an item */
+    double search_cost;
+
+    /* what a randomly levelled list of this population should cost */
+    double expected_cost;
+} skiplist_health_t;
+
+typedef struct {
+    /* node that will be returned next */
+    node_t* current;
+
+    /* when set, iteration stops at the first key greater than this one (less
+     * than this one, when iterating in reverse) */
+    const void* last;
+
+    /* when set, iteration stops on reaching this node */
+    node_t* end;
+} skiplist_iterator_t;
+
+typedef struct {
+    /* the last search's path: the last node with a key less than the key
+     * searched for, on each line */
+    node_t* pred[SKIPLIST_MAX_LEVELS];
+
+    /* list's version when the path was saved */
+    unsigned long version;
+} skiplist_finger_t;
+
 /**
  * @param udata User data passed to comparator */
 skiplist_t *skiplist_new(func_longcmp_f cmp, const void* udata);
 
+/**
+ * @param udata User data passed to comparator
+ * @param opts Options; NULL for the defaults */
+skiplist_t *skiplist_new_opts(
+    func_longcmp_f cmp,
+    const void* udata,
+    const skiplist_opts_t* opts);
+
+/**
+ * Make a new version of this list in O(1). The versions share every node
+ * until one of them changes. The first change to a version that still shares
+ * its nodes (a put, remove, or any other call that writes) copies every node
+ * first, so it costs O(n) time and memory rather than O(log n). After that
+ * the version is a plain list again. The last version left holding the
+ * nodes skips the copy. So a version no one changes stays intact; eg. it can
+ * be published to readers that don't lock. With SKIPLIST_TTL, gets on a
+ * version that shares its nodes skip expired items instead of removing them,
+ * so reads never pay for the copy.
+ * @return new version, otherwise NULL if out of memory */
+skiplist_t *skiplist_clone(skiplist_t * me);
+
 /**
  * Get this key's value.
+ * With SKIPLIST_MULTIMAP this is the value of the first item put with an equal
+ * key.
  * @return key's item, otherwise NULL */
 void *skiplist_get(skiplist_t * me, const void *key);
 
+/**
+ * Start a finger: a saved search path that later searches start from instead
+ * of from the top of the list. A finger belongs to one list and one thread.
+ * Nothing needs freeing */
+void skiplist_finger_init(skiplist_finger_t * finger);
+
+/**
+ * skiplist_get, for workloads where successive keys are near each other.
+ * The search climbs from the finger's last path only as high as it needs to
+ * reach key, so a key d items away costs O(log d) rather than O(log n). A key
+ * far from the last one can cost up to twice what skiplist_get would. Any
+ * change to the list other than through this finger makes the next search
+ * start from the top again.
+ * @return key's item, otherwise NULL */
+void *skiplist_finger_get(
+    skiplist_t * me,
+    skiplist_finger_t * finger,
+    const void *key);
+
+/**
+ * skiplist_put, searching from the finger as skiplist_finger_get does. The
+ * finger stays valid afterwards. With SKIPLIST_MULTIMAP or
+ * SKIPLIST_DETERMINISTIC this is a plain skiplist_put.
+ * @return previous associated val; otherwise NULL */
+void *skiplist_finger_put(
+    skiplist_t * me,
+    skiplist_finger_t * finger,
+    void *key,
+    void *val);
+
 /**
  * @return smallest item */
 void *skiplist_get_min(skiplist_t * me);
@@ -60,6 +357,51 @@ void *skiplist_get_min(skiplist_t * me);
  * @return largest item */
 void *skiplist_get_max(skiplist_t * me);
 
+/**
+ * Remove the smallest item. Together with SKIPLIST_MULTIMAP, skiplist_put and
+ * skiplist_get_min this makes the list a priority queue; equal priorities
+ * come out in insertion order.
+ * Unlinking the head needs no search, so this is O(height of the head node).
+ * @return smallest item's value, otherwise NULL if the list is empty */
+void *skiplist_pop_min(skiplist_t * me);
+
+/**
+ * Remove the item with an equal key and this value. With SKIPLIST_MULTIMAP
+ * this picks out one item from a run of equal keys; the rest keep their
+ * insertion order.
+ * @return 1 if the item was removed, otherwise 0 */
+int skiplist_remove_item(
+    skiplist_t * me,
+    const void *key,
+    const void *val);
+
+/**
+ * Move the item with an equal key and this value to newkey; ie. a priority
+ * queue's decrease-key (or increase-key). The item goes after every item with
+ * a key equal to newkey.
+ * @return 0 on success, otherwise -1 if there is no such item */
+int skiplist_change_key(
+    skiplist_t * me,
+    const void *key,
+    void *val,
+    void *newkey);
+
+/**
+ * @return item with the largest key not greater than key, otherwise NULL */
+skiplist_entry_t *skiplist_floor(skiplist_t * me, const void *key);
+
+/**
+ * @return item with the smallest key not less than key, otherwise NULL */
+skiplist_entry_t *skiplist_ceiling(skiplist_t * me, const void *key);
+
+/**
+ * @return item with the largest key less than key, otherwise NULL */
+skiplist_entry_t *skiplist_lower(skiplist_t * me, const void *key);
+
+/**
+ * @return item with the smallest key greater than key, otherwise NULL */
+skiplist_entry_t *skiplist_higher(skiplist_t * me, const void *key);
+
 /**
  * Is this key inside this map?
  * @return 1 if key is in hash, otherwise 0 */
@@ -67,41 +409,327 @@ int skiplist_contains_key(skiplist_t * me, const void *key);
 
 /**
  * Remove this key and value from the map.
+ * With SKIPLIST_MULTIMAP only the first item put with an equal key is removed.
  * @return value of key, or NULL on failure */
 void *skiplist_remove(skiplist_t * me, const void *key);
 
 /**
  * Associate key with val.
- * Does not insert key if an equal key exists.
+ * Does not insert key if an equal key exists, unless SKIPLIST_MULTIMAP is set;
+ * then the item goes after every item with an equal key.
  * @return previous associated val; otherwise NULL */
 void *skiplist_put(skiplist_t * me, void *key, void *val);
 
 /**
- * Remove the value refrenced by this key. */
-void skiplist_remove_entry(
-    skiplist_t * hmap,
-    skiplist_entry_t * entry,
-    const void *key
-);
+ * Read-modify-write in one descent: hand the item with an equal key to fn to
+ * update in place, or if there isn't one, have fn make the value for a new
+ * item and put it where the search ended. Saves a get followed by a put.
+ * With SKIPLIST_MULTIMAP, the first item with an equal key is updated. With
+ * SKIPLIST_DETERMINISTIC, putting a new item takes a second descent. An
+ * updated item keeps its expiry time.
+ * @return 1 if a new item was put, 0 if one was updated; otherwise -1 if key
+ *  is NULL or out of memory */
+int skiplist_upsert(
+    skiplist_t * me,
+    void *key,
+    func_upsert_f fn,
+    void *udata);
 
 /**
- * Put this key/value entry */
-void skiplist_put_entry(
-    skiplist_t * hmap,
-    skiplist_entry_t * entry
-);
+ * Put the item, unless there's already one with an equal key.
+ * @return the val already associated with key, leaving it be; otherwise NULL
+ *  once the item is put */
+void *skiplist_put_if_absent(skiplist_t * me, void *key, void *val);
+
+/**
+ * Replace the value of the item with an equal key, but only if it's still
+ * expected; eg. to only write back a value computed from what was read if no
+ * one has changed it since. The item keeps its expiry time.
+ * @return 0 if replaced; otherwise -1 if there's no such item, if its value
+ *  isn't expected, or if out of memory */
+int skiplist_compare_and_replace(
+    skiplist_t * me,
+    void *key,
+    void *expected,
+    void *val);
+
+#ifdef SKIPLIST_TTL
+/**
+ * skiplist_put, with an item that expires at this time (see
+ * skiplist_opts_t.clock). From then on gets, iterators and scans act as if
+ * it isn't there. A get that comes across it removes it, handing it to
+ * on_expire, so with expiring items a get can change the list; except on a
+ * version that shares its nodes with a clone, which it leaves be. Until then
+ * it's still counted by skiplist_count. A plain skiplist_put of an equal key
+ * leaves an item that doesn't expire.
+ * @param expires 0 to never expire. If out of memory the item won't expire
+ * @return previous associated val, even if it had expired; otherwise NULL */
+void *skiplist_put_expiry(
+    skiplist_t * me,
+    void *key,
+    void *val,
+    uint64_t expires);
+
+/**
+ * Remove up to max expired items, earliest expiry first, handing each to
+ * on_expire. Each costs O(log n), so calling this regularly with a small max
+ * keeps expiry's cost spread out.
+ * @return number of items removed */
+int skiplist_expire(skiplist_t * me, unsigned int max);
+#endif
 
 /**
  * @return number of items */
 int skiplist_count(const skiplist_t * me);
 
 /**
- * Remove all items */
+ * Remove all items, freeing their nodes in one walk of the bottom line */
 void skiplist_clear(skiplist_t * me);
 
+/**
+ * Remove all items, handing each to cb before its node is freed. Items that
+ * other versions (see skiplist_clone) still hold aren't passed to cb.
+ * @param cb Called with each item, eg. to free its key and value; may be NULL
+ * @param udata Passed to cb */
+void skiplist_clear_cb(skiplist_t * me, func_entry_f cb, void *udata);
+
+/**
+ * Free every node and the filter, but not the skiplist_t itself. The list
+ * can't be used afterwards. Nodes that other versions still share are left
+ * to the last of them */
 void skiplist_free(skiplist_t * me);
 
+/**
+ * skiplist_free, then free the skiplist_t */
 void skiplist_freeall(skiplist_t * me);
+
+/**
+ * Like skiplist_freeall, but rather than freeing each node it resets the
+ * pool they came from, in O(number of slabs). Only for a pool that holds
+ * nothing but this list. Without a pool, or while other versions share the
+ * nodes, this is skiplist_freeall */
+void skiplist_drop(skiplist_t * me);
+
+/**
+ * @return number of items with a key equal to this key */
+int skiplist_count_equal(skiplist_t * me, const void *key);
+
+/**
+ * Remove every item with a key equal to this key.
+ * @return number of items removed */
+int skiplist_remove_all(skiplist_t * me, const void *key);
+
+/**
+ * Remove every item with a key from lo to hi inclusive, in O(log n + k).
+ * The run is spliced out of each line with a single unlink.
+ * @param cb Called with each removed item before it is freed; may be NULL
+ * @param udata Passed to cb
+ * @return number of items removed */
+int skiplist_remove_range(
+    skiplist_t * me,
+    const void *lo,
+    const void *hi,
+    func_entry_f cb,
+    void *udata);
+
+/**
+ * Move every item with a key not less than key into a new list.
+ * Relinking is O(log n); working out the new populations costs a walk of the
+ * smaller half. With a Bloom filter the upper half is walked as well, to move
+ * its keys into a filter of its own.
+ * @return list with the upper half, otherwise NULL on failure */
+skiplist_t *skiplist_split(skiplist_t * me, const void *key);
+
+/**
+ * Move every item in other onto the end of me by splicing the towers
+ * together, in O(log n). other is left empty. With a Bloom filter, other's
+ * keys are walked to add them to me's filter.
+ * @return 0 on success; -1 if other has a key that doesn't sort after all of
+ *  me's keys, if the lists use different pools, prefix or hash functions,
+ *  or if out of memory */
+int skiplist_join(skiplist_t * me, skiplist_t * other);
+
+/**
+ * Move every item in other into me, in linear time. Lists whose keys don't
+ * overlap are joined instead. other is left empty.
+ * Where keys are equal other's value replaces me's, unless SKIPLIST_MULTIMAP
+ * is set.
+ * @return 0 on success; otherwise -1, leaving both lists as they were, if the
+ *  lists use different pools, prefix or hash functions, or if out of
+ *  memory */
+int skiplist_merge(skiplist_t * me, skiplist_t * other);
+
+/**
+ * Copy out the counters, and work out the tower histograms.
+ * Building the histograms walks the bottom line.
+ * @return 0; otherwise -1 if SKIPLIST_STATS wasn't defined, in which case only
+ *  the histograms are filled in */
+int skiplist_stats(skiplist_t * me, skiplist_stats_t * stats);
+
+/**
+ * Zero the counters */
+void skiplist_stats_reset(skiplist_t * me);
+
+/**
+ * Work out how many bytes the list takes up, in O(n). With a pool, sizes are
+ * what the pool hands out, rounded up to SKIPLIST_POOL_GRAIN; without one
+ * they're what was asked of malloc, which adds its own overhead. Nodes shared
+ * with clones are counted by each version */
+void skiplist_memory_usage(skiplist_t * me, skiplist_memory_t * mem);
+
+/**
+ * Relocate nodes into fresh slab space in key order, so that a scan walks
+ * memory front to back instead of jumping around the heap.
+ * Works incrementally: each call looks at up to max nodes, carrying on where
+ * the last call left off, and moves those that don't already follow the node
+ * before them. Each pass takes the pool another copy of the nodes it moves;
+ * the old ones go on its free lists for later puts to reuse.
+ * Like any change, this invalidates iterators.
+ * @return 1 once the pass has reached the end of the list, 0 if it hasn't;
+ *  otherwise -1 if the list has no pool, or if out of memory */
+int skiplist_compact(skiplist_t * me, unsigned int max);
+
+/**
+ * Check that every line is in order, that each express line only holds nodes
+ * from the line below it, that backlinks and prefixes agree with the bottom
+ * line, that the population adds up, and that the Bloom filter knows every
+ * key.
+ * @param health Receives actual vs. expected search cost; may be NULL
+ * @return 0 if the list is intact; otherwise -1 */
+int skiplist_validate(skiplist_t * me, skiplist_health_t * health);
+
+/**
+ * Re-level every node deterministically, in place and in O(n): every 2nd node
+ * goes on line 1, every 4th on line 2, and so on.
+ * @param threshold Only rebuild if the search cost is more than this many
+ *  times the expected cost. 0 to always rebuild
+ * @return 1 if rebuilt, 0 if the list didn't need it; otherwise -1 if the
+ *  list is corrupt or we ran out of memory */
+int skiplist_rebuild(skiplist_t * me, double threshold);
+
+/**
+ * Fill an empty list from items already in key order, in O(n). The towers
+ * come out as skiplist_rebuild would make them.
+ * The items are cut into segments that tp's threads build at once, and the
+ * segments' lines are then stitched together end to end. cmp and prefix are
+ * called from those threads. A list with a pool is built on this thread
+ * alone, as a pool isn't thread safe.
+ * @param tp Threads to build on; NULL for this thread alone
+ * @return 0 on success; otherwise -1 if the list isn't empty, if items are
+ *  out of order (or have equal keys, without SKIPLIST_MULTIMAP), if a key is
+ *  NULL, or if out of memory. The list is left empty on failure */
+int skiplist_load(
+    skiplist_t * me,
+    const skiplist_entry_t * items,
+    unsigned int n,
+    skiplist_tpool_t * tp);
+
+/**
+ * Call cb on every item with a key from lo to hi inclusive, with the range
+ * cut into nruns runs that tp's threads walk at once. Runs are cut at nodes
+ * on the highest express line that has enough of them in range, so they're
+ * about the same length. Each run walks its items in key order, and passes
+ * cb its own udata, so an aggregate can be kept per run without locking and
+ * totalled afterwards. The list mustn't change during the scan.
+ * @param lo NULL to start from the smallest key
+ * @param hi NULL to carry on to the largest key
+ * @param udata nruns pointers; run i, which comes before run i + 1 in key
+ *  order, passes udata[i] to cb
+ * @param tp Threads to scan on; NULL for a single run on this thread
+ * @return number of runs used, at most nruns; otherwise -1 if out of memory
+ *  */
+int skiplist_scan(
+    skiplist_t * me,
+    const void *lo,
+    const void *hi,
+    func_entry_f cb,
+    void **udata,
+    unsigned int nruns,
+    skiplist_tpool_t * tp);
+
+/**
+ * Cut the list into k ranges of about the same length, for threads to iterate
+ * over at once, in O(k + log n). There's no pre-pass: the ranges start at
+ * nodes taken from the highest express line with a few times k of them,
+ * which are spread evenly enough to act as splitters.
+ * Each cursor is an iterator over its own range, to be used with
+ * skiplist_iterator_next; cursor i's items all come before cursor i + 1's.
+ * The list mustn't change while the cursors are in use.
+ * @param cursors Receives up to k iterators
+ * @return number of cursors, fewer than k if the list is shorter than k;
+ *  otherwise -1 if out of memory */
+int skiplist_partition(
+    skiplist_t * me,
+    unsigned int k,
+    skiplist_iterator_t * cursors);
+
+/**
+ * skiplist_validate, with the lines cut into runs that tp's threads check at
+ * once. cmp, prefix and hash are called from those threads.
+ * @return 0 if the list is intact; otherwise -1 */
+int skiplist_validate_par(skiplist_t * me, skiplist_tpool_t * tp);
+
+/**
+ * Iterate over every item in key order */
+void skiplist_iterator(skiplist_t * me, skiplist_iterator_t * iter);
+
+/**
+ * Iterate in key order, starting from the first item with a key not less than
+ * this key, in O(log n). Stops only at the end of the list.
+ * @param key NULL to start from the smallest key */
+void skiplist_iterator_from(
+    skiplist_t * me,
+    const void *key,
+    skiplist_iterator_t * iter);
+
+/**
+ * Iterate over the items with a key equal to this key, in insertion order.
+ * Doesn't allocate. */
+void skiplist_iterator_equal(
+    skiplist_t * me,
+    const void *key,
+    skiplist_iterator_t * iter);
+
+/**
+ * @return 1 if there is another item, otherwise 0 */
+int skiplist_iterator_has_next(skiplist_t * me, skiplist_iterator_t * iter);
+
+/**
+ * Removing the returned item doesn't break iteration.
+ * @return next item's key, otherwise NULL */
+void *skiplist_iterator_next(skiplist_t * me, skiplist_iterator_t * iter);
+
+/**
+ * @return next item's value, otherwise NULL */
+void *skiplist_iterator_next_value(
+    skiplist_t * me,
+    skiplist_iterator_t * iter);
+
+/**
+ * Iterate backwards over the items with keys from hi down to lo, inclusive.
+ * Each step back is O(1) with SKIPLIST_BACKLINKS; otherwise it's a search.
+ * @param hi Start here; NULL to start from the largest key
+ * @param lo Stop here; NULL to carry on to the smallest key */
+void skiplist_iterator_reverse(
+    skiplist_t * me,
+    const void *hi,
+    const void *lo,
+    skiplist_iterator_t * iter);
+
+/**
+ * @return 1 if there is another item going backwards, otherwise 0 */
+int skiplist_iterator_has_prev(skiplist_t * me, skiplist_iterator_t * iter);
+
+/**
+ * Removing the returned item doesn't break iteration.
+ * @return previous item's key, otherwise NULL */
+void *skiplist_iterator_prev(skiplist_t * me, skiplist_iterator_t * iter);
+
+/**
+ * @return previous item's value, otherwise NULL */
+void *skiplist_iterator_prev_value(
+    skiplist_t * me,
+    skiplist_iterator_t * iter);
 /*--------------------------------------------------------------79-characters-*/
 
 #endif /* SKIPLIST_H */
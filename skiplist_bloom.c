@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2011, Willem-Hendrik Thiart
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * @file
+ * @author  Willem Thiart himself@willemthiart.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "skiplist_bloom.h"
+
+/* counters per block */
+#define COUNTERS (SKIPLIST_BLOOM_BLOCK * 2)
+
+/* bits of hash it takes to pick a counter within a block */
+#define COUNTER_BITS 7
+
+/* a counter this high no longer counts */
+#define STUCK 15
+
+/**
+ * MurmurHash3's finaliser. Every input bit affects every output bit */
+static uint64_t __mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @return the block this hash's counters are in */
+static unsigned char *__block(const skiplist_bloom_t * me, uint64_t h)
+{
+    return me->blocks + ((h >> 42) & (me->nblocks - 1)) * SKIPLIST_BLOOM_BLOCK;
+}
+
+static unsigned int __get(const unsigned char *blk, unsigned int i)
+{
+    return (blk[i >> 1] >> ((i & 1) * 4)) & 0xf;
+}
+
+static void __set(unsigned char *blk, unsigned int i, unsigned int v)
+{
+    unsigned int shift = (i & 1) * 4;
+    blk[i >> 1] = (blk[i >> 1] & ~(0xf << shift)) | v << shift;
+}
+
+static skiplist_bloom_t *__new(unsigned int nblocks)
+{
+    skiplist_bloom_t *me;
+
+    if (!(me = malloc(sizeof(skiplist_bloom_t))))
+        return NULL;
+    me->nblocks = nblocks;
+    me->capacity = nblocks * (COUNTERS / SKIPLIST_BLOOM_COUNTERS_PER_KEY);
+    if (!(me->blocks = aligned_alloc(SKIPLIST_BLOOM_BLOCK,
+                                     skiplist_bloom_bytes(me))))
+    {
+        free(me);
+        return NULL;
+    }
+    return me;
+}
+
+skiplist_bloom_t *skiplist_bloom_new(unsigned int capacity)
+{
+    unsigned int per_block = COUNTERS / SKIPLIST_BLOOM_COUNTERS_PER_KEY;
+    unsigned int nblocks = 1;
+    skiplist_bloom_t *me;
+
+    while (nblocks * per_block < capacity && nblocks < SKIPLIST_BLOOM_MAX_BLOCKS)
+        nblocks <<= 1;
+    if (!(me = __new(nblocks)))
+        return NULL;
+    skiplist_bloom_clear(me);
+    return me;
+}
+
+skiplist_bloom_t *skiplist_bloom_copy(const skiplist_bloom_t * me)
+{
+    skiplist_bloom_t *copy;
+
+    if (!(copy = __new(me->nblocks)))
+        return NULL;
+    memcpy(copy->blocks, me->blocks, skiplist_bloom_bytes(me));
+    return copy;
+}
+
+void skiplist_bloom_free(skiplist_bloom_t * me)
+{
+    free(me->blocks);
+    free(me);
+}
+
+void skiplist_bloom_clear(skiplist_bloom_t * me)
+{
+    memset(me->blocks, 0, skiplist_bloom_bytes(me));
+}
+
+void skiplist_bloom_add(skiplist_bloom_t * me, uint64_t hash)
+{
+    uint64_t h = __mix(hash);
+    unsigned char *blk = __block(me, h);
+    int i;
+
+    for (i = 0; i < SKIPLIST_BLOOM_PROBES; i++, h >>= COUNTER_BITS)
+    {
+        unsigned int j = h & (COUNTERS - 1), c = __get(blk, j);
+        if (c < STUCK)
+            __set(blk, j, c + 1);
+    }
+}
+
+void skiplist_bloom_remove(skiplist_bloom_t * me, uint64_t hash)
+{
+    uint64_t h = __mix(hash);
+    unsigned char *blk = __block(me, h);
+    int i;
+
+    for (i = 0; i < SKIPLIST_BLOOM_PROBES; i++, h >>= COUNTER_BITS)
+    {
+        unsigned int j = h & (COUNTERS - 1), c = __get(blk, j);
+        if (0 < c && c < STUCK)
+            __set(blk, j, c - 1);
+    }
+}
+
+int skiplist_bloom_maybe(const skiplist_bloom_t * me, uint64_t hash)
+{
+    uint64_t h = __mix(hash);
+    const unsigned char *blk = __block(me, h);
+    int i;
+
+    for (i = 0; i < SKIPLIST_BLOOM_PROBES; i++, h >>= COUNTER_BITS)
+        if (0 == __get(blk, h & (COUNTERS - 1)))
+            return 0;
+    return 1;
+}
+
+size_t skiplist_bloom_bytes(const skiplist_bloom_t * me)
+{
+    return (size_t)me->nblocks * SKIPLIST_BLOOM_BLOCK;
+}
@@ -0,0 +1,79 @@
+#ifndef SKIPLIST_BLOOM_H
+#define SKIPLIST_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A counting Bloom filter over key hashes, so that a lookup for a key that
+ * isn't there can usually be answered without searching at all.
+ *
+ * Counters are 4 bits, so removing a key is just as cheap as adding one. A
+ * counter that reaches 15 sticks there, since we no longer know how many keys
+ * it stands for; that costs false positives, never false negatives.
+ *
+ * The filter is blocked: a key's counters all sit in one 64 byte block, so
+ * checking a key costs a single cache miss however many counters it has.
+ *
+ * Hashes are mixed before use, so a weak hash (eg. the integer itself) is
+ * fine. */
+
+/* bytes per block; one cache line */
+#define SKIPLIST_BLOOM_BLOCK 64
+
+/* most blocks a filter will have; the hash bits left over after picking
+ * counters only go so far */
+#define SKIPLIST_BLOOM_MAX_BLOCKS (1u << 22)
+
+/* counters set per key */
+#define SKIPLIST_BLOOM_PROBES 6
+
+/* counters per key at capacity. With 6 probes that's a false positive rate
+ * of about 0.1% */
+#define SKIPLIST_BLOOM_COUNTERS_PER_KEY 16
+
+typedef struct {
+    /* keys the filter is sized for. Past this the false positive rate climbs,
+     * so it's time for a bigger filter */
+    unsigned int capacity;
+
+    /* number of blocks; a power of two */
+    unsigned int nblocks;
+
+    /* two counters per byte, SKIPLIST_BLOOM_BLOCK aligned */
+    unsigned char *blocks;
+} skiplist_bloom_t;
+
+/**
+ * @param capacity Keys to size the filter for
+ * @return new empty filter, otherwise NULL */
+skiplist_bloom_t *skiplist_bloom_new(unsigned int capacity);
+
+/**
+ * @return copy of the filter, otherwise NULL */
+skiplist_bloom_t *skiplist_bloom_copy(const skiplist_bloom_t * me);
+
+void skiplist_bloom_free(skiplist_bloom_t * me);
+
+/**
+ * Forget every key */
+void skiplist_bloom_clear(skiplist_bloom_t * me);
+
+void skiplist_bloom_add(skiplist_bloom_t * me, uint64_t hash);
+
+/**
+ * Take out a key that was added. Removing a key that wasn't added can cause
+ * false negatives */
+void skiplist_bloom_remove(skiplist_bloom_t * me, uint64_t hash);
+
+/**
+ * @return 0 if no key with this hash was added; otherwise 1, which means it
+ *  probably was */
+int skiplist_bloom_maybe(const skiplist_bloom_t * me, uint64_t hash);
+
+/**
+ * @return bytes of counters */
+size_t skiplist_bloom_bytes(const skiplist_bloom_t * me);
+
+/*--------------------------------------------------------------79-characters-*/
+
+#endif /* SKIPLIST_BLOOM_H */
@@ -0,0 +1,512 @@
+/**
+ * Copyright (c) 2011, Willem-Hendrik Thiart
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * @file
+ * @author  Willem Thiart himself@willemthiart.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "skiplist_mmap.h"
+
+#define MAGIC 0x534b4c50 /* "SKLP" */
+#define VERSION 1
+
+#define __align(x) (((uint64_t)(x) + 7) & ~(uint64_t)7)
+
+static skiplist_mmap_header_t *__hdr(const skiplist_mmap_t * me)
+{
+    return (skiplist_mmap_header_t*)me->base;
+}
+
+static skiplist_mmap_node_t *__node(const skiplist_mmap_t * me,
+                                    skiplist_off_t off)
+{
+    return (skiplist_mmap_node_t*)(me->base + off);
+}
+
+/**
+ * @return tower of the node at this offset, or the nil sentinel's tower if the
+ *  offset is 0 */
+static skiplist_off_t *__tower(const skiplist_mmap_t * me, skiplist_off_t off)
+{
+    return off ? __node(me, off)->next : __hdr(me)->nil;
+}
+
+static uint64_t __node_size(uint64_t levels, uint64_t klen)
+{
+    return __align(sizeof(skiplist_mmap_node_t) +
+                   sizeof(skiplist_off_t) * levels + klen);
+}
+
+static const void *__node_key(const skiplist_mmap_node_t * n)
+{
+    return n->next + n->levels;
+}
+
+static long __keycmp(const void *k1, size_t l1, const void *k2, size_t l2)
+{
+    int c = memcmp(k1, k2, l1 < l2 ? l1 : l2);
+    if (c)
+        return c;
+    return (long)l1 - (long)l2;
+}
+
+static void __store(skiplist_off_t *p, skiplist_off_t off)
+{
+    /* other processes may be reading this line right now */
+    __atomic_store_n(p, off, __ATOMIC_RELEASE);
+}
+
+static int __sync_range(skiplist_mmap_t * me, uint64_t start, uint64_t end)
+{
+    if (!(me->flags & SKIPLIST_MMAP_SYNC))
+        return 0;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    start &= ~(page - 1);
+    return msync(me->base + start, end - start, MS_SYNC);
+}
+
+static int __map(skiplist_mmap_t * me, size_t size)
+{
+    int prot = PROT_READ;
+    if (!(me->flags & SKIPLIST_MMAP_RDONLY))
+        prot |= PROT_WRITE;
+
+    void *p = mmap(NULL, size, prot, MAP_SHARED, me->fd, 0);
+    if (MAP_FAILED == p)
+        return -1;
+    if (me->base)
+        munmap(me->base, me->size);
+    me->base = p;
+    me->size = size;
+    return 0;
+}
+
+/**
+ * Make sure the first end bytes of the file are mapped. Writers grow the file
+ * to fit; readers pick up whatever the writer has grown it to.
+ * Remapping is safe because nothing inside the region is a pointer. */
+static int __reserve(skiplist_mmap_t * me, uint64_t end)
+{
+    if (end <= me->size)
+        return 0;
+
+    /* with 32 bit offsets, anything past 4GiB can't be linked to */
+    if ((uint64_t)(skiplist_off_t)-1 < end)
+        return -1;
+
+    struct stat st;
+    if (fstat(me->fd, &st))
+        return -1;
+
+    uint64_t size = st.st_size;
+    if (size < end)
+    {
+        if (me->flags & SKIPLIST_MMAP_RDONLY)
+            return -1;
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        size = me->size * 2 < end ? end : me->size * 2;
+        size = (size + page - 1) & ~(page - 1);
+        if (ftruncate(me->fd, size))
+            return -1;
+    }
+    return __map(me, size);
+}
+
+/**
+ * Readers map a snapshot of the file's size; catch up with the writer */
+static int __refresh(skiplist_mmap_t * me)
+{
+    return __reserve(me, __hdr(me)->used);
+}
+
+static unsigned int __flip_coins(skiplist_mmap_t * me)
+{
+    skiplist_mmap_header_t *h = __hdr(me);
+
+    /* xorshift64, so that heights don't depend on the process' rand() */
+    uint64_t x = h->seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    h->seed = x;
+
+    /* never go taller than log2(count) + 1 */
+    unsigned int max = 1;
+    uint64_t c = h->count;
+    while (c >>= 1)
+        max++;
+    if (SKIPLIST_MMAP_MAX_LEVELS < max)
+        max = SKIPLIST_MMAP_MAX_LEVELS;
+
+    unsigned int levels = 1;
+    for (; levels < max && (x & 1); x >>= 1)
+        levels++;
+    return levels;
+}
+
+/**
+ * Record the last node before key on every line in pred; 0 means nil.
+ * @return offset of the node with an equal key, otherwise 0 */
+static skiplist_off_t __find(
+    const skiplist_mmap_t * me,
+    const void *key,
+    size_t klen,
+    skiplist_off_t *pred)
+{
+    skiplist_off_t n = 0, found = 0;
+    int lvl;
+
+    for (lvl = __hdr(me)->levels - 1; 0 <= lvl; lvl--)
+    {
+        while (1)
+        {
+            skiplist_off_t r = __tower(me, n)[lvl];
+            if (!r)
+                break;
+
+            skiplist_mmap_node_t *node = __node(me, r);
+            long c = __keycmp(key, klen, __node_key(node), node->klen);
+
+            if (0 < c)
+            {
+                n = r;
+            }
+            else
+            {
+                if (0 == c)
+                    found = r;
+                break;
+            }
+        }
+
+        if (pred)
+            pred[lvl] = n;
+    }
+    return found;
+}
+
+/**
+ * Bounds check the node at off, which we reached on line lvl.
+ * @return end of the node's records; otherwise 0 if the node is corrupt */
+static uint64_t __check_node(
+    const skiplist_mmap_t * me,
+    skiplist_off_t off,
+    unsigned int lvl)
+{
+    if (off < __align(sizeof(skiplist_mmap_header_t)) || (off & 7) ||
+        me->size < off + sizeof(skiplist_mmap_node_t))
+        return 0;
+
+    skiplist_mmap_node_t *n = __node(me, off);
+    if (n->levels <= lvl || SKIPLIST_MMAP_MAX_LEVELS < n->levels)
+        return 0;
+
+    uint64_t end = off + __node_size(n->levels, n->klen);
+    if (me->size < end)
+        return 0;
+
+    uint64_t v = n->val;
+    if (v < __align(sizeof(skiplist_mmap_header_t)) || (v & 7) ||
+        me->size < v + sizeof(uint64_t))
+        return 0;
+
+    uint64_t vlen = *(uint64_t*)(me->base + v);
+    if (me->size - v - sizeof(uint64_t) < vlen)
+        return 0;
+
+    uint64_t vend = v + __align(sizeof(uint64_t) + vlen);
+    return end < vend ? vend : end;
+}
+
+/**
+ * Check the header alone, in O(1)
+ * @return 0 if it's sane; otherwise -1 */
+static int __check_header(const skiplist_mmap_t * me)
+{
+    if (me->size < sizeof(skiplist_mmap_header_t))
+        return -1;
+
+    skiplist_mmap_header_t *h = __hdr(me);
+
+    if (h->magic != MAGIC || h->version != VERSION ||
+        h->off_size != sizeof(skiplist_off_t))
+        return -1;
+
+    if (0 == h->levels || SKIPLIST_MMAP_MAX_LEVELS < h->levels)
+        return -1;
+
+    if (h->used < __align(sizeof(skiplist_mmap_header_t)) ||
+        me->size < h->used)
+        return -1;
+    return 0;
+}
+
+int skiplist_mmap_validate(skiplist_mmap_t * me)
+{
+    if (__check_header(me))
+        return -1;
+
+    skiplist_mmap_header_t *h = __hdr(me);
+    uint64_t used = h->used, count = 0;
+    unsigned int lvl;
+
+    /* bottom line up, so each line can be checked against the one below */
+    for (lvl = 0; lvl < h->levels; lvl++)
+    {
+        skiplist_off_t prev = 0, n, below = lvl ? h->nil[lvl - 1] : 0;
+
+        for (n = h->nil[lvl]; n; prev = n, n = __node(me, n)->next[lvl])
+        {
+            uint64_t end = __check_node(me, n, lvl);
+            if (!end)
+                return -1;
+            if (used < end)
+                used = end;
+
+            skiplist_mmap_node_t *node = __node(me, n);
+
+            /* strictly ascending, which also rules out cycles */
+            if (prev)
+            {
+                skiplist_mmap_node_t *p = __node(me, prev);
+                if (0 <= __keycmp(__node_key(p), p->klen,
+                                  __node_key(node), node->klen))
+                    return -1;
+            }
+
+            if (0 == lvl)
+            {
+                count++;
+                continue;
+            }
+
+            /* an express line may only contain nodes from the line below */
+            while (below != n)
+            {
+                if (!below)
+                    return -1;
+                skiplist_mmap_node_t *b = __node(me, below);
+                if (0 < __keycmp(__node_key(b), b->klen,
+                                 __node_key(node), node->klen))
+                    return -1;
+                below = b->next[lvl - 1];
+            }
+        }
+    }
+
+    if (me->size < used)
+        return -1;
+
+    /* a crash may have happened before the header caught up */
+    if (!(me->flags & SKIPLIST_MMAP_RDONLY))
+    {
+        h->used = used;
+        h->count = count;
+    }
+    return 0;
+}
+
+skiplist_mmap_t *skiplist_mmap_open(const char *path, int flags)
+{
+    skiplist_mmap_t *me;
+    struct stat st;
+    int oflags = O_RDWR;
+
+    if (flags & SKIPLIST_MMAP_RDONLY)
+        oflags = O_RDONLY;
+    else if (flags & SKIPLIST_MMAP_CREATE)
+        oflags |= O_CREAT;
+
+    if (!(me = calloc(1, sizeof(skiplist_mmap_t))))
+        return NULL;
+    me->flags = flags;
+
+    if (-1 == (me->fd = open(path, oflags, 0644)))
+        goto fail;
+    if (fstat(me->fd, &st))
+        goto fail;
+
+    int fresh = 0 == st.st_size;
+    if (fresh)
+    {
+        if (flags & SKIPLIST_MMAP_RDONLY)
+            goto fail;
+        st.st_size = sysconf(_SC_PAGESIZE);
+        if (ftruncate(me->fd, st.st_size))
+            goto fail;
+    }
+
+    if (__map(me, st.st_size))
+        goto fail;
+
+    if (fresh)
+    {
+        skiplist_mmap_header_t *h = __hdr(me);
+        h->magic = MAGIC;
+        h->version = VERSION;
+        h->off_size = sizeof(skiplist_off_t);
+        h->levels = 1;
+        h->used = __align(sizeof(skiplist_mmap_header_t));
+        h->seed = 0x9e3779b97f4a7c15ULL;
+        if (skiplist_mmap_sync(me))
+            goto fail;
+    }
+
+    if ((flags & SKIPLIST_MMAP_NOCHECK) ? __check_header(me) :
+                                          skiplist_mmap_validate(me))
+        goto fail;
+
+    return me;
+
+fail:
+    skiplist_mmap_close(me);
+    return NULL;
+}
+
+void skiplist_mmap_close(skiplist_mmap_t * me)
+{
+    if (me->base)
+        munmap(me->base, me->size);
+    if (0 <= me->fd)
+        close(me->fd);
+    free(me);
+}
+
+int skiplist_mmap_sync(skiplist_mmap_t * me)
+{
+    return msync(me->base, me->size, MS_SYNC);
+}
+
+uint64_t skiplist_mmap_count(const skiplist_mmap_t * me)
+{
+    return __hdr(me)->count;
+}
+
+const void *skiplist_mmap_get(
+    skiplist_mmap_t * me,
+    const void *key,
+    size_t klen,
+    size_t *vlen)
+{
+    if (!key || __refresh(me))
+        return NULL;
+
+    skiplist_off_t n = __find(me, key, klen, NULL);
+    if (!n)
+        return NULL;
+
+    uint64_t *rec = (uint64_t*)(me->base + __node(me, n)->val);
+    if (vlen)
+        *vlen = *rec;
+    return rec + 1;
+}
+
+int skiplist_mmap_put(
+    skiplist_mmap_t * me,
+    const void *key,
+    size_t klen,
+    const void *val,
+    size_t vlen)
+{
+    if (!key || (me->flags & SKIPLIST_MMAP_RDONLY) || UINT32_MAX < klen)
+        return -1;
+
+    /* grow before searching; a remap would invalidate the search */
+    uint64_t vsize = __align(sizeof(uint64_t) + vlen);
+    uint64_t used = __hdr(me)->used;
+    if (__reserve(me, used + vsize +
+                  __node_size(SKIPLIST_MMAP_MAX_LEVELS, klen)))
+        return -1;
+
+    skiplist_mmap_header_t *h = __hdr(me);
+    skiplist_off_t pred[SKIPLIST_MMAP_MAX_LEVELS];
+    skiplist_off_t found = __find(me, key, klen, pred);
+
+    /* the value goes first, past the end; nothing refers to it yet */
+    uint64_t *rec = (uint64_t*)(me->base + used);
+    *rec = vlen;
+    memcpy(rec + 1, val, vlen);
+
+    if (found)
+    {
+        if (__sync_range(me, used, used + vsize))
+            return -1;
+        h->used = used + vsize;
+        __store(&__node(me, found)->val, used);
+        return __sync_range(me, found, found + sizeof(skiplist_mmap_node_t));
+    }
+
+    unsigned int i, levels = __flip_coins(me);
+    skiplist_off_t off = used + vsize;
+    skiplist_mmap_node_t *n = __node(me, off);
+    n->val = used;
+    n->klen = klen;
+    n->levels = levels;
+    for (i = 0; i < levels; i++)
+        n->next[i] = i < h->levels ? __tower(me, pred[i])[i] : 0;
+    memcpy(n->next + levels, key, klen);
+
+    uint64_t end = off + __node_size(levels, klen);
+    if (__sync_range(me, used, end))
+        return -1;
+    h->used = end;
+
+    /* bottom line first. The level 0 link is the commit point */
+    for (i = 0; i < levels; i++)
+    {
+        skiplist_off_t *t = i < h->levels ? __tower(me, pred[i]) : h->nil;
+        __store(t + i, off);
+        if (0 == i && __sync_range(me, (char*)t - me->base,
+                                   (char*)(t + 1) - me->base))
+            return -1;
+    }
+
+    if (h->levels < levels)
+        h->levels = levels;
+    h->count++;
+    return 0;
+}
+
+int skiplist_mmap_remove(skiplist_mmap_t * me, const void *key, size_t klen)
+{
+    if (!key || (me->flags & SKIPLIST_MMAP_RDONLY))
+        return -1;
+
+    skiplist_mmap_header_t *h = __hdr(me);
+    skiplist_off_t pred[SKIPLIST_MMAP_MAX_LEVELS];
+    skiplist_off_t found = __find(me, key, klen, pred);
+
+    if (!found)
+        return 0;
+
+    skiplist_mmap_node_t *n = __node(me, found);
+    int i = (n->levels < h->levels ? n->levels : h->levels) - 1;
+
+    /* top line first, so that the node never sits on a line without also
+     * being on the lines below it. The level 0 unlink is the commit point */
+    for (; 0 <= i; i--)
+    {
+        skiplist_off_t *t = __tower(me, pred[i]);
+        if (t[i] == found)
+            __store(t + i, n->next[i]);
+        if (0 == i && __sync_range(me, (char*)t - me->base,
+                                   (char*)(t + 1) - me->base))
+            return -1;
+    }
+
+    h->count--;
+    while (1 < h->levels && !h->nil[h->levels - 1])
+        h->levels--;
+    return 1;
+}
+
+/*--------------------------------------------------------------79-characters-*/
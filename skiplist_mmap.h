@@ -0,0 +1,153 @@
+#ifndef SKIPLIST_MMAP_H
+#define SKIPLIST_MMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A skiplist that lives entirely inside a file-backed mmap region.
+ *
+ * Nodes refer to each other by offsets from the start of the region, never by
+ * pointers. This means the file can be mapped at any address, so opening a
+ * multi-GB index is just an mmap() (no deserialization), and any number of
+ * processes can map it read-only at the same time.
+ *
+ * Keys and values are byte strings which are copied into the region. Keys are
+ * ordered lexicographically (memcmp, shorter key first on a tie) because a
+ * comparator function pointer can't be persisted alongside the data.
+ *
+ * The region is append-only. Every put writes a complete node past the end of
+ * the used space and only then links it in, bottom line first. The level 0
+ * link is a single aligned store and is the commit point, so a crash at any
+ * time leaves a list that is valid at every level. Removed nodes and replaced
+ * values are not reclaimed. */
+
+/* with SKIPLIST_MMAP_OFF32 nodes are smaller, but the region can't grow past
+ * 4GiB; puts that would take it further fail */
+#ifdef SKIPLIST_MMAP_OFF32
+typedef uint32_t skiplist_off_t;
+#else
+typedef uint64_t skiplist_off_t;
+#endif
+
+#define SKIPLIST_MMAP_MAX_LEVELS 32
+
+enum {
+    /* create the file if it doesn't exist */
+    SKIPLIST_MMAP_CREATE = 1 << 0,
+    /* map read-only; put/remove will fail */
+    SKIPLIST_MMAP_RDONLY = 1 << 1,
+    /* msync() written records before they are linked in, and the link after.
+     * Without this a put survives a process crash but not a power failure */
+    SKIPLIST_MMAP_SYNC = 1 << 2,
+    /* only check the header on open, so that opening takes O(1) instead of
+     * a walk of every node. A corrupt list then goes unnoticed until
+     * skiplist_mmap_validate() is called, and an advisory count left behind
+     * by a crash isn't repaired */
+    SKIPLIST_MMAP_NOCHECK = 1 << 3,
+};
+
+typedef struct {
+    uint32_t magic;
+
+    uint32_t version;
+
+    /* sizeof(skiplist_off_t) of the writer that created the file */
+    uint32_t off_size;
+
+    /* number of lines */
+    uint32_t levels;
+
+    /* population; advisory, recomputed by skiplist_mmap_validate() */
+    uint64_t count;
+
+    /* bytes of the region in use. Appends start here */
+    uint64_t used;
+
+    /* state for choosing tower heights */
+    uint64_t seed;
+
+    /* the nil sentinel's tower */
+    skiplist_off_t nil[SKIPLIST_MMAP_MAX_LEVELS];
+} skiplist_mmap_header_t;
+
+typedef struct {
+    /* offset of the value record: a uint64_t length followed by the bytes */
+    skiplist_off_t val;
+
+    uint32_t klen;
+
+    /* height of the tower. Unlike node_t we record this because a reader
+     * needs to know where the key bytes start (right after the tower) */
+    uint32_t levels;
+
+    skiplist_off_t next[];
+} skiplist_mmap_node_t;
+
+typedef struct {
+    int fd;
+
+    int flags;
+
+    /* start of the mapping */
+    char *base;
+
+    /* mapped bytes */
+    size_t size;
+} skiplist_mmap_t;
+
+/**
+ * Map this file. Unless SKIPLIST_MMAP_NOCHECK is given, the whole list is
+ * validated before it is handed back, which takes O(n).
+ * @param flags SKIPLIST_MMAP_CREATE, SKIPLIST_MMAP_RDONLY, SKIPLIST_MMAP_SYNC,
+ *  SKIPLIST_MMAP_NOCHECK
+ * @return mapped skiplist; otherwise NULL if the file can't be opened or fails
+ *  validation */
+skiplist_mmap_t *skiplist_mmap_open(const char *path, int flags);
+
+/**
+ * Check the header and every line of the list for corruption. If the mapping
+ * is writable, repairs the advisory count.
+ * @return 0 if the list is intact; otherwise -1 */
+int skiplist_mmap_validate(skiplist_mmap_t * me);
+
+/**
+ * Get this key's value. The returned memory is inside the mapping and is only
+ * valid until the next put or get on this handle: either may remap the
+ * region, a get when a reader catches up with a writer's growth.
+ * @param vlen Receives the length of the value; may be NULL
+ * @return key's value, otherwise NULL */
+const void *skiplist_mmap_get(
+    skiplist_mmap_t * me,
+    const void *key,
+    size_t klen,
+    size_t *vlen);
+
+/**
+ * Associate key with val. Replaces the value if an equal key exists.
+ * @return 0 on success; otherwise -1 */
+int skiplist_mmap_put(
+    skiplist_mmap_t * me,
+    const void *key,
+    size_t klen,
+    const void *val,
+    size_t vlen);
+
+/**
+ * Remove this key from the list.
+ * @return 1 if the key was removed; 0 if it didn't exist; -1 on failure */
+int skiplist_mmap_remove(skiplist_mmap_t * me, const void *key, size_t klen);
+
+/**
+ * @return number of items */
+uint64_t skiplist_mmap_count(const skiplist_mmap_t * me);
+
+/**
+ * Flush the mapping to disk.
+ * @return 0 on success; otherwise -1 */
+int skiplist_mmap_sync(skiplist_mmap_t * me);
+
+void skiplist_mmap_close(skiplist_mmap_t * me);
+
+/*--------------------------------------------------------------79-characters-*/
+
+#endif /* SKIPLIST_MMAP_H */
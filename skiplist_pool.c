@@ -0,0 +1,264 @@
+/**
+ * Copyright (c) 2011, Willem-Hendrik Thiart
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * @file
+ * @author  Willem Thiart himself@willemthiart.com
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef SKIPLIST_NUMA
+#include <numa.h>
+#endif
+
+#include "skiplist_pool.h"
+
+#define GRAIN SKIPLIST_POOL_GRAIN
+
+/* anything bigger comes straight from malloc. The tallest tower is
+ * SKIPLIST_MAX_LEVELS pointers, so in practice nothing is */
+#define CLASSES 32
+
+typedef struct slab_s slab_t;
+
+/* sits at the start of each slab */
+struct slab_s {
+    slab_t *next;
+};
+
+typedef struct big_s big_t;
+
+/* sits in front of each allocation too big for a size class, so that reset
+ * can free the ones still out. Two pointers long, which keeps what follows
+ * as aligned as malloc's own */
+struct big_s {
+    big_t *next, *prev;
+};
+
+struct skiplist_pool_s {
+    int flags;
+
+    int numa_node;
+
+    /* free list per size class. The first word of a free object points to
+     * the next one */
+    void *free[CLASSES];
+
+    /* unused tail of the newest slab */
+    char *cur;
+
+    size_t left;
+
+    slab_t *slabs;
+
+    /* allocations too big for a size class */
+    big_t *bigs;
+
+    size_t bytes;
+
+    /* bytes handed out and not yet released */
+    size_t used;
+};
+
+static size_t __class(size_t size)
+{
+    return (size + GRAIN - 1) / GRAIN - 1;
+}
+
+/**
+ * Map a slab on a slab boundary, so that huge pages can back all of it.
+ * mmap only promises page alignment, so map twice as much and trim */
+static void *__map_aligned(void)
+{
+    size_t len = SKIPLIST_POOL_SLAB * 2;
+    char *p, *a;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == p)
+        return MAP_FAILED;
+    a = (char*)(((uintptr_t)p + SKIPLIST_POOL_SLAB - 1) &
+                ~(uintptr_t)(SKIPLIST_POOL_SLAB - 1));
+    if (a != p)
+        munmap(p, a - p);
+    munmap(a + SKIPLIST_POOL_SLAB, p + len - (a + SKIPLIST_POOL_SLAB));
+    return a;
+}
+
+static void *__map_slab(skiplist_pool_t * me)
+{
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (me->flags & SKIPLIST_POOL_HUGEPAGES)
+        p = mmap(NULL, SKIPLIST_POOL_SLAB, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (MAP_FAILED == p)
+    {
+        if (MAP_FAILED == (p = __map_aligned()))
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        if (me->flags & SKIPLIST_POOL_HUGEPAGES)
+            madvise(p, SKIPLIST_POOL_SLAB, MADV_HUGEPAGE);
+#endif
+    }
+
+#ifdef SKIPLIST_NUMA
+    /* pages haven't been touched yet, so they'll be faulted in on the node */
+    if (0 <= me->numa_node && -1 != numa_available())
+        numa_tonode_memory(p, SKIPLIST_POOL_SLAB, me->numa_node);
+#endif
+    return p;
+}
+
+skiplist_pool_t *skiplist_pool_new(int flags, int numa_node)
+{
+    skiplist_pool_t *me;
+
+    if (!(me = calloc(1, sizeof(skiplist_pool_t))))
+        return NULL;
+    me->flags = flags;
+    me->numa_node = numa_node;
+    return me;
+}
+
+void skiplist_pool_reset(skiplist_pool_t * me)
+{
+    while (me->slabs)
+    {
+        slab_t *next = me->slabs->next;
+        munmap(me->slabs, SKIPLIST_POOL_SLAB);
+        me->slabs = next;
+    }
+    while (me->bigs)
+    {
+        big_t *next = me->bigs->next;
+        free(me->bigs);
+        me->bigs = next;
+    }
+    memset(me->free, 0, sizeof(me->free));
+    me->cur = NULL;
+    me->left = 0;
+    me->bytes = 0;
+    me->used = 0;
+}
+
+void skiplist_pool_free(skiplist_pool_t * me)
+{
+    skiplist_pool_reset(me);
+    free(me);
+}
+
+/**
+ * Take size bytes off the unused end of the newest slab, mapping a new slab
+ * if it's too short */
+static void *__carve(skiplist_pool_t * me, size_t size)
+{
+    void *p;
+
+    if (me->left < size)
+    {
+        slab_t *s = __map_slab(me);
+        if (!s)
+            return NULL;
+        s->next = me->slabs;
+        me->slabs = s;
+        me->bytes += SKIPLIST_POOL_SLAB;
+
+        /* what was left of the old slab is too small to bother with */
+        me->cur = (char*)s + GRAIN;
+        me->left = SKIPLIST_POOL_SLAB - GRAIN;
+    }
+
+    /* fresh pages from mmap are already zeroed */
+    p = me->cur;
+    me->cur += size;
+    me->left -= size;
+    me->used += size;
+    return p;
+}
+
+/**
+ * Allocate from the heap, for sizes too big for a size class */
+static void *__big_alloc(skiplist_pool_t * me, size_t size)
+{
+    big_t *b;
+
+    if (!(b = calloc(1, sizeof(big_t) + size)))
+        return NULL;
+    b->next = me->bigs;
+    if (me->bigs)
+        me->bigs->prev = b;
+    me->bigs = b;
+    return b + 1;
+}
+
+static void __big_release(skiplist_pool_t * me, void *p)
+{
+    big_t *b = (big_t*)p - 1;
+
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        me->bigs = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    free(b);
+}
+
+void *skiplist_pool_alloc(skiplist_pool_t * me, size_t size)
+{
+    size_t c = __class(size);
+    void *p;
+
+    if (CLASSES <= c)
+        return __big_alloc(me, size);
+
+    if ((p = me->free[c]))
+    {
+        me->free[c] = *(void**)p;
+        memset(p, 0, (c + 1) * GRAIN);
+        me->used += (c + 1) * GRAIN;
+        return p;
+    }
+    return __carve(me, (c + 1) * GRAIN);
+}
+
+void *skiplist_pool_carve(skiplist_pool_t * me, size_t size)
+{
+    size_t c = __class(size);
+
+    if (CLASSES <= c)
+        return __big_alloc(me, size);
+    return __carve(me, (c + 1) * GRAIN);
+}
+
+void skiplist_pool_release(skiplist_pool_t * me, void *p, size_t size)
+{
+    size_t c = __class(size);
+
+    if (CLASSES <= c)
+    {
+        __big_release(me, p);
+        return;
+    }
+    *(void**)p = me->free[c];
+    me->free[c] = p;
+    me->used -= (c + 1) * GRAIN;
+}
+
+size_t skiplist_pool_bytes(const skiplist_pool_t * me)
+{
+    return me->bytes;
+}
+
+size_t skiplist_pool_slack(const skiplist_pool_t * me)
+{
+    return me->bytes - me->used;
+}
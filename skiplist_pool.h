@@ -0,0 +1,80 @@
+#ifndef SKIPLIST_POOL_H
+#define SKIPLIST_POOL_H
+
+#include <stddef.h>
+
+/* A slab allocator for nodes and towers.
+ *
+ * calloc() scatters nodes all over the heap, so a search touches a new page,
+ * and often takes a TLB miss, at nearly every step. A pool carves nodes out
+ * of large slabs instead, which can be backed by huge pages, and which can be
+ * bound to a NUMA node so that a list lives next to the CPUs reading it.
+ *
+ * Each size class keeps a free list, so freed nodes and towers are reused
+ * before the slab grows. Memory only goes back to the OS when the pool is
+ * destroyed.
+ *
+ * A pool isn't thread safe; give each list (or each set of lists used by one
+ * thread) its own. */
+
+/* bytes per slab; the size of a huge page on x86-64 */
+#define SKIPLIST_POOL_SLAB (2 << 20)
+
+/* sizes are rounded up to a multiple of this */
+#define SKIPLIST_POOL_GRAIN 16
+
+enum {
+    /* back slabs with MAP_HUGETLB pages. If none are reserved, fall back to
+     * asking for transparent huge pages with madvise() */
+    SKIPLIST_POOL_HUGEPAGES = 1 << 0,
+};
+
+typedef struct skiplist_pool_s skiplist_pool_t;
+
+/**
+ * @param flags SKIPLIST_POOL_HUGEPAGES
+ * @param numa_node Bind slabs to this NUMA node; -1 for no preference. Only
+ *  honoured when built with SKIPLIST_NUMA (and linked with -lnuma)
+ * @return new pool, otherwise NULL */
+skiplist_pool_t *skiplist_pool_new(int flags, int numa_node);
+
+/**
+ * Release every slab at once. Anything still allocated from the pool is
+ * freed with it */
+void skiplist_pool_free(skiplist_pool_t * me);
+
+/**
+ * Give every slab back to the OS, leaving the pool empty but usable. Anything
+ * allocated from the pool, including anything too big for a slab's size
+ * classes, is freed with them, so this frees a whole list in one go instead
+ * of a node at a time */
+void skiplist_pool_reset(skiplist_pool_t * me);
+
+/**
+ * @return zeroed memory of at least size bytes, otherwise NULL */
+void *skiplist_pool_alloc(skiplist_pool_t * me, size_t size);
+
+/**
+ * skiplist_pool_alloc, but always from the unused end of the newest slab and
+ * never from a free list, so that memory from successive calls is laid out
+ * one after another. Used to pack things into a fresh stretch of slab
+ * @return zeroed memory of at least size bytes, otherwise NULL */
+void *skiplist_pool_carve(skiplist_pool_t * me, size_t size);
+
+/**
+ * Give memory back to the pool.
+ * @param size At most what it was allocated with */
+void skiplist_pool_release(skiplist_pool_t * me, void *p, size_t size);
+
+/**
+ * @return bytes mapped for slabs */
+size_t skiplist_pool_bytes(const skiplist_pool_t * me);
+
+/**
+ * @return bytes mapped for slabs but not handed out: the free lists, and the
+ *  ends of slabs too short to have been used */
+size_t skiplist_pool_slack(const skiplist_pool_t * me);
+
+/*--------------------------------------------------------------79-characters-*/
+
+#endif /* SKIPLIST_POOL_H */
@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) 2011, Willem-Hendrik Thiart
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * @file
+ * @author  Willem Thiart himself@willemthiart.com
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "skiplist_pq.h"
+
+/**
+ * @return a random shard. Each thread has its own generator so that picking a
+ *  shard doesn't become the contended cache line */
+static skiplist_pq_shard_t *__pick(skiplist_pq_t * me)
+{
+    static __thread uint32_t seed;
+
+    if (!seed)
+        seed = (uint32_t)(uintptr_t)&seed | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return &me->shards[seed % me->nshards];
+}
+
+skiplist_pq_t *skiplist_pq_new(
+    func_longcmp_f cmp,
+    const void* udata,
+    unsigned int nshards)
+{
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    skiplist_pq_t *me;
+    unsigned int i;
+
+    if (0 == nshards)
+        return NULL;
+    if (!(me = calloc(1, sizeof(skiplist_pq_t))))
+        return NULL;
+    if (posix_memalign((void**)&me->shards, sizeof(skiplist_pq_shard_t),
+                       sizeof(skiplist_pq_shard_t) * nshards))
+    {
+        free(me);
+        return NULL;
+    }
+    me->cmp = cmp;
+    me->udata = udata;
+
+    for (me->nshards = 0; me->nshards < nshards; me->nshards++)
+    {
+        skiplist_pq_shard_t *s = &me->shards[me->nshards];
+        if (!(s->list = skiplist_new_opts(cmp, udata, &opts)))
+            goto fail;
+        pthread_mutex_init(&s->lock, NULL);
+    }
+    return me;
+
+fail:
+    for (i = 0; i < me->nshards; i++)
+    {
+        pthread_mutex_destroy(&me->shards[i].lock);
+        skiplist_freeall(me->shards[i].list);
+    }
+    free(me->shards);
+    free(me);
+    return NULL;
+}
+
+void skiplist_pq_free(skiplist_pq_t * me)
+{
+    unsigned int i;
+
+    for (i = 0; i < me->nshards; i++)
+    {
+        pthread_mutex_destroy(&me->shards[i].lock);
+        skiplist_freeall(me->shards[i].list);
+    }
+    free(me->shards);
+    free(me);
+}
+
+int skiplist_pq_put(skiplist_pq_t * me, void *key, void *val)
+{
+    skiplist_pq_shard_t *s = __pick(me);
+    int count;
+
+    if (!key || !val)
+        return -1;
+
+    /* spin over shards rather than queueing behind a busy one */
+    while (0 != pthread_mutex_trylock(&s->lock))
+        s = __pick(me);
+    count = skiplist_count(s->list);
+    skiplist_put(s->list, key, val);
+    /* put has no way of reporting that it ran out of memory */
+    count = skiplist_count(s->list) - count;
+    pthread_mutex_unlock(&s->lock);
+    return count ? 0 : -1;
+}
+
+/**
+ * @return the head of this locked shard, or NULL if it's empty */
+static node_t *__head(skiplist_pq_shard_t * s)
+{
+    return s->list->nil->next[0];
+}
+
+static void *__pop(skiplist_pq_shard_t * s, void **key)
+{
+    node_t *n = __head(s);
+
+    if (!n)
+        return NULL;
+    if (key)
+        *key = n->ety.k;
+    return skiplist_pop_min(s->list);
+}
+
+void *skiplist_pq_pop_min(skiplist_pq_t * me, void **key)
+{
+    unsigned int i;
+    void *v;
+
+    for (i = 0; i < me->nshards * 2; i++)
+    {
+        skiplist_pq_shard_t *a = __pick(me), *b = __pick(me);
+
+        if (0 != pthread_mutex_trylock(&a->lock))
+            continue;
+        /* a busy second choice isn't worth waiting for */
+        if (a == b || 0 != pthread_mutex_trylock(&b->lock))
+            b = a;
+
+        skiplist_pq_shard_t *s = a;
+        if (!__head(a) ||
+            (__head(b) && 0 < me->cmp(__head(a)->ety.k, __head(b)->ety.k,
+                                      me->udata)))
+            s = b;
+        v = __pop(s, key);
+
+        if (b != a)
+            pthread_mutex_unlock(&b->lock);
+        pthread_mutex_unlock(&a->lock);
+        if (v)
+            return v;
+    }
+
+    /* the shards we picked were empty or busy. Before saying the queue is
+     * empty make sure of it */
+    for (i = 0; i < me->nshards; i++)
+    {
+        skiplist_pq_shard_t *s = &me->shards[i];
+        pthread_mutex_lock(&s->lock);
+        v = __pop(s, key);
+        pthread_mutex_unlock(&s->lock);
+        if (v)
+            return v;
+    }
+    return NULL;
+}
+
+int skiplist_pq_count(skiplist_pq_t * me)
+{
+    unsigned int i;
+    int count = 0;
+
+    for (i = 0; i < me->nshards; i++)
+    {
+        pthread_mutex_lock(&me->shards[i].lock);
+        count += skiplist_count(me->shards[i].list);
+        pthread_mutex_unlock(&me->shards[i].lock);
+    }
+    return count;
+}
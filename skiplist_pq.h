@@ -0,0 +1,68 @@
+#ifndef SKIPLIST_PQ_H
+#define SKIPLIST_PQ_H
+
+#include <pthread.h>
+
+#include "skiplist.h"
+
+/* A relaxed concurrent priority queue built out of skiplists.
+ *
+ * With a single list every consumer contends on nil->next[0]. Instead the
+ * items are spread over a number of shards, each a SKIPLIST_MULTIMAP list with
+ * its own lock. A put goes to a random shard. A pop locks two random shards
+ * and takes the smaller of their minimums ("power of two choices"), so pops
+ * rarely collide on a lock, while what comes out stays close to the true
+ * minimum: with n shards the popped item is expected to be within O(n) ranks
+ * of it.
+ *
+ * Locks are only ever taken with trylock while another is held, so there is
+ * no lock ordering to get wrong. */
+
+typedef struct {
+    pthread_mutex_t lock;
+
+    skiplist_t *list;
+} __attribute__((aligned(64))) skiplist_pq_shard_t;
+
+typedef struct {
+    func_longcmp_f cmp;
+
+    const void* udata;
+
+    unsigned int nshards;
+
+    skiplist_pq_shard_t *shards;
+} skiplist_pq_t;
+
+/**
+ * @param udata User data passed to comparator
+ * @param nshards Number of shards; 2 to 4 per consuming thread works well.
+ *  With 1 shard pops are exact
+ * @return new queue, otherwise NULL */
+skiplist_pq_t *skiplist_pq_new(
+    func_longcmp_f cmp,
+    const void* udata,
+    unsigned int nshards);
+
+void skiplist_pq_free(skiplist_pq_t * me);
+
+/**
+ * Add this item. Items with equal keys are all kept.
+ * @param val Must not be NULL; NULL is how pop says the queue is empty
+ * @return 0 on success, otherwise -1 */
+int skiplist_pq_put(skiplist_pq_t * me, void *key, void *val);
+
+/**
+ * Remove an item with one of the smallest keys. Only returns NULL if every
+ * shard was empty when looked at.
+ * @param key Receives the item's key; may be NULL
+ * @return item's value, otherwise NULL */
+void *skiplist_pq_pop_min(skiplist_pq_t * me, void **key);
+
+/**
+ * @return number of items. Only exact if nothing is being put or popped */
+int skiplist_pq_count(skiplist_pq_t * me);
+
+/*--------------------------------------------------------------79-characters-*/
+
+#endif /* SKIPLIST_PQ_H */
@@ -0,0 +1,543 @@
+/**
+ * Copyright (c) 2011, Willem-Hendrik Thiart
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * @file
+ * @author  Willem Thiart himself@willemthiart.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "skiplist_str.h"
+
+#define __align4(x) (((x) + 3) & ~(size_t)3)
+
+typedef struct {
+    const char *k;
+    size_t len;
+    void *v;
+} __entry_t;
+
+static long __keycmp(const void *k1, size_t l1, const void *k2, size_t l2)
+{
+    int c = memcmp(k1, k2, l1 < l2 ? l1 : l2);
+    if (c)
+        return c;
+    return (long)l1 - (long)l2;
+}
+
+static long __cmp(const void *k1, const void *k2, const void *udata)
+{
+    const skiplist_str_key_t *a = k1, *b = k2;
+    (void)udata;
+    return __keycmp(a->s, a->len, b->s, b->len);
+}
+
+static size_t __varint_len(size_t v)
+{
+    size_t n = 1;
+    while (v >>= 7)
+        n++;
+    return n;
+}
+
+static char *__put_varint(char *p, size_t v)
+{
+    for (; 0x80 <= v; v >>= 7)
+        *p++ = (char)(v | 0x80);
+    *p++ = (char)v;
+    return p;
+}
+
+static const char *__get_varint(const char *p, size_t *v)
+{
+    unsigned int shift = 0;
+    *v = 0;
+    do
+        *v |= (size_t)(*p & 0x7f) << shift, shift += 7;
+    while (*p++ & 0x80);
+    return p;
+}
+
+static unsigned int __nrestarts(unsigned int count)
+{
+    return (count + SKIPLIST_STR_RESTART - 1) / SKIPLIST_STR_RESTART;
+}
+
+static uint32_t *__restarts(const skiplist_str_block_t * b)
+{
+    return (uint32_t*)(b->data + __align4(b->size));
+}
+
+static size_t __block_size(const skiplist_str_block_t * b)
+{
+    return sizeof(skiplist_str_block_t) + __align4(b->size) +
+        sizeof(uint32_t) * __nrestarts(b->count);
+}
+
+/**
+ * Parse the entry at *off, and move *off on to the next entry.
+ * @return the entry's unshared bytes */
+static const char *__parse(
+    const skiplist_str_block_t * b,
+    unsigned int *off,
+    size_t *shared,
+    size_t *unshared,
+    void **val)
+{
+    const char *p = b->data + *off, *bytes;
+
+    p = __get_varint(p, shared);
+    p = __get_varint(p, unshared);
+    bytes = p;
+    p += *unshared;
+    memcpy(val, p, sizeof(void*));
+    *off = p + sizeof(void*) - b->data;
+    return bytes;
+}
+
+/**
+ * Decode the entry at off on top of the previous key, which is in buf.
+ * Only the bytes past the shared prefix are written, so decoding the same
+ * entry twice is harmless.
+ * @return offset of the next entry */
+static unsigned int __decode(
+    const skiplist_str_block_t * b,
+    unsigned int off,
+    char *buf,
+    size_t *klen,
+    void **val)
+{
+    size_t shared, unshared;
+    const char *bytes = __parse(b, &off, &shared, &unshared, val);
+
+    memcpy(buf + shared, bytes, unshared);
+    *klen = shared + unshared;
+    return off;
+}
+
+static size_t __shared(const __entry_t *a, const __entry_t *b)
+{
+    size_t i, max = a->len < b->len ? a->len : b->len;
+    for (i = 0; i < max && a->k[i] == b->k[i]; i++);
+    return i;
+}
+
+/**
+ * Encode these entries into a new block
+ * @return new block, otherwise NULL if out of memory */
+static skiplist_str_block_t *__pack(const __entry_t *e, unsigned int n)
+{
+    skiplist_str_block_t *b;
+    size_t size = 0;
+    unsigned int i;
+    char *p;
+
+    for (i = 0; i < n; i++)
+    {
+        size_t shared = i % SKIPLIST_STR_RESTART ? __shared(&e[i - 1], &e[i]) : 0;
+        size += __varint_len(shared) + __varint_len(e[i].len - shared) +
+            e[i].len - shared + sizeof(void*);
+    }
+
+    if (!(b = malloc(sizeof(skiplist_str_block_t) + __align4(size) +
+                     sizeof(uint32_t) * __nrestarts(n))))
+        return NULL;
+    b->count = n;
+    b->size = size;
+
+    for (p = b->data, i = 0; i < n; i++)
+    {
+        size_t shared = 0;
+
+        if (0 == i % SKIPLIST_STR_RESTART)
+            __restarts(b)[i / SKIPLIST_STR_RESTART] = p - b->data;
+        else
+            shared = __shared(&e[i - 1], &e[i]);
+
+        p = __put_varint(p, shared);
+        p = __put_varint(p, e[i].len - shared);
+        if (0 == i)
+        {
+            b->first.s = p;
+            b->first.len = e[i].len;
+        }
+        memcpy(p, e[i].k + shared, e[i].len - shared);
+        p += e[i].len - shared;
+        memcpy(p, &e[i].v, sizeof(void*));
+        p += sizeof(void*);
+    }
+    return b;
+}
+
+/**
+ * Decode every entry in b. The keys are copied into a single allocation.
+ * @param keys Receives the key allocation, which the caller frees
+ * @return entries, with room for one more; otherwise NULL if out of memory */
+static __entry_t *__unpack(const skiplist_str_block_t * b, char **keys)
+{
+    size_t shared, unshared, total = 0;
+    unsigned int i, off;
+    __entry_t *e;
+    void *v;
+    char *k;
+
+    for (off = 0, i = 0; i < b->count; i++)
+    {
+        __parse(b, &off, &shared, &unshared, &v);
+        total += shared + unshared;
+    }
+
+    e = malloc(sizeof(__entry_t) * (b->count + 1));
+    *keys = malloc(total ? total : 1);
+    if (!e || !*keys)
+    {
+        free(e);
+        free(*keys);
+        return NULL;
+    }
+
+    for (k = *keys, off = 0, i = 0; i < b->count; i++)
+    {
+        const char *bytes = __parse(b, &off, &shared, &unshared, &e[i].v);
+        if (shared)
+            memcpy(k, e[i - 1].k, shared);
+        memcpy(k + shared, bytes, unshared);
+        e[i].k = k;
+        e[i].len = shared + unshared;
+        k += e[i].len;
+    }
+    return e;
+}
+
+/**
+ * Find the first entry in b with a key not less than key. Binary searches the
+ * restart points, then decodes forward into buf.
+ * @param idx Receives the entry's index; b->count if every key is less
+ * @param off Receives the entry's offset
+ * @param val Receives the entry's value
+ * @return 0 if the entry's key is equal; 1 if it's greater; -1 if there's no
+ *  such entry */
+static int __seek(
+    const skiplist_str_block_t * b,
+    const void *key,
+    size_t klen,
+    char *buf,
+    unsigned int *idx,
+    unsigned int *off,
+    void **val)
+{
+    uint32_t *restarts = __restarts(b);
+    unsigned int lo = 0, hi = __nrestarts(b->count) - 1;
+
+    while (lo < hi)
+    {
+        unsigned int mid = (lo + hi + 1) / 2, o = restarts[mid];
+        size_t shared, unshared;
+        const char *k = __parse(b, &o, &shared, &unshared, val);
+
+        if (__keycmp(k, unshared, key, klen) <= 0)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    *idx = lo * SKIPLIST_STR_RESTART;
+    *off = restarts[lo];
+    for (; *idx < b->count; (*idx)++)
+    {
+        size_t len;
+        unsigned int next = __decode(b, *off, buf, &len, val);
+        long c = __keycmp(buf, len, key, klen);
+
+        if (0 <= c)
+            return 0 == c ? 0 : 1;
+        *off = next;
+    }
+    return -1;
+}
+
+/**
+ * @return the list entry of the block key belongs in, otherwise NULL if
+ *  there are no blocks */
+static skiplist_entry_t *__block_for(
+    skiplist_str_t * me,
+    const void *key,
+    size_t klen)
+{
+    skiplist_str_key_t probe = { key, klen };
+    skiplist_entry_t *e = skiplist_floor(me->list, &probe);
+
+    /* smaller than every key; it goes at the front of the first block */
+    if (!e)
+        e = skiplist_ceiling(me->list, &probe);
+    return e;
+}
+
+skiplist_str_t *skiplist_str_new(void)
+{
+    skiplist_str_t *me;
+
+    if (!(me = calloc(1, sizeof(skiplist_str_t))))
+        return NULL;
+    if (!(me->list = skiplist_new(__cmp, NULL)))
+    {
+        free(me);
+        return NULL;
+    }
+    return me;
+}
+
+void skiplist_str_free(skiplist_str_t * me)
+{
+    node_t *n;
+
+    for (n = me->list->nil->next[0]; n; n = n->next[0])
+        free(n->ety.v);
+    skiplist_freeall(me->list);
+    free(me->buf);
+    free(me);
+}
+
+int skiplist_str_count(const skiplist_str_t * me)
+{
+    return me->count;
+}
+
+void *skiplist_str_get(skiplist_str_t * me, const void *key, size_t klen)
+{
+    skiplist_entry_t *e;
+    unsigned int idx, off;
+    void *v;
+
+    if (!key || me->buflen < klen || !(e = __block_for(me, key, klen)))
+        return NULL;
+    if (0 == __seek(e->v, key, klen, me->buf, &idx, &off, &v))
+        return v;
+    return NULL;
+}
+
+/**
+ * Replace the block filed under e with these entries, splitting them over two
+ * blocks if there are too many.
+ * @return 0 on success, otherwise -1 if out of memory, leaving e's block as it
+ *  was */
+static int __repack(
+    skiplist_str_t * me,
+    skiplist_entry_t *e,
+    const __entry_t *entries,
+    unsigned int n)
+{
+    unsigned int half = SKIPLIST_STR_BLOCK < n ? n / 2 : n;
+    skiplist_str_block_t *b, *upper = NULL;
+
+    if (!(b = __pack(entries, half)))
+        return -1;
+    if (half < n && !(upper = __pack(entries + half, n - half)))
+    {
+        free(b);
+        return -1;
+    }
+
+    /* file the upper half first, so that if there's no room for it the old
+     * block is left whole */
+    if (upper)
+    {
+        int count = skiplist_count(me->list);
+
+        skiplist_put(me->list, &upper->first, upper);
+        if (count == skiplist_count(me->list))
+        {
+            free(b);
+            free(upper);
+            return -1;
+        }
+    }
+
+    /* the first key may have changed, but not its place among the blocks,
+     * so the block can be swapped in without relinking */
+    free(e->v);
+    e->k = &b->first;
+    e->v = b;
+    return 0;
+}
+
+void *skiplist_str_put(
+    skiplist_str_t * me,
+    const void *key,
+    size_t klen,
+    void *val)
+{
+    __entry_t *entries, new = { key, klen, val };
+    skiplist_entry_t *e;
+    skiplist_str_block_t *b;
+    unsigned int idx, off;
+    char *keys;
+    void *v;
+
+    if (!key)
+        return NULL;
+
+    if (!me->buf || me->buflen < klen)
+    {
+        char *buf = realloc(me->buf, klen + 1);
+        if (!buf)
+            return NULL;
+        me->buf = buf;
+        me->buflen = klen;
+    }
+
+    if (!(e = __block_for(me, key, klen)))
+    {
+        if (!(b = __pack(&new, 1)))
+            return NULL;
+        /* the list was empty, so it still is if out of memory */
+        skiplist_put(me->list, &b->first, b);
+        if (0 == skiplist_count(me->list))
+        {
+            free(b);
+            return NULL;
+        }
+        me->count++;
+        return NULL;
+    }
+
+    b = e->v;
+    int c = __seek(b, key, klen, me->buf, &idx, &off, &v);
+    if (0 == c)
+    {
+        /* values are fixed size, so replacing one needs no re-encoding */
+        size_t shared, unshared;
+        __parse(b, &off, &shared, &unshared, &v);
+        memcpy(b->data + off - sizeof(void*), &val, sizeof(void*));
+        return v;
+    }
+
+    if (!(entries = __unpack(b, &keys)))
+        return NULL;
+    memmove(entries + idx + 1, entries + idx,
+            sizeof(__entry_t) * (b->count - idx));
+    entries[idx] = new;
+    if (0 == __repack(me, e, entries, b->count + 1))
+        me->count++;
+    free(entries);
+    free(keys);
+    return NULL;
+}
+
+void *skiplist_str_remove(skiplist_str_t * me, const void *key, size_t klen)
+{
+    __entry_t *entries;
+    skiplist_entry_t *e;
+    skiplist_str_block_t *b;
+    unsigned int idx, off;
+    char *keys;
+    void *v;
+
+    if (!key || me->buflen < klen || !(e = __block_for(me, key, klen)))
+        return NULL;
+
+    b = e->v;
+    if (0 != __seek(b, key, klen, me->buf, &idx, &off, &v))
+        return NULL;
+
+    if (1 == b->count)
+    {
+        skiplist_remove(me->list, &b->first);
+        free(b);
+        me->count--;
+        return v;
+    }
+
+    if (!(entries = __unpack(b, &keys)))
+        return NULL;
+    memmove(entries + idx, entries + idx + 1,
+            sizeof(__entry_t) * (b->count - idx - 1));
+    if (0 == __repack(me, e, entries, b->count - 1))
+        me->count--;
+    else
+        v = NULL;
+    free(entries);
+    free(keys);
+    return v;
+}
+
+size_t skiplist_str_bytes(const skiplist_str_t * me)
+{
+    size_t bytes = sizeof(skiplist_str_t) + me->buflen;
+    node_t *n = me->list->nil;
+
+    /* towers are as tall as they were allocated, not as they are now */
+    bytes += sizeof(skiplist_t) + sizeof(node_t) +
+        sizeof(node_t*) * n->capacity;
+    for (n = n->next[0]; n; n = n->next[0])
+        bytes += sizeof(node_t) + sizeof(node_t*) * n->capacity +
+            __block_size(n->ety.v);
+    return bytes;
+}
+
+int skiplist_str_iterator(
+    skiplist_str_t * me,
+    const void *key,
+    size_t klen,
+    skiplist_str_iterator_t * iter)
+{
+    void *v;
+
+    memset(iter, 0, sizeof(skiplist_str_iterator_t));
+    if (!(iter->key = malloc(me->buflen + 1)))
+        return -1;
+
+    iter->node = me->list->nil->next[0];
+    if (key && iter->node)
+    {
+        /* ety is node_t's first member */
+        iter->node = (node_t*)__block_for(me, key, klen);
+        if (-1 == __seek(iter->node->ety.v, key, klen, iter->key,
+                         &iter->idx, &iter->off, &v))
+        {
+            iter->node = iter->node->next[0];
+            iter->idx = iter->off = 0;
+        }
+    }
+    return 0;
+}
+
+int skiplist_str_iterator_next(
+    skiplist_str_iterator_t * iter,
+    const char **key,
+    size_t *klen,
+    void **val)
+{
+    skiplist_str_block_t *b;
+    void *v;
+
+    if (!iter->node)
+        return 0;
+
+    b = iter->node->ety.v;
+    iter->off = __decode(b, iter->off, iter->key, &iter->keylen, &v);
+    if (key)
+        *key = iter->key;
+    if (klen)
+        *klen = iter->keylen;
+    if (val)
+        *val = v;
+
+    /* the next block starts with a restart point, so nothing carries over */
+    if (++iter->idx == b->count)
+    {
+        iter->node = iter->node->next[0];
+        iter->idx = iter->off = 0;
+    }
+    return 1;
+}
+
+void skiplist_str_iterator_done(skiplist_str_iterator_t * iter)
+{
+    free(iter->key);
+    iter->key = NULL;
+    iter->node = NULL;
+}
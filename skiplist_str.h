@@ -0,0 +1,135 @@
+#ifndef SKIPLIST_STR_H
+#define SKIPLIST_STR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "skiplist.h"
+
+/* A map from byte string keys to values, built for keys that share long
+ * prefixes (URLs, paths).
+ *
+ * Instead of a node per key, the skiplist holds blocks of up to
+ * SKIPLIST_STR_BLOCK sorted entries. Inside a block each key is front coded:
+ * stored as the length of the prefix it shares with the previous key, plus the
+ * rest. Every SKIPLIST_STR_RESTART-th key is stored in full (a "restart
+ * point"), so a get finds its block with the skiplist, binary searches the
+ * restart points, and then decodes at most SKIPLIST_STR_RESTART keys.
+ *
+ * Keys are ordered lexicographically (memcmp, shorter key first on a tie) and
+ * copied into the blocks. Put and remove re-encode the block they touch, so
+ * they cost O(log n + SKIPLIST_STR_BLOCK). */
+
+/* most entries a block holds before it's split in two */
+#define SKIPLIST_STR_BLOCK 64
+
+/* keys between restart points */
+#define SKIPLIST_STR_RESTART 16
+
+typedef struct {
+    const char *s;
+
+    size_t len;
+} skiplist_str_key_t;
+
+typedef struct {
+    /* the first key, stored in full; it points into data. The block is filed
+     * in the skiplist under this key */
+    skiplist_str_key_t first;
+
+    /* number of entries */
+    unsigned int count;
+
+    /* bytes of encoded entries. The restart offsets follow them */
+    unsigned int size;
+
+    /* entries, each: varint shared length, varint unshared length, the
+     * unshared bytes, and the value. Then a uint32_t offset per restart */
+    char data[];
+} skiplist_str_block_t;
+
+typedef struct {
+    /* blocks, keyed by their first key */
+    skiplist_t *list;
+
+    /* population */
+    unsigned int count;
+
+    /* scratch space for decoding a key; as long as the longest key put */
+    char *buf;
+
+    size_t buflen;
+} skiplist_str_t;
+
+typedef struct {
+    /* skiplist node of the block being decoded */
+    node_t *node;
+
+    /* entry within the block, and its offset */
+    unsigned int idx;
+
+    unsigned int off;
+
+    /* the key returned last. Entries are decoded on top of it */
+    char *key;
+
+    size_t keylen;
+} skiplist_str_iterator_t;
+
+skiplist_str_t *skiplist_str_new(void);
+
+void skiplist_str_free(skiplist_str_t * me);
+
+/**
+ * @return key's value, otherwise NULL */
+void *skiplist_str_get(skiplist_str_t * me, const void *key, size_t klen);
+
+/**
+ * Associate key with val. The key is copied. If out of memory, the list is
+ * left as it was, which skiplist_str_count tells apart from a new key.
+ * @return previous associated val; otherwise NULL */
+void *skiplist_str_put(
+    skiplist_str_t * me,
+    const void *key,
+    size_t klen,
+    void *val);
+
+/**
+ * @return value of the removed key, otherwise NULL */
+void *skiplist_str_remove(skiplist_str_t * me, const void *key, size_t klen);
+
+/**
+ * @return number of items */
+int skiplist_str_count(const skiplist_str_t * me);
+
+/**
+ * @return bytes used by the blocks and the skiplist nodes that index them */
+size_t skiplist_str_bytes(const skiplist_str_t * me);
+
+/**
+ * Iterate in key order. Keys are decoded one at a time as the scan reaches
+ * them. A put or remove ends the iteration.
+ * @param key Start at the first key not less than this; NULL for the start
+ * @return 0 on success, otherwise -1 if out of memory */
+int skiplist_str_iterator(
+    skiplist_str_t * me,
+    const void *key,
+    size_t klen,
+    skiplist_str_iterator_t * iter);
+
+/**
+ * @param key Receives the next key. It is only valid until the next call
+ * @return 1 if there was another item, otherwise 0 */
+int skiplist_str_iterator_next(
+    skiplist_str_iterator_t * iter,
+    const char **key,
+    size_t *klen,
+    void **val);
+
+/**
+ * Release the iterator's key buffer */
+void skiplist_str_iterator_done(skiplist_str_iterator_t * iter);
+
+/*--------------------------------------------------------------79-characters-*/
+
+#endif /* SKIPLIST_STR_H */
@@ -0,0 +1,219 @@
+/**
+ * Copyright (c) 2011, Willem-Hendrik Thiart
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * @file
+ * @author  Willem Thiart himself@willemthiart.com
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "skiplist_tpool.h"
+
+/* one per thread; a line each so that stealing doesn't bounce the owner's */
+typedef struct {
+    pthread_mutex_t lock;
+
+    /* tasks not yet taken */
+    unsigned int lo, hi;
+} __attribute__((aligned(64))) deque_t;
+
+typedef struct {
+    skiplist_tpool_t *pool;
+
+    unsigned int idx;
+} worker_t;
+
+struct skiplist_tpool_s {
+    unsigned int nthreads;
+
+    /* nthreads - 1 of them; the caller is thread 0 */
+    pthread_t *threads;
+
+    worker_t *workers;
+
+    deque_t *deques;
+
+    pthread_mutex_t lock;
+
+    /* a new batch, or stop */
+    pthread_cond_t work;
+
+    /* busy reached 0 */
+    pthread_cond_t done;
+
+    /* bumped for each batch */
+    unsigned long batch;
+
+    /* threads still working on the batch */
+    unsigned int busy;
+
+    int stop;
+
+    /* current batch */
+    func_task_f fn;
+
+    char *args;
+
+    size_t argsize;
+};
+
+/**
+ * @return a task from the front of our deque, or the back of someone else's;
+ *  otherwise -1 once every task has been taken */
+static long __take(skiplist_tpool_t * me, unsigned int idx)
+{
+    unsigned int i;
+
+    for (i = 0; i < me->nthreads; i++)
+    {
+        deque_t *d = &me->deques[(idx + i) % me->nthreads];
+        long task = -1;
+
+        pthread_mutex_lock(&d->lock);
+        if (d->lo < d->hi)
+            task = 0 == i ? d->lo++ : --d->hi;
+        pthread_mutex_unlock(&d->lock);
+        if (0 <= task)
+            return task;
+    }
+    return -1;
+}
+
+static void __work(skiplist_tpool_t * me, unsigned int idx)
+{
+    long task;
+
+    while (0 <= (task = __take(me, idx)))
+        me->fn(me->args + task * me->argsize);
+}
+
+static void *__worker(void *arg)
+{
+    worker_t *w = arg;
+    skiplist_tpool_t *me = w->pool;
+    unsigned long seen = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&me->lock);
+        while (!me->stop && me->batch == seen)
+            pthread_cond_wait(&me->work, &me->lock);
+        if (me->stop)
+        {
+            pthread_mutex_unlock(&me->lock);
+            return NULL;
+        }
+        seen = me->batch;
+        pthread_mutex_unlock(&me->lock);
+
+        __work(me, w->idx);
+
+        pthread_mutex_lock(&me->lock);
+        if (0 == --me->busy)
+            pthread_cond_signal(&me->done);
+        pthread_mutex_unlock(&me->lock);
+    }
+}
+
+skiplist_tpool_t *skiplist_tpool_new(unsigned int nthreads)
+{
+    skiplist_tpool_t *me;
+    unsigned int i;
+
+    if (0 == nthreads || !(me = calloc(1, sizeof(skiplist_tpool_t))))
+        return NULL;
+    me->nthreads = nthreads;
+    me->threads = calloc(nthreads, sizeof(pthread_t));
+    me->workers = calloc(nthreads, sizeof(worker_t));
+    me->deques = aligned_alloc(64, nthreads * sizeof(deque_t));
+    if (!me->threads || !me->workers || !me->deques)
+    {
+        free(me->threads);
+        free(me->workers);
+        free(me->deques);
+        free(me);
+        return NULL;
+    }
+    pthread_mutex_init(&me->lock, NULL);
+    pthread_cond_init(&me->work, NULL);
+    pthread_cond_init(&me->done, NULL);
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_mutex_init(&me->deques[i].lock, NULL);
+        me->deques[i].lo = me->deques[i].hi = 0;
+        me->workers[i].pool = me;
+        me->workers[i].idx = i;
+    }
+
+    for (i = 1; i < nthreads; i++)
+        if (pthread_create(&me->threads[i], NULL, __worker, &me->workers[i]))
+        {
+            /* make do with the threads we've got */
+            me->nthreads = i;
+            break;
+        }
+    return me;
+}
+
+void skiplist_tpool_free(skiplist_tpool_t * me)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&me->lock);
+    me->stop = 1;
+    pthread_cond_broadcast(&me->work);
+    pthread_mutex_unlock(&me->lock);
+    for (i = 1; i < me->nthreads; i++)
+        pthread_join(me->threads[i], NULL);
+
+    for (i = 0; i < me->nthreads; i++)
+        pthread_mutex_destroy(&me->deques[i].lock);
+    pthread_mutex_destroy(&me->lock);
+    pthread_cond_destroy(&me->work);
+    pthread_cond_destroy(&me->done);
+    free(me->threads);
+    free(me->workers);
+    free(me->deques);
+    free(me);
+}
+
+unsigned int skiplist_tpool_threads(const skiplist_tpool_t * me)
+{
+    return me->nthreads;
+}
+
+void skiplist_tpool_run(
+    skiplist_tpool_t * me,
+    func_task_f fn,
+    void *args,
+    size_t argsize,
+    unsigned int n)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&me->lock);
+    me->fn = fn;
+    me->args = args;
+    me->argsize = argsize;
+    for (i = 0; i < me->nthreads; i++)
+    {
+        pthread_mutex_lock(&me->deques[i].lock);
+        me->deques[i].lo = (unsigned long)n * i / me->nthreads;
+        me->deques[i].hi = (unsigned long)n * (i + 1) / me->nthreads;
+        pthread_mutex_unlock(&me->deques[i].lock);
+    }
+    me->busy = me->nthreads - 1;
+    me->batch++;
+    pthread_cond_broadcast(&me->work);
+    pthread_mutex_unlock(&me->lock);
+
+    __work(me, 0);
+
+    pthread_mutex_lock(&me->lock);
+    while (0 < me->busy)
+        pthread_cond_wait(&me->done, &me->lock);
+    pthread_mutex_unlock(&me->lock);
+}
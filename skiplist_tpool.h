@@ -0,0 +1,45 @@
+#ifndef SKIPLIST_TPOOL_H
+#define SKIPLIST_TPOOL_H
+
+#include <stddef.h>
+
+/* A small work-stealing thread pool for the bulk operations.
+ *
+ * A batch of tasks is dealt out evenly to the threads up front. Each thread
+ * runs its own tasks from the front, and once it's out of tasks it steals
+ * from the back of the others', so a thread that lands slow tasks doesn't
+ * hold up the batch.
+ *
+ * The thread calling skiplist_tpool_run() works too, so a pool of one thread
+ * starts no threads at all. Batches run one at a time. */
+
+typedef void (*func_task_f) (void *arg);
+
+typedef struct skiplist_tpool_s skiplist_tpool_t;
+
+/**
+ * @param nthreads Threads to run tasks on, counting the caller's
+ * @return new pool, otherwise NULL */
+skiplist_tpool_t *skiplist_tpool_new(unsigned int nthreads);
+
+/**
+ * Stop and join the threads */
+void skiplist_tpool_free(skiplist_tpool_t * me);
+
+/**
+ * @return threads in the pool, counting the caller's */
+unsigned int skiplist_tpool_threads(const skiplist_tpool_t * me);
+
+/**
+ * Call fn on each of n args, and wait for every call to return.
+ * @param args Array of n args, each argsize bytes */
+void skiplist_tpool_run(
+    skiplist_tpool_t * me,
+    func_task_f fn,
+    void *args,
+    size_t argsize,
+    unsigned int n);
+
+/*--------------------------------------------------------------79-characters-*/
+
+#endif /* SKIPLIST_TPOOL_H */
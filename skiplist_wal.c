@@ -0,0 +1,461 @@
+/**
+ * Copyright (c) 2011, Willem-Hendrik Thiart
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * @file
+ * @author  Willem Thiart himself@willemthiart.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "skiplist_wal.h"
+
+struct skiplist_wal_s {
+    int fd;
+
+    pthread_t flusher;
+
+    pthread_mutex_t lock;
+
+    /* for the flusher: something was logged, or we're closing */
+    pthread_cond_t wake;
+
+    /* for skiplist_wal_sync(): durable has moved on */
+    pthread_cond_t synced;
+
+    /* logged but not yet handed to the flusher */
+    char *buf;
+
+    size_t len, size;
+
+    /* the flusher's buffer, swapped with buf for each group */
+    char *out;
+
+    size_t outsize;
+
+    /* LSNs are byte offsets into the log. Everything before appended has
+     * been logged, and everything before durable is on disk */
+    int64_t appended;
+
+    int64_t durable;
+
+    unsigned int delay_us;
+
+    /* a write or sync failed; nothing more can be made durable */
+    int err;
+
+    int stop;
+};
+
+static uint32_t __fnv(uint32_t h, const void *p, size_t len)
+{
+    const unsigned char *c = p;
+
+    while (len--)
+        h = (h ^ *c++) * 16777619u;
+    return h;
+}
+
+static uint32_t __sum(const skiplist_wal_record_t *r, const void *body)
+{
+    uint32_t h = __fnv(2166136261u, &r->op, sizeof(*r) - sizeof(r->sum));
+    return __fnv(h, body, (size_t)r->klen + r->vlen);
+}
+
+/**
+ * @return length of the intact record at off, otherwise 0 */
+static size_t __record(const char *data, size_t size, size_t off)
+{
+    skiplist_wal_record_t r;
+    size_t len;
+
+    if (size - off < sizeof(r))
+        return 0;
+    memcpy(&r, data + off, sizeof(r));
+    len = sizeof(r) + (size_t)r.klen + r.vlen;
+    if ((SKIPLIST_WAL_PUT != r.op && SKIPLIST_WAL_REMOVE != r.op) ||
+        size - off < len || r.sum != __sum(&r, data + off + sizeof(r)))
+        return 0;
+    return len;
+}
+
+/**
+ * Read the whole file into memory
+ * @return file contents, otherwise NULL */
+static char *__read_all(int fd, size_t *size)
+{
+    struct stat st;
+    char *data;
+    size_t got = 0;
+
+    if (fstat(fd, &st) || !(data = malloc(st.st_size + 1)))
+        return NULL;
+    while (got < (size_t)st.st_size)
+    {
+        ssize_t n = pread(fd, data + got, st.st_size - got, got);
+        if (n <= 0)
+        {
+            if (n < 0 && EINTR == errno)
+                continue;
+            break;
+        }
+        got += n;
+    }
+    *size = got;
+    return data;
+}
+
+static int __write_all(int fd, const char *p, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *__flusher(void *arg)
+{
+    skiplist_wal_t *me = arg;
+
+    pthread_mutex_lock(&me->lock);
+    while (1)
+    {
+        while (!me->stop && 0 == me->len)
+            pthread_cond_wait(&me->wake, &me->lock);
+        if (0 == me->len)
+            break;
+
+        /* let the group grow */
+        if (me->delay_us && !me->stop)
+        {
+            pthread_mutex_unlock(&me->lock);
+            usleep(me->delay_us);
+            pthread_mutex_lock(&me->lock);
+        }
+
+        /* take the group, and leave writers our old buffer to carry on in */
+        char *group = me->buf;
+        size_t len = me->len, size = me->size;
+        int64_t end = me->appended;
+        me->buf = me->out;
+        me->size = me->outsize;
+        me->len = 0;
+        pthread_mutex_unlock(&me->lock);
+
+        int err = __write_all(me->fd, group, len) || fdatasync(me->fd);
+
+        pthread_mutex_lock(&me->lock);
+        me->out = group;
+        me->outsize = size;
+        if (err)
+            me->err = 1;
+        else
+            me->durable = end;
+        pthread_cond_broadcast(&me->synced);
+    }
+    pthread_mutex_unlock(&me->lock);
+    return NULL;
+}
+
+skiplist_wal_t *skiplist_wal_open(const char *path, unsigned int delay_us)
+{
+    skiplist_wal_t *me;
+    char *data;
+    size_t size, off = 0, len;
+
+    if (!(me = calloc(1, sizeof(skiplist_wal_t))))
+        return NULL;
+    me->delay_us = delay_us;
+
+    if (-1 == (me->fd = open(path, O_RDWR | O_CREAT, 0644)))
+        goto fail;
+
+    /* find the end of the last intact record; a torn one after it goes, or
+     * appends after it would be lost on replay */
+    if (!(data = __read_all(me->fd, &size)))
+        goto fail;
+    while ((len = __record(data, size, off)))
+        off += len;
+    free(data);
+    if ((off < size && ftruncate(me->fd, off)) ||
+        (off_t)-1 == lseek(me->fd, off, SEEK_SET))
+        goto fail;
+    me->appended = me->durable = off;
+
+    pthread_mutex_init(&me->lock, NULL);
+    pthread_cond_init(&me->wake, NULL);
+    pthread_cond_init(&me->synced, NULL);
+    if (pthread_create(&me->flusher, NULL, __flusher, me))
+    {
+        pthread_mutex_destroy(&me->lock);
+        pthread_cond_destroy(&me->wake);
+        pthread_cond_destroy(&me->synced);
+        goto fail;
+    }
+    return me;
+
+fail:
+    if (0 <= me->fd)
+        close(me->fd);
+    free(me);
+    return NULL;
+}
+
+int skiplist_wal_close(skiplist_wal_t * me)
+{
+    int err;
+
+    pthread_mutex_lock(&me->lock);
+    me->stop = 1;
+    pthread_cond_signal(&me->wake);
+    pthread_mutex_unlock(&me->lock);
+    pthread_join(me->flusher, NULL);
+
+    /* close even after a failure, or the fd leaks */
+    err = close(me->fd);
+    if (me->err)
+        err = -1;
+    pthread_mutex_destroy(&me->lock);
+    pthread_cond_destroy(&me->wake);
+    pthread_cond_destroy(&me->synced);
+    free(me->buf);
+    free(me->out);
+    free(me);
+    return err;
+}
+
+static int64_t __append(
+    skiplist_wal_t * me,
+    uint32_t op,
+    const void *key,
+    size_t klen,
+    const void *val,
+    size_t vlen)
+{
+    skiplist_wal_record_t r;
+    size_t len = sizeof(r) + klen + vlen;
+    int64_t lsn;
+    char *p;
+
+    if (UINT32_MAX < klen || UINT32_MAX < vlen)
+        return -1;
+    r.op = op;
+    r.klen = klen;
+    r.vlen = vlen;
+
+    pthread_mutex_lock(&me->lock);
+    if (me->err)
+    {
+        pthread_mutex_unlock(&me->lock);
+        return -1;
+    }
+    if (me->size < me->len + len)
+    {
+        size_t size = me->size ? me->size : 4096;
+        while (size < me->len + len)
+            size *= 2;
+        if (!(p = realloc(me->buf, size)))
+        {
+            pthread_mutex_unlock(&me->lock);
+            return -1;
+        }
+        me->buf = p;
+        me->size = size;
+    }
+
+    /* checksum in place, so the key and value are only copied once */
+    p = me->buf + me->len;
+    memcpy(p + sizeof(r), key, klen);
+    if (vlen)
+        memcpy(p + sizeof(r) + klen, val, vlen);
+    r.sum = __sum(&r, p + sizeof(r));
+    memcpy(p, &r, sizeof(r));
+
+    if (0 == me->len)
+        pthread_cond_signal(&me->wake);
+    me->len += len;
+    lsn = me->appended += len;
+    pthread_mutex_unlock(&me->lock);
+    return lsn;
+}
+
+int64_t skiplist_wal_put(
+    skiplist_wal_t * me,
+    const void *key,
+    size_t klen,
+    const void *val,
+    size_t vlen)
+{
+    return __append(me, SKIPLIST_WAL_PUT, key, klen, val, vlen);
+}
+
+int64_t skiplist_wal_remove(skiplist_wal_t * me, const void *key, size_t klen)
+{
+    return __append(me, SKIPLIST_WAL_REMOVE, key, klen, NULL, 0);
+}
+
+int skiplist_wal_sync(skiplist_wal_t * me, int64_t lsn)
+{
+    int err;
+
+    /* the put or remove this came from wasn't logged */
+    if (lsn < 0)
+        return -1;
+
+    pthread_mutex_lock(&me->lock);
+    while (!me->err && me->durable < lsn)
+        pthread_cond_wait(&me->synced, &me->lock);
+    err = me->durable < lsn ? -1 : 0;
+    pthread_mutex_unlock(&me->lock);
+    return err;
+}
+
+static void __drop(func_entry_f drop, void *k, void *v, void *udata)
+{
+    skiplist_entry_t ety = { .k = k, .v = v };
+
+    if (drop)
+        drop(&ety, udata);
+}
+
+/**
+ * Put, dropping whatever the put leaves unused
+ * @return 0 on success, otherwise -1 if out of memory */
+static int __apply_put(
+    skiplist_t * list,
+    skiplist_entry_t * ety,
+    func_entry_f drop,
+    void *udata)
+{
+    int count = skiplist_count(list);
+    void *old = skiplist_put(list, ety->k, ety->v);
+
+    /* a replaced value keeps the list's key */
+    if (old)
+        __drop(drop, ety->k, old, udata);
+    else if (count == skiplist_count(list))
+    {
+        __drop(drop, ety->k, ety->v, udata);
+        return -1;
+    }
+    return 0;
+}
+
+static void __apply_remove(
+    skiplist_t * list,
+    void *key,
+    func_entry_f drop,
+    void *udata)
+{
+    skiplist_entry_t *e = skiplist_ceiling(list, key);
+
+    /* the first of any equal keys, which is the one remove takes */
+    if (e && 0 == list->cmp(key, e->k, list->udata))
+    {
+        skiplist_entry_t removed = *e;
+        skiplist_remove(list, key);
+        __drop(drop, removed.k, removed.v, udata);
+    }
+    __drop(drop, key, NULL, udata);
+}
+
+int skiplist_wal_replay(
+    const char *path,
+    skiplist_t * list,
+    func_wal_decode_f decode,
+    func_entry_f drop,
+    void *udata)
+{
+    skiplist_wal_record_t r;
+    skiplist_entry_t *items = NULL, ety;
+    size_t size, off, len;
+    int fd, n = 0, puts = 0, i;
+    char *data;
+
+    if (-1 == (fd = open(path, O_RDONLY)))
+        return -1;
+    data = __read_all(fd, &size);
+    close(fd);
+    if (!data)
+        return -1;
+
+    /* records were checked here, so they needn't be again below */
+    for (off = 0; (len = __record(data, size, off)); off += len, n++)
+    {
+        memcpy(&r, data + off, sizeof(r));
+        puts += SKIPLIST_WAL_PUT == r.op;
+    }
+
+    /* a log of nothing but puts may be in key order, and can then be loaded
+     * in one go */
+    if (0 < n && n == puts && 0 == skiplist_count(list))
+    {
+        if (!(items = malloc(n * sizeof(skiplist_entry_t))))
+            goto fail;
+        for (i = 0, off = 0; i < n; i++, off += len)
+        {
+            const char *k = data + off + sizeof(r);
+            memcpy(&r, data + off, sizeof(r));
+            len = sizeof(r) + (size_t)r.klen + r.vlen;
+            if (decode(k, r.klen, k + r.klen, r.vlen, &items[i], udata))
+            {
+                for (; 0 < i; i--)
+                    __drop(drop, items[i - 1].k, items[i - 1].v, udata);
+                goto fail;
+            }
+        }
+        if (skiplist_load(list, items, n, NULL))
+            for (i = 0; i < n; i++)
+                if (__apply_put(list, &items[i], drop, udata))
+                {
+                    for (i++; i < n; i++)
+                        __drop(drop, items[i].k, items[i].v, udata);
+                    goto fail;
+                }
+        free(items);
+        free(data);
+        return n;
+    }
+
+    for (i = 0, off = 0; i < n; i++, off += len)
+    {
+        const char *k = data + off + sizeof(r);
+        memcpy(&r, data + off, sizeof(r));
+        len = sizeof(r) + (size_t)r.klen + r.vlen;
+        if (SKIPLIST_WAL_PUT == r.op)
+        {
+            if (decode(k, r.klen, k + r.klen, r.vlen, &ety, udata) ||
+                __apply_put(list, &ety, drop, udata))
+                goto fail;
+        }
+        else
+        {
+            if (decode(k, r.klen, NULL, 0, &ety, udata))
+                goto fail;
+            __apply_remove(list, ety.k, drop, udata);
+        }
+    }
+    free(data);
+    return n;
+
+fail:
+    free(items);
+    free(data);
+    return -1;
+}
@@ -0,0 +1,114 @@
+#ifndef SKIPLIST_WAL_H
+#define SKIPLIST_WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "skiplist.h"
+
+/* A write-ahead log, to make puts and removes on a skiplist_t durable without
+ * making each caller wait for the disk.
+ *
+ * Logging an operation only copies it into a buffer and returns a log
+ * sequence number (LSN). A flusher thread writes out everything buffered
+ * since its last write in one go and calls fdatasync() once for the lot, so
+ * however many threads are logging, they share each sync (group commit). A
+ * caller that needs to know an operation has reached the disk waits on its
+ * LSN with skiplist_wal_sync().
+ *
+ * Log first, then apply the operation to the list. At startup,
+ * skiplist_wal_replay() applies the log to a fresh list.
+ *
+ * Keys and values are logged as byte strings, so the caller supplies a
+ * decoder that turns them back into the list's keys and values. Each record
+ * carries a checksum; a torn record at the end of the log, from a crash
+ * mid-write, is dropped when the log is opened. */
+
+enum {
+    SKIPLIST_WAL_PUT = 1,
+    SKIPLIST_WAL_REMOVE = 2,
+};
+
+typedef struct {
+    /* FNV-1a of the rest of the record, key and value included */
+    uint32_t sum;
+
+    /* SKIPLIST_WAL_PUT or SKIPLIST_WAL_REMOVE */
+    uint32_t op;
+
+    uint32_t klen;
+
+    uint32_t vlen;
+
+    /* then the key bytes, then the value bytes */
+} skiplist_wal_record_t;
+
+/**
+ * Turn a logged key and value back into what the list holds.
+ * @param val NULL for a remove, which only needs the key
+ * @param ety Receives the key and value
+ * @return 0 on success, otherwise -1 */
+typedef int (*func_wal_decode_f) (
+        const void *key,
+        size_t klen,
+        const void *val,
+        size_t vlen,
+        skiplist_entry_t *ety,
+        void *udata);
+
+typedef struct skiplist_wal_s skiplist_wal_t;
+
+/**
+ * Open the log for appending, creating it if need be, and start the flusher.
+ * @param delay_us How long the flusher waits after the first operation of a
+ *  group, to let more join it. 0 to write as soon as there's anything; a
+ *  group still forms from whatever is logged while a sync is under way
+ * @return log, otherwise NULL */
+skiplist_wal_t *skiplist_wal_open(const char *path, unsigned int delay_us);
+
+/**
+ * Write out and sync whatever is buffered, then stop the flusher and close
+ * the log.
+ * @return 0 if everything logged reached the disk, otherwise -1 */
+int skiplist_wal_close(skiplist_wal_t * me);
+
+/**
+ * Log a put. Doesn't wait for the disk.
+ * @return the put's LSN, otherwise -1 if a write has failed */
+int64_t skiplist_wal_put(
+    skiplist_wal_t * me,
+    const void *key,
+    size_t klen,
+    const void *val,
+    size_t vlen);
+
+/**
+ * Log a remove. Doesn't wait for the disk.
+ * @return the remove's LSN, otherwise -1 if a write has failed */
+int64_t skiplist_wal_remove(skiplist_wal_t * me, const void *key, size_t klen);
+
+/**
+ * Wait until everything up to this LSN has been synced.
+ * @return 0 once it's durable, otherwise -1 if a write or sync failed, or if
+ *  lsn is -1 from a put or remove that failed */
+int skiplist_wal_sync(skiplist_wal_t * me, int64_t lsn);
+
+/**
+ * Apply the log to a list, in order.
+ * If the list is empty and the log only holds puts in key order (eg. it was
+ * written by a bulk ingest) the list is built with skiplist_load in O(n);
+ * otherwise each operation is applied in turn.
+ * @param drop Called with each key and value that the replay leaves unused:
+ *  removed items, the key of a remove, and on a replaced value, the new key
+ *  with the old value. May be NULL
+ * @return number of operations applied, otherwise -1 on failure */
+int skiplist_wal_replay(
+    const char *path,
+    skiplist_t * list,
+    func_wal_decode_f decode,
+    func_entry_f drop,
+    void *udata);
+
+/*--------------------------------------------------------------79-characters-*/
+
+#endif /* SKIPLIST_WAL_H */
@@ -0,0 +1,103 @@
+/* Compare plain gets and puts with finger searches on local access patterns.
+ *
+ * Build with "make bench_finger". Reports the mean cost of a get and a put,
+ * and the mean number of comparisons a get made, with and without a finger. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "skiplist.h"
+
+#define N 1000000
+
+/* clustered keys come in bursts this long, within this distance of a random
+ * centre */
+#define BURST 64
+#define SPREAD 256
+
+static long __ulong_compare(const void *k1, const void *k2, const void *udata)
+{
+    (void)udata;
+    return (unsigned long)k1 < (unsigned long)k2 ? -1 :
+           (unsigned long)k1 > (unsigned long)k2;
+}
+
+static double __now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void __fill(unsigned long *keys, int order)
+{
+    unsigned long i, centre = 0;
+
+    srand(1);
+    for (i = 0; i < N; i++)
+        switch (order)
+        {
+        case 0: keys[i] = i + 1; break;
+        case 1:
+            if (0 == i % BURST)
+                centre = SPREAD + rand() % (N - 2 * SPREAD);
+            keys[i] = centre + rand() % (2 * SPREAD);
+            break;
+        default: keys[i] = (i * 2654435761UL) % N + 1; break;
+        }
+}
+
+static void __run(const char *name, int order, int finger)
+{
+    static unsigned long keys[N];
+    skiplist_opts_t opts = { .capacity = N };
+    skiplist_t *me;
+    skiplist_finger_t f;
+    unsigned long i;
+    double t0, put, get;
+
+    /* a pool of its own, so that each run's nodes are laid out alike rather
+     * than wherever the last run's frees left holes in the heap */
+    opts.pool = skiplist_pool_new(0, -1);
+    __fill(keys, order);
+    me = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_finger_init(&f);
+
+    t0 = __now();
+    for (i = 0; i < N; i++)
+        if (finger)
+            skiplist_finger_put(me, &f, (void *) keys[i], (void *) keys[i]);
+        else
+            skiplist_put(me, (void *) keys[i], (void *) keys[i]);
+    put = (__now() - t0) / N;
+
+    skiplist_stats_reset(me);
+    t0 = __now();
+    for (i = 0; i < N; i++)
+        if (finger)
+            skiplist_finger_get(me, &f, (void *) keys[i]);
+        else
+            skiplist_get(me, (void *) keys[i]);
+    get = (__now() - t0) / N;
+
+    printf("%-10s %-6s %8.1f %8.1f %9.1f\n", name, finger ? "finger" : "plain",
+           put, get, (double)me->stats.cmps / N);
+    skiplist_drop(me);
+    skiplist_pool_free(opts.pool);
+}
+
+int main(void)
+{
+    const char *names[] = { "sequential", "clustered", "random" };
+    int order;
+
+    printf("%-10s %-6s %8s %8s %9s\n", "order", "search",
+           "put ns", "get ns", "avg cmps");
+    for (order = 0; order < 3; order++)
+    {
+        __run(names[order], order, 0);
+        __run(names[order], order, 1);
+    }
+    return 0;
+}
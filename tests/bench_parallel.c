@@ -0,0 +1,87 @@
+/* How the bulk operations scale with threads.
+ *
+ * Build with "make bench_par". Loads, scans and validates a list of N items
+ * (the first argument; 2M by default) with 1 to 64 threads, and reports the
+ * time each took and the speedup over one thread. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "skiplist.h"
+
+static long __ulong_compare(const void *k1, const void *k2, const void *udata)
+{
+    (void)udata;
+    return (unsigned long)k1 < (unsigned long)k2 ? -1 :
+           (unsigned long)k1 > (unsigned long)k2;
+}
+
+static double __now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void __sum(skiplist_entry_t *ety, void *udata)
+{
+    *(unsigned long *)udata += (unsigned long)ety->v;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int n = 1 < argc ? atoi(argv[1]) : 2000000;
+    unsigned long sums[64 * 4];
+    void *udata[64 * 4];
+    double base[3] = { 0 };
+    skiplist_entry_t *items;
+    unsigned int i, threads;
+
+    items = malloc(n * sizeof(skiplist_entry_t));
+    for (i = 0; i < n; i++)
+    {
+        items[i].k = (void *) (unsigned long) (i + 1);
+        items[i].v = (void *) 1;
+    }
+    for (i = 0; i < 64 * 4; i++)
+        udata[i] = &sums[i];
+
+    printf("%7s %10s %7s %10s %7s %10s %7s\n", "threads",
+           "load ms", "x", "scan ms", "x", "valid ms", "x");
+    for (threads = 1; threads <= 64; threads *= 2)
+    {
+        skiplist_tpool_t *tp = skiplist_tpool_new(threads);
+        skiplist_t *me = skiplist_new(__ulong_compare, NULL);
+        unsigned long total = 0;
+        double t[3], t0;
+        int runs, r;
+
+        t0 = __now();
+        skiplist_load(me, items, n, tp);
+        t[0] = __now() - t0;
+
+        for (i = 0; i < threads * 4; i++)
+            sums[i] = 0;
+        t0 = __now();
+        runs = skiplist_scan(me, NULL, NULL, __sum, udata, threads * 4, tp);
+        t[1] = __now() - t0;
+        for (r = 0; r < runs; r++)
+            total += sums[r];
+
+        t0 = __now();
+        if (skiplist_validate_par(me, tp) || total != n)
+            printf("list is broken\n");
+        t[2] = __now() - t0;
+
+        for (i = 0; i < 3 && 1 == threads; i++)
+            base[i] = t[i];
+        printf("%7u %10.1f %7.2f %10.1f %7.2f %10.1f %7.2f\n", threads,
+               t[0], base[0] / t[0], t[1], base[1] / t[1],
+               t[2], base[2] / t[2]);
+        skiplist_freeall(me);
+        skiplist_tpool_free(tp);
+    }
+    free(items);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/* Compare the randomized and deterministic modes on adversarial key orders.
+ *
+ * Build with "make bench". Reports the mean cost of a put and a get, and the
+ * worst and mean number of comparisons a get made. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "skiplist.h"
+
+#define N 200000
+
+static long __ulong_compare(const void *k1, const void *k2, const void *udata)
+{
+    (void)udata;
+    return (unsigned long)k1 < (unsigned long)k2 ? -1 :
+           (unsigned long)k1 > (unsigned long)k2;
+}
+
+static double __now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void __fill(unsigned long *keys, int order)
+{
+    unsigned long i;
+
+    for (i = 0; i < N; i++)
+        switch (order)
+        {
+        case 0: keys[i] = i + 1; break;
+        case 1: keys[i] = N - i; break;
+        /* alternate between both ends */
+        case 2: keys[i] = i % 2 ? N - i / 2 : i / 2 + 1; break;
+        default: keys[i] = (i * 2654435761UL) % N + 1; break;
+        }
+}
+
+static void __run(const char *name, int order, int flags)
+{
+    static unsigned long keys[N];
+    skiplist_opts_t opts = { .flags = flags };
+    skiplist_t *me;
+    unsigned long i, worst = 0, total = 0;
+    double t0, put, get;
+
+    __fill(keys, order);
+    me = skiplist_new_opts(__ulong_compare, NULL, &opts);
+
+    t0 = __now();
+    for (i = 0; i < N; i++)
+        skiplist_put(me, (void *) keys[i], (void *) keys[i]);
+    put = (__now() - t0) / N;
+
+    t0 = __now();
+    for (i = 0; i < N; i++)
+        skiplist_get(me, (void *) keys[i]);
+    get = (__now() - t0) / N;
+
+    for (i = 0; i < N; i++)
+    {
+        /* skiplist_stats() walks the list, so read the counter directly */
+        skiplist_stats_reset(me);
+        skiplist_get(me, (void *) keys[i]);
+        total += me->stats.cmps;
+        if (worst < me->stats.cmps)
+            worst = me->stats.cmps;
+    }
+
+    printf("%-11s %-13s %8.1f %8.1f %9lu %9.1f\n", name,
+           flags & SKIPLIST_DETERMINISTIC ? "deterministic" : "random",
+           put, get, worst, (double)total / N);
+    skiplist_freeall(me);
+}
+
+int main(void)
+{
+    const char *names[] = { "ascending", "descending", "zigzag", "random" };
+    int order;
+
+    printf("%-11s %-13s %8s %8s %9s %9s\n", "order", "mode",
+           "put ns", "get ns", "max cmps", "avg cmps");
+    for (order = 0; order < 4; order++)
+    {
+        __run(names[order], order, 0);
+        __run(names[order], order, SKIPLIST_DETERMINISTIC);
+    }
+    return 0;
+}
@@ -0,0 +1,469 @@
+/* Tail latency under YCSB-style mixes, from several threads.
+ *
+ * Build with "make bench_ycsb". A list isn't thread safe, so two ways of
+ * sharing one are compared: a single list behind a read-write lock, and the
+ * key space cut into SHARDS ranges, each its own list and lock. For each of
+ * the core workloads A to F and each thread count, reports throughput and the
+ * 50th, 99th and 99.9th percentile latency of each kind of op.
+ *
+ * ./bench_ycsb [duration ms per run] [max threads] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "skiplist.h"
+
+#define RECORDS 100000
+
+#define SHARDS 16
+
+/* YCSB's request distribution: hot keys follow a zipfian with this skew */
+#define THETA 0.99
+
+#define MAX_SCAN 100
+
+/* Latency histogram, after HdrHistogram: buckets are exact below 128ns, and
+ * above that each power of two is cut into 64, so every bucket is within
+ * 1.6% of the values in it */
+#define SUB_BITS 6
+#define SUB (1 << SUB_BITS)
+#define BUCKETS (SUB * 42)
+
+enum {
+    READ,
+    UPDATE,
+    INSERT,
+    SCAN,
+    RMW,
+    NKINDS
+};
+
+static const char *__kinds[] = { "read", "update", "insert", "scan", "rmw" };
+
+typedef struct {
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} histogram_t;
+
+static unsigned int __bucket(uint64_t ns)
+{
+    unsigned int e;
+
+    if (ns < 2 * SUB)
+        return ns;
+    e = 63 - __builtin_clzll(ns) - SUB_BITS;
+    if (BUCKETS <= SUB * e + (ns >> e))
+        return BUCKETS - 1;
+    return SUB * e + (ns >> e);
+}
+
+static uint64_t __bucket_value(unsigned int i)
+{
+    unsigned int e;
+
+    if (i < 2 * SUB)
+        return i;
+    e = i / SUB - 1;
+    return (uint64_t)(i - SUB * e) << e;
+}
+
+static void __record(histogram_t *h, uint64_t ns)
+{
+    h->counts[__bucket(ns)]++;
+    h->total++;
+    if (h->max < ns)
+        h->max = ns;
+}
+
+static void __merge(histogram_t *h, const histogram_t *other)
+{
+    unsigned int i;
+
+    for (i = 0; i < BUCKETS; i++)
+        h->counts[i] += other->counts[i];
+    h->total += other->total;
+    if (h->max < other->max)
+        h->max = other->max;
+}
+
+static double __percentile(const histogram_t *h, double p)
+{
+    uint64_t want = h->total * p, seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < BUCKETS; i++)
+        if (want < (seen += h->counts[i]))
+            return __bucket_value(i) / 1e3;
+    return h->max / 1e3;
+}
+
+/* Workloads */
+
+typedef struct {
+    const char *name;
+
+    /* percent of each kind of op */
+    int mix[NKINDS];
+
+    /* reads go to the most recently inserted records */
+    int latest;
+} workload_t;
+
+static const workload_t __workloads[] = {
+    { "A", { 50, 50, 0, 0, 0 }, 0 },
+    { "B", { 95, 5, 0, 0, 0 }, 0 },
+    { "C", { 100, 0, 0, 0, 0 }, 0 },
+    { "D", { 95, 0, 5, 0, 0 }, 1 },
+    { "E", { 0, 0, 5, 95, 0 }, 0 },
+    { "F", { 50, 0, 0, 0, 50 }, 0 },
+};
+
+/* Gray et al.'s zipfian generator, as YCSB uses it */
+typedef struct {
+    double zetan, alpha, eta, half;
+    unsigned long n;
+} zipf_t;
+
+static void __zipf_init(zipf_t *z, unsigned long n)
+{
+    double zeta2 = 1 + pow(0.5, THETA);
+    unsigned long i;
+
+    z->n = n;
+    z->zetan = 0;
+    for (i = 1; i <= n; i++)
+        z->zetan += 1 / pow(i, THETA);
+    z->alpha = 1 / (1 - THETA);
+    z->eta = (1 - pow(2.0 / n, 1 - THETA)) / (1 - zeta2 / z->zetan);
+    z->half = 1 + pow(0.5, THETA);
+}
+
+static uint64_t __rand(uint64_t *s)
+{
+    /* xorshift64* */
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+static double __uniform(uint64_t *s)
+{
+    return (__rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned long __zipf(const zipf_t *z, uint64_t *s)
+{
+    double u = __uniform(s), uz = u * z->zetan;
+
+    if (uz < 1)
+        return 0;
+    if (uz < z->half)
+        return 1;
+    return z->n * pow(z->eta * u - z->eta + 1, z->alpha);
+}
+
+/**
+ * Record numbers are hashed into keys, so that popular records are spread
+ * over the key space rather than bunched at one end. Keys are in [1, 2^60] */
+static unsigned long __key(unsigned long record)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        h ^= (record >> (i * 8)) & 0xff;
+        h *= 1099511628211ULL;
+    }
+    return (h >> 4) + 1;
+}
+
+/* Stores */
+
+typedef struct {
+    pthread_rwlock_t lock;
+    skiplist_t *list;
+} shard_t;
+
+typedef struct {
+    unsigned int nshards;
+    shard_t shards[SHARDS];
+} store_t;
+
+static long __ulong_compare(const void *k1, const void *k2, const void *udata)
+{
+    (void)udata;
+    return (unsigned long)k1 < (unsigned long)k2 ? -1 :
+           (unsigned long)k1 > (unsigned long)k2;
+}
+
+static int __ulong_sort(const void *a, const void *b)
+{
+    const skiplist_entry_t *x = a, *y = b;
+    return __ulong_compare(x->k, y->k, NULL);
+}
+
+static unsigned int __shard(const store_t *st, unsigned long key)
+{
+    /* shards cover equal ranges of the key space, in order */
+    return (key - 1) / ((1UL << 60) / st->nshards);
+}
+
+static void __store_load(store_t *st, unsigned int nshards)
+{
+    static skiplist_entry_t items[RECORDS];
+    unsigned long i;
+    unsigned int s, from = 0;
+
+    for (i = 0; i < RECORDS; i++)
+    {
+        items[i].k = (void *) __key(i);
+        items[i].v = (void *) (i + 1);
+    }
+    qsort(items, RECORDS, sizeof(skiplist_entry_t), __ulong_sort);
+
+    st->nshards = nshards;
+    for (s = 0; s < nshards; s++)
+    {
+        unsigned int to = from;
+        while (to < RECORDS &&
+               __shard(st, (unsigned long)items[to].k) == s)
+            to++;
+        pthread_rwlock_init(&st->shards[s].lock, NULL);
+        st->shards[s].list = skiplist_new(__ulong_compare, NULL);
+        skiplist_load(st->shards[s].list, items + from, to - from, NULL);
+        from = to;
+    }
+}
+
+static void __store_free(store_t *st)
+{
+    unsigned int s;
+
+    for (s = 0; s < st->nshards; s++)
+    {
+        skiplist_freeall(st->shards[s].list);
+        pthread_rwlock_destroy(&st->shards[s].lock);
+    }
+}
+
+static void *__store_read(store_t *st, unsigned long key)
+{
+    shard_t *sh = &st->shards[__shard(st, key)];
+    void *v;
+
+    pthread_rwlock_rdlock(&sh->lock);
+    v = skiplist_get(sh->list, (void *) key);
+    pthread_rwlock_unlock(&sh->lock);
+    return v;
+}
+
+static void __store_put(store_t *st, unsigned long key, unsigned long val)
+{
+    shard_t *sh = &st->shards[__shard(st, key)];
+
+    pthread_rwlock_wrlock(&sh->lock);
+    skiplist_put(sh->list, (void *) key, (void *) val);
+    pthread_rwlock_unlock(&sh->lock);
+}
+
+static void __store_rmw(store_t *st, unsigned long key)
+{
+    shard_t *sh = &st->shards[__shard(st, key)];
+    unsigned long v;
+
+    pthread_rwlock_wrlock(&sh->lock);
+    v = (unsigned long)skiplist_get(sh->list, (void *) key);
+    skiplist_put(sh->list, (void *) key, (void *) (v + 1));
+    pthread_rwlock_unlock(&sh->lock);
+}
+
+/**
+ * Read len items from the first key not less than key, carrying on into the
+ * shards after this one if need be
+ * @return sum of the values, so the scan can't be optimised away */
+static unsigned long __store_scan(store_t *st, unsigned long key, int len)
+{
+    skiplist_iterator_t iter;
+    unsigned long sum = 0;
+    unsigned int s;
+
+    for (s = __shard(st, key); s < st->nshards && 0 < len; s++)
+    {
+        shard_t *sh = &st->shards[s];
+
+        pthread_rwlock_rdlock(&sh->lock);
+        skiplist_iterator_from(sh->list, (void *) key, &iter);
+        for (; 0 < len && skiplist_iterator_has_next(sh->list, &iter); len--)
+            sum += (unsigned long)skiplist_iterator_next_value(sh->list, &iter);
+        pthread_rwlock_unlock(&sh->lock);
+        key = 1;
+    }
+    return sum;
+}
+
+/* Runs */
+
+typedef struct {
+    store_t *st;
+    const workload_t *w;
+    const zipf_t *z;
+    pthread_barrier_t *start;
+    volatile int *stop;
+    unsigned long *inserted;
+    uint64_t seed;
+    unsigned long ops, sink;
+    histogram_t hist[NKINDS];
+} worker_t;
+
+static uint64_t __now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *__worker(void *arg)
+{
+    worker_t *wk = arg;
+    const workload_t *w = wk->w;
+    uint64_t *s = &wk->seed;
+
+    pthread_barrier_wait(wk->start);
+    while (!*wk->stop)
+    {
+        int p = __rand(s) % 100, kind;
+        unsigned long r, key;
+        uint64_t t0;
+
+        for (kind = 0; kind < NKINDS - 1 && w->mix[kind] <= p; kind++)
+            p -= w->mix[kind];
+
+        r = __zipf(wk->z, s);
+        if (w->latest)
+        {
+            unsigned long n = __atomic_load_n(wk->inserted, __ATOMIC_RELAXED);
+            r = r < n ? n - 1 - r : 0;
+        }
+        key = __key(r);
+
+        t0 = __now();
+        switch (kind)
+        {
+        case READ:
+            wk->sink += (unsigned long)__store_read(wk->st, key);
+            break;
+        case UPDATE:
+            __store_put(wk->st, key, r + 2);
+            break;
+        case INSERT:
+            r = __atomic_fetch_add(wk->inserted, 1, __ATOMIC_RELAXED);
+            __store_put(wk->st, __key(r), r + 1);
+            break;
+        case SCAN:
+            wk->sink += __store_scan(wk->st, key, 1 + __rand(s) % MAX_SCAN);
+            break;
+        case RMW:
+            __store_rmw(wk->st, key);
+            break;
+        }
+        __record(&wk->hist[kind], __now() - t0);
+        wk->ops++;
+    }
+    return NULL;
+}
+
+static void __run(
+    const workload_t *w,
+    const zipf_t *z,
+    const char *name,
+    unsigned int nshards,
+    unsigned int nthreads,
+    unsigned int ms)
+{
+    static histogram_t hist[NKINDS];
+    store_t st;
+    worker_t *wks = calloc(nthreads, sizeof(worker_t));
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    pthread_barrier_t start;
+    volatile int stop = 0;
+    unsigned long inserted = RECORDS, ops = 0;
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    uint64_t t0;
+    unsigned int i, k;
+    int first = 1;
+
+    __store_load(&st, nshards);
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++)
+    {
+        wks[i].st = &st;
+        wks[i].w = w;
+        wks[i].z = z;
+        wks[i].start = &start;
+        wks[i].stop = &stop;
+        wks[i].inserted = &inserted;
+        wks[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&threads[i], NULL, __worker, &wks[i]);
+    }
+    pthread_barrier_wait(&start);
+    t0 = __now();
+    nanosleep(&ts, NULL);
+    stop = 1;
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        ops += wks[i].ops;
+        for (k = 0; k < NKINDS; k++)
+            __merge(&hist[k], &wks[i].hist[k]);
+    }
+    t0 = __now() - t0;
+
+    for (k = 0; k < NKINDS; k++)
+    {
+        if (!hist[k].total)
+            continue;
+        if (first)
+            printf("%-8s %-7s %7u %9.1f ", w->name, name, nthreads,
+                   ops / (t0 / 1e9) / 1e3);
+        else
+            printf("%-8s %-7s %7s %9s ", "", "", "", "");
+        printf("%-6s %8.2f %8.2f %8.2f %9.2f\n", __kinds[k],
+               __percentile(&hist[k], 0.5), __percentile(&hist[k], 0.99),
+               __percentile(&hist[k], 0.999), hist[k].max / 1e3);
+        first = 0;
+    }
+
+    pthread_barrier_destroy(&start);
+    __store_free(&st);
+    free(threads);
+    free(wks);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int ms = 1 < argc ? atoi(argv[1]) : 200;
+    unsigned int max_threads = 2 < argc ? atoi(argv[2]) : 8;
+    unsigned int w, t;
+    zipf_t z;
+
+    __zipf_init(&z, RECORDS);
+    printf("%-8s %-7s %7s %9s %-6s %8s %8s %8s %9s\n", "workload", "store",
+           "threads", "kops/s", "op", "p50 us", "p99 us", "p999 us", "max us");
+    for (w = 0; w < sizeof(__workloads) / sizeof(__workloads[0]); w++)
+        for (t = 1; t <= max_threads; t *= 2)
+        {
+            __run(&__workloads[w], &z, "locked", 1, t, ms);
+            __run(&__workloads[w], &z, "sharded", SHARDS, t, ms);
+        }
+    return 0;
+}
@@ -0,0 +1,831 @@
+/* Differential tester. Reads a sequence of operations from a byte string and
+ * replays it against skiplist_t in each of its configurations, skiplist_str
+ * and skiplist_mmap, checking every result against a sorted array.
+ *
+ * "make fuzz" replays random sequences under AddressSanitizer. Given files,
+ * ./fuzz replays those instead, so it can be run by AFL (afl-fuzz -i in -o out
+ * ./fuzz @@). Built with SKIPLIST_LIBFUZZER there's no main, and libFuzzer
+ * calls LLVMFuzzerTestOneInput ("make fuzz_libfuzzer", which needs clang).
+ *
+ * The random sequences come from FUZZ_SEED in the environment, or 1. Built
+ * with SKIPLIST_TTL ("make fuzz_ttl", which also turns on SKIPLIST_STATS) the
+ * lists run on a clock the sequence moves on, and items are put with expiry
+ * times too.
+ *
+ * On a mismatch the input is written to fuzz-failure before aborting; run
+ * ./fuzz fuzz-failure to replay it. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "skiplist.h"
+#include "skiplist_str.h"
+#include "skiplist_mmap.h"
+
+/* keys come from a small range, so that ops keep running into each other */
+#define KEYS 64
+
+/* each op is 4 bytes: what to do, two keys, and a selector */
+#define OP_BYTES 4
+#define MAX_OPS 4096
+
+#define RUNS 2000
+
+#define K(k) ((void *)(unsigned long)(k))
+#define U(p) ((unsigned long)(p))
+
+static const uint8_t *__input;
+static size_t __input_size;
+static const char *__target;
+static int __step;
+
+#define CHECK(c) do { if (!(c)) __fail(__LINE__, #c); } while (0)
+
+static void __fail(int line, const char *what)
+{
+    FILE *f = fopen("fuzz-failure", "wb");
+
+    if (f)
+    {
+        fwrite(__input, 1, __input_size, f);
+        fclose(f);
+    }
+    fprintf(stderr, "%s: op %d: line %d: %s\n", __target, __step, line, what);
+    abort();
+}
+
+/* The reference: items sorted by key, and equal keys in insertion order */
+
+typedef struct {
+    unsigned long k, v;
+
+    /* 0 if the item never expires */
+    uint64_t expires;
+} item_t;
+
+typedef struct {
+    item_t items[MAX_OPS];
+    int n;
+    int multimap;
+} ref_t;
+
+/**
+ * @return index of the first item with a key not less than k */
+static int __ref_lower(const ref_t *r, unsigned long k)
+{
+    int i = 0;
+    while (i < r->n && r->items[i].k < k)
+        i++;
+    return i;
+}
+
+/**
+ * @return index of the first item with a key greater than k */
+static int __ref_upper(const ref_t *r, unsigned long k)
+{
+    int i = __ref_lower(r, k);
+    while (i < r->n && r->items[i].k == k)
+        i++;
+    return i;
+}
+
+static unsigned long __ref_at(const ref_t *r, int i)
+{
+    return 0 <= i && i < r->n ? r->items[i].v : 0;
+}
+
+static void __ref_delete(ref_t *r, int i, int len)
+{
+    memmove(&r->items[i], &r->items[i + len],
+            (r->n - i - len) * sizeof(item_t));
+    r->n -= len;
+}
+
+/**
+ * Item removal goes by key and value, and upsert sums can give items with
+ * equal keys equal values too; so, like the list, take the first of them.
+ * @return index of the first item with this key and value */
+static int __ref_item(const ref_t *r, unsigned long k, unsigned long v)
+{
+    int i = __ref_lower(r, k);
+    while (r->items[i].v != v)
+        i++;
+    return i;
+}
+
+static unsigned long __ref_put(ref_t *r, unsigned long k, unsigned long v)
+{
+    int i = __ref_lower(r, k);
+
+    if (!r->multimap && i < r->n && r->items[i].k == k)
+    {
+        unsigned long old = r->items[i].v;
+        r->items[i].v = v;
+        r->items[i].expires = 0;
+        return old;
+    }
+    if (r->multimap)
+        i = __ref_upper(r, k);
+    memmove(&r->items[i + 1], &r->items[i], (r->n - i) * sizeof(item_t));
+    r->items[i].k = k;
+    r->items[i].v = v;
+    r->items[i].expires = 0;
+    r->n++;
+    return 0;
+}
+
+static unsigned long __ref_get(const ref_t *r, unsigned long k)
+{
+    int i = __ref_lower(r, k);
+    return i < r->n && r->items[i].k == k ? r->items[i].v : 0;
+}
+
+static unsigned long __ref_remove(ref_t *r, unsigned long k)
+{
+    int i = __ref_lower(r, k);
+    unsigned long v;
+
+    if (r->n <= i || r->items[i].k != k)
+        return 0;
+    v = r->items[i].v;
+    __ref_delete(r, i, 1);
+    return v;
+}
+
+/**
+ * Drop every item that has expired by now
+ * @return number of items dropped */
+static int __ref_expire(ref_t *r, uint64_t now)
+{
+    int i, j;
+
+    for (i = j = 0; i < r->n; i++)
+        if (!r->items[i].expires || now < r->items[i].expires)
+            r->items[j++] = r->items[i];
+    i -= j;
+    r->n = j;
+    return i;
+}
+
+/**
+ * Upsert callback: add udata to the value */
+static void __add(skiplist_entry_t *ety, int found, void *udata)
+{
+    ety->v = K((found ? U(ety->v) : 0) + U(udata));
+}
+
+/* Things under test */
+
+enum {
+    LIST,
+    STR,
+    MMAP,
+};
+
+typedef struct {
+    const char *name;
+
+    int kind;
+
+    /* for LIST */
+    int flags, prefix, hash, pool;
+
+    skiplist_t *list;
+
+    skiplist_finger_t finger;
+
+    /* a version taken by OP_CLONE, and what it should hold */
+    skiplist_t *clone;
+
+    ref_t snapshot;
+
+    skiplist_str_t *str;
+
+    skiplist_mmap_t *mmap;
+
+    char path[64];
+
+    ref_t ref;
+} target_t;
+
+static target_t __targets[] = {
+    { .name = "random", .kind = LIST },
+    { .name = "deterministic", .kind = LIST, .flags = SKIPLIST_DETERMINISTIC },
+    { .name = "prefix+bloom", .kind = LIST, .prefix = 1, .hash = 1 },
+    { .name = "pool", .kind = LIST, .pool = 1 },
+    { .name = "multimap", .kind = LIST, .flags = SKIPLIST_MULTIMAP },
+    { .name = "deterministic multimap", .kind = LIST,
+      .flags = SKIPLIST_MULTIMAP | SKIPLIST_DETERMINISTIC },
+    { .name = "multimap+prefix+bloom", .kind = LIST,
+      .flags = SKIPLIST_MULTIMAP, .prefix = 1, .hash = 1 },
+    { .name = "str", .kind = STR },
+    { .name = "mmap", .kind = MMAP },
+};
+
+#define NTARGETS (sizeof(__targets) / sizeof(__targets[0]))
+
+static skiplist_tpool_t *__tp;
+
+/* what the lists' clock reads; OP_TICK moves it on */
+static uint64_t __now;
+
+static uint64_t __clock(const void *udata)
+{
+    (void)udata;
+    return __now;
+}
+
+static long __ulong_compare(const void *k1, const void *k2, const void *udata)
+{
+    (void)udata;
+    return U(k1) < U(k2) ? -1 : U(k1) > U(k2);
+}
+
+static uint64_t __ulong_prefix(const void *key, const void *udata)
+{
+    (void)udata;
+    /* coarse on purpose, so that ties fall through to the comparator */
+    return U(key) >> 2;
+}
+
+static uint64_t __ulong_hash(const void *key, const void *udata)
+{
+    (void)udata;
+    return U(key) * 0x9E3779B97F4A7C15ULL;
+}
+
+static size_t __strkey(char *buf, unsigned long k)
+{
+    return sprintf(buf, "key/%05lu", k);
+}
+
+static skiplist_t *__new_list(target_t *t)
+{
+    skiplist_opts_t opts = {
+        .flags = t->flags,
+        .prefix = t->prefix ? __ulong_prefix : NULL,
+        .hash = t->hash ? __ulong_hash : NULL,
+        .pool = t->list ? t->list->pool : NULL,
+        .clock = __clock
+    };
+
+    if (t->pool && !opts.pool)
+        opts.pool = skiplist_pool_new(0, -1);
+    return skiplist_new_opts(__ulong_compare, NULL, &opts);
+}
+
+static void __check_list(skiplist_t *l, const ref_t *r)
+{
+    skiplist_iterator_t it;
+    int i;
+
+    CHECK(r->n == skiplist_count(l));
+    CHECK(0 == skiplist_validate(l, NULL));
+
+    skiplist_iterator(l, &it);
+    for (i = 0; i < r->n; i++)
+        CHECK(r->items[i].k == U(skiplist_iterator_next(l, &it)));
+    CHECK(!skiplist_iterator_has_next(l, &it));
+
+    skiplist_iterator_reverse(l, NULL, NULL, &it);
+    for (i = r->n - 1; 0 <= i; i--)
+        CHECK(r->items[i].v == U(skiplist_iterator_prev_value(l, &it)));
+    CHECK(!skiplist_iterator_has_prev(l, &it));
+
+#ifdef SKIPLIST_STATS
+    {
+        skiplist_stats_t stats;
+        unsigned int n = 0;
+
+        CHECK(0 == skiplist_stats(l, &stats));
+        for (i = 0; i < SKIPLIST_MAX_LEVELS; i++)
+            n += stats.heights[i];
+        CHECK((unsigned int)r->n == n);
+        CHECK((unsigned int)r->n == stats.nodes_per_level[0]);
+    }
+#endif
+}
+
+static void __count_run(skiplist_entry_t *ety, void *udata)
+{
+    unsigned long *run = udata;
+    run[0]++;
+    run[1] += U(ety->v);
+}
+
+enum {
+    OP_PUT,
+    OP_GET,
+    OP_REMOVE,
+    OP_POP_MIN,
+    OP_MIN_MAX,
+    OP_NEIGHBOURS,
+    OP_REMOVE_RANGE,
+    OP_FINGER_GET,
+    OP_FINGER_PUT,
+    OP_COUNT_EQUAL,
+    OP_SPLIT_JOIN,
+    OP_CLONE,
+    OP_REBUILD,
+    OP_CHECK,
+    OP_LOAD,
+    OP_SCAN,
+    OP_CHANGE_KEY,
+    OP_REMOVE_ITEM,
+    OP_COMPACT,
+    OP_UPSERT,
+#ifdef SKIPLIST_TTL
+    OP_PUT_EXPIRY,
+    OP_TICK,
+#endif
+    NOPS
+};
+
+static void __list_op(
+    target_t *t,
+    int op,
+    unsigned long k,
+    unsigned long k2,
+    unsigned int sel,
+    unsigned long v)
+{
+    skiplist_t *l = t->list, *other;
+    ref_t *r = &t->ref;
+    unsigned long lo = k < k2 ? k : k2, hi = k < k2 ? k2 : k;
+    skiplist_entry_t *e;
+    unsigned long expected;
+    int i, j;
+
+    switch (op)
+    {
+    case OP_PUT:
+        CHECK(__ref_put(r, k, v) == U(skiplist_put(l, K(k), K(v))));
+        break;
+    case OP_GET:
+        CHECK(__ref_get(r, k) == U(skiplist_get(l, K(k))));
+        break;
+    case OP_REMOVE:
+        CHECK(__ref_remove(r, k) == U(skiplist_remove(l, K(k))));
+        break;
+    case OP_POP_MIN:
+        v = __ref_at(r, 0);
+        if (v)
+            __ref_delete(r, 0, 1);
+        CHECK(v == U(skiplist_pop_min(l)));
+        break;
+    case OP_MIN_MAX:
+        CHECK(__ref_at(r, 0) == U(skiplist_get_min(l)));
+        CHECK(__ref_at(r, r->n - 1) == U(skiplist_get_max(l)));
+        break;
+    case OP_NEIGHBOURS:
+        e = skiplist_floor(l, K(k));
+        CHECK(__ref_at(r, __ref_upper(r, k) - 1) == (e ? U(e->v) : 0));
+        e = skiplist_ceiling(l, K(k));
+        CHECK(__ref_at(r, __ref_lower(r, k)) == (e ? U(e->v) : 0));
+        e = skiplist_lower(l, K(k));
+        CHECK(__ref_at(r, __ref_lower(r, k) - 1) == (e ? U(e->v) : 0));
+        e = skiplist_higher(l, K(k));
+        CHECK(__ref_at(r, __ref_upper(r, k)) == (e ? U(e->v) : 0));
+        break;
+    case OP_REMOVE_RANGE:
+        i = __ref_lower(r, lo);
+        j = __ref_upper(r, hi);
+        __ref_delete(r, i, j - i);
+        CHECK(j - i == skiplist_remove_range(l, K(lo), K(hi), NULL, NULL));
+        break;
+    case OP_FINGER_GET:
+        CHECK(__ref_get(r, k) == U(skiplist_finger_get(l, &t->finger, K(k))));
+        break;
+    case OP_FINGER_PUT:
+        CHECK(__ref_put(r, k, v) ==
+              U(skiplist_finger_put(l, &t->finger, K(k), K(v))));
+        break;
+    case OP_COUNT_EQUAL:
+        i = __ref_upper(r, k) - __ref_lower(r, k);
+        CHECK(i == skiplist_count_equal(l, K(k)));
+        CHECK((0 < i) == skiplist_contains_key(l, K(k)));
+        break;
+    case OP_SPLIT_JOIN:
+        i = __ref_lower(r, k);
+        other = skiplist_split(l, K(k));
+        CHECK(NULL != other);
+        CHECK(i == skiplist_count(l));
+        CHECK(r->n - i == skiplist_count(other));
+        CHECK(0 == skiplist_join(l, other));
+        skiplist_freeall(other);
+        break;
+    case OP_CLONE:
+        if (t->clone)
+        {
+            __check_list(t->clone, &t->snapshot);
+            skiplist_freeall(t->clone);
+        }
+        t->clone = skiplist_clone(l);
+        CHECK(NULL != t->clone);
+        memcpy(&t->snapshot, r, sizeof(ref_t));
+        break;
+    case OP_REBUILD:
+        CHECK(0 <= skiplist_rebuild(l, sel % 2 ? 0 : 1.5));
+        break;
+    case OP_CHECK:
+        __check_list(l, r);
+        break;
+    case OP_LOAD:
+        {
+            skiplist_entry_t items[MAX_OPS];
+
+            for (i = 0; i < r->n; i++)
+            {
+                items[i].k = K(r->items[i].k);
+                items[i].v = K(r->items[i].v);
+            }
+            other = __new_list(t);
+            CHECK(NULL != other);
+            CHECK(0 == skiplist_load(other, items, r->n,
+                                     sel % 2 ? __tp : NULL));
+            __check_list(other, r);
+            /* carry on with the loaded list, whose items don't expire */
+            for (i = 0; i < r->n; i++)
+                r->items[i].expires = 0;
+            skiplist_freeall(l);
+            t->list = other;
+            skiplist_finger_init(&t->finger);
+        }
+        break;
+    case OP_SCAN:
+        {
+            unsigned long runs[4][2] = { { 0 } }, n = 0, sum = 0;
+            void *udata[4] = { runs[0], runs[1], runs[2], runs[3] };
+            int nruns = skiplist_scan(l, K(lo), K(hi), __count_run, udata,
+                                      1 + sel % 4, __tp);
+
+            CHECK(0 <= nruns && nruns <= 1 + (int)(sel % 4));
+            for (i = 0; i < nruns; i++)
+            {
+                n += runs[i][0];
+                sum += runs[i][1];
+            }
+            for (i = __ref_lower(r, lo), j = __ref_upper(r, hi); i < j; i++)
+            {
+                n--;
+                sum -= r->items[i].v;
+            }
+            CHECK(0 == n && 0 == sum);
+        }
+        break;
+    case OP_CHANGE_KEY:
+        if (0 == r->n)
+        {
+            CHECK(-1 == skiplist_change_key(l, K(k), K(v), K(k2)));
+            break;
+        }
+        i = sel % r->n;
+        v = r->items[i].v;
+        CHECK(0 == skiplist_change_key(l, K(r->items[i].k), K(v), K(k2)));
+        /* the moved item is put again, and no longer expires */
+        __ref_delete(r, __ref_item(r, r->items[i].k, v), 1);
+        __ref_put(r, k2, v);
+        break;
+    case OP_REMOVE_ITEM:
+        /* values are step numbers, and upsert sums of them stay below
+         * MAX_OPS * MAX_OPS; so nothing matches ~v */
+        if (0 == r->n || sel % 2)
+        {
+            CHECK(0 == skiplist_remove_item(l, K(k), K(~v)));
+            break;
+        }
+        i = sel % r->n;
+        CHECK(1 == skiplist_remove_item(l, K(r->items[i].k),
+                                        K(r->items[i].v)));
+        __ref_delete(r, __ref_item(r, r->items[i].k, r->items[i].v), 1);
+        break;
+    case OP_COMPACT:
+        /* small steps, so that passes get interrupted by other ops */
+        i = skiplist_compact(l, sel % 8 + 1);
+        CHECK(l->pool ? 0 <= i : -1 == i);
+        break;
+    case OP_UPSERT:
+        i = __ref_lower(r, k);
+        j = i < r->n && r->items[i].k == k;
+        switch (sel % 3)
+        {
+        case 0:
+            CHECK((j ? 0 : 1) == skiplist_upsert(l, K(k), __add, K(v)));
+            if (j)
+                r->items[i].v += v;
+            else
+                __ref_put(r, k, v);
+            break;
+        case 1:
+            CHECK((j ? r->items[i].v : 0) ==
+                  U(skiplist_put_if_absent(l, K(k), K(v))));
+            if (!j)
+                __ref_put(r, k, v);
+            break;
+        case 2:
+            /* half the time, expect what's really there */
+            expected = j && sel / 3 % 2 ? r->items[i].v : k2;
+            j = j && expected == r->items[i].v;
+            CHECK((j ? 0 : -1) ==
+                  skiplist_compare_and_replace(l, K(k), K(expected), K(v)));
+            if (j)
+                r->items[i].v = v;
+            break;
+        }
+        break;
+#ifdef SKIPLIST_TTL
+    case OP_PUT_EXPIRY:
+        expected = __now + 1 + sel % 4;
+        CHECK(__ref_put(r, k, v) ==
+              U(skiplist_put_expiry(l, K(k), K(v), expected)));
+        r->items[r->multimap ? __ref_upper(r, k) - 1 : __ref_lower(r, k)]
+            .expires = expected;
+        break;
+    case OP_TICK:
+        /* the clock has already moved on; expire a few at a time */
+        i = __ref_expire(r, __now);
+        while (0 < (j = skiplist_expire(l, 1 + sel % 8)))
+        {
+            CHECK(j <= 1 + (int)(sel % 8));
+            i -= j;
+        }
+        CHECK(0 == i);
+        if (t->clone)
+        {
+            CHECK(__ref_expire(&t->snapshot, __now) ==
+                  skiplist_expire(t->clone, UINT_MAX));
+        }
+        break;
+#endif
+    }
+}
+
+static void __str_op(
+    target_t *t,
+    int op,
+    unsigned long k,
+    unsigned long v)
+{
+    skiplist_str_t *s = t->str;
+    skiplist_str_iterator_t it;
+    ref_t *r = &t->ref;
+    char buf[32], want[32];
+    const char *key;
+    size_t len, klen;
+    void *val;
+    int i;
+
+    len = __strkey(buf, k);
+    switch (op)
+    {
+    case OP_PUT:
+    case OP_FINGER_PUT:
+        CHECK(__ref_put(r, k, v) == U(skiplist_str_put(s, buf, len, K(v))));
+        break;
+    case OP_GET:
+    case OP_FINGER_GET:
+        CHECK(__ref_get(r, k) == U(skiplist_str_get(s, buf, len)));
+        break;
+    case OP_REMOVE:
+        CHECK(__ref_remove(r, k) == U(skiplist_str_remove(s, buf, len)));
+        break;
+    case OP_NEIGHBOURS:
+        CHECK(0 == skiplist_str_iterator(s, buf, len, &it));
+        i = __ref_lower(r, k);
+        CHECK((i < r->n) == skiplist_str_iterator_next(&it, &key, &klen, &val));
+        CHECK(__ref_at(r, i) == U(i < r->n ? val : NULL));
+        skiplist_str_iterator_done(&it);
+        break;
+    case OP_CHECK:
+        CHECK(r->n == skiplist_str_count(s));
+        CHECK(0 == skiplist_str_iterator(s, NULL, 0, &it));
+        for (i = 0; i < r->n; i++)
+        {
+            CHECK(skiplist_str_iterator_next(&it, &key, &klen, &val));
+            len = __strkey(want, r->items[i].k);
+            CHECK(klen == len && 0 == memcmp(key, want, len));
+            CHECK(r->items[i].v == U(val));
+        }
+        CHECK(!skiplist_str_iterator_next(&it, &key, &klen, &val));
+        skiplist_str_iterator_done(&it);
+        break;
+    }
+}
+
+static void __mmap_op(
+    target_t *t,
+    int op,
+    unsigned long k,
+    unsigned long v)
+{
+    skiplist_mmap_t *m = t->mmap;
+    ref_t *r = &t->ref;
+    const void *got;
+    unsigned long w;
+    char buf[32];
+    size_t len, vlen;
+
+    len = __strkey(buf, k);
+    switch (op)
+    {
+    case OP_PUT:
+    case OP_FINGER_PUT:
+        __ref_put(r, k, v);
+        CHECK(0 == skiplist_mmap_put(m, buf, len, &v, sizeof(v)));
+        break;
+    case OP_GET:
+    case OP_FINGER_GET:
+        got = skiplist_mmap_get(m, buf, len, &vlen);
+        w = 0;
+        if (got)
+        {
+            CHECK(sizeof(w) == vlen);
+            memcpy(&w, got, sizeof(w));
+        }
+        CHECK(__ref_get(r, k) == w);
+        break;
+    case OP_REMOVE:
+        CHECK((0 != __ref_remove(r, k)) == skiplist_mmap_remove(m, buf, len));
+        break;
+    case OP_CHECK:
+        CHECK((uint64_t)r->n == skiplist_mmap_count(m));
+        CHECK(0 == skiplist_mmap_validate(m));
+        for (k = 1; k <= KEYS; k++)
+            __mmap_op(t, OP_GET, k, 0);
+        break;
+    }
+}
+
+static void __setup(target_t *t)
+{
+    memset(&t->ref, 0, sizeof(ref_t));
+    t->ref.multimap = t->kind == LIST && (t->flags & SKIPLIST_MULTIMAP);
+    t->clone = NULL;
+    switch (t->kind)
+    {
+    case LIST:
+        t->list = NULL;
+        t->list = __new_list(t);
+        skiplist_finger_init(&t->finger);
+        break;
+    case STR:
+        t->str = skiplist_str_new();
+        break;
+    case MMAP:
+        {
+            int fd;
+
+            strcpy(t->path, "/tmp/skiplist_fuzz_XXXXXX");
+            fd = mkstemp(t->path);
+            close(fd);
+            /* an empty file is initialised on open */
+            t->mmap = skiplist_mmap_open(t->path, SKIPLIST_MMAP_CREATE);
+        }
+        break;
+    }
+}
+
+static void __teardown(target_t *t)
+{
+    skiplist_pool_t *pool;
+
+    switch (t->kind)
+    {
+    case LIST:
+        pool = t->list->pool;
+        if (t->clone)
+            skiplist_freeall(t->clone);
+        skiplist_freeall(t->list);
+        if (pool)
+            skiplist_pool_free(pool);
+        break;
+    case STR:
+        skiplist_str_free(t->str);
+        break;
+    case MMAP:
+        skiplist_mmap_close(t->mmap);
+        unlink(t->path);
+        break;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    unsigned int i;
+    size_t n = size / OP_BYTES;
+
+    if (!__tp)
+        __tp = skiplist_tpool_new(2);
+    if (MAX_OPS < n)
+        n = MAX_OPS;
+    __input = data;
+    __input_size = size;
+    __now = 0;
+
+    for (i = 0; i < NTARGETS; i++)
+        __setup(&__targets[i]);
+
+    for (__step = 0; __step < (int)n; __step++)
+    {
+        const uint8_t *d = data + __step * OP_BYTES;
+        int op = d[0] % NOPS;
+        unsigned long k = d[1] % KEYS + 1, k2 = d[2] % KEYS + 1;
+
+#ifdef SKIPLIST_TTL
+        /* one clock for every target */
+        if (OP_TICK == op)
+            __now += 1 + d[3] % 4;
+#endif
+
+        for (i = 0; i < NTARGETS; i++)
+        {
+            target_t *t = &__targets[i];
+
+            __target = t->name;
+            /* values are step numbers, which tell items with equal keys
+             * apart; except where upsert sums make them equal */
+            if (LIST == t->kind)
+                __list_op(t, op, k, k2, d[3], __step + 1);
+            else if (STR == t->kind)
+                __str_op(t, op, k, __step + 1);
+            else
+                __mmap_op(t, op, k, __step + 1);
+        }
+    }
+
+    for (i = 0; i < NTARGETS; i++)
+    {
+        target_t *t = &__targets[i];
+
+        __target = t->name;
+        if (LIST == t->kind)
+        {
+            __list_op(t, OP_CHECK, 1, 1, 0, 0);
+            if (t->clone)
+                __check_list(t->clone, &t->snapshot);
+        }
+        else if (STR == t->kind)
+            __str_op(t, OP_CHECK, 1, 0);
+        else
+            __mmap_op(t, OP_CHECK, 1, 0);
+        __teardown(t);
+    }
+    return 0;
+}
+
+#ifndef SKIPLIST_LIBFUZZER
+static int __replay(const char *path)
+{
+    static uint8_t data[MAX_OPS * OP_BYTES];
+    FILE *f = fopen(path, "rb");
+    size_t size;
+
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+    size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(data, size);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t data[MAX_OPS * OP_BYTES];
+    const char *env = getenv("FUZZ_SEED");
+    unsigned int seed = env ? strtoul(env, NULL, 0) : 1;
+    int i;
+    size_t j, size;
+
+    if (1 < argc)
+    {
+        for (i = 1; i < argc; i++)
+            if (__replay(argv[i]))
+                return 1;
+        return 0;
+    }
+
+    srand(seed);
+    for (i = 0; i < RUNS; i++)
+    {
+        /* mostly short sequences, and now and then a long one */
+        size = OP_BYTES * (1 + rand() % (i % 10 ? 256 : MAX_OPS));
+        for (j = 0; j < size; j++)
+            data[j] = rand();
+        /* weight towards puts, so that lists get some size */
+        for (j = 0; j < size; j += OP_BYTES)
+            if (rand() % 3 == 0)
+                data[j] = OP_PUT;
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("%d sequences from seed %u, no differences\n", RUNS, seed);
+    skiplist_tpool_free(__tp);
+    return 0;
+}
+#endif
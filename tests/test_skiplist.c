@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include "CuTest.h"
 
 #include "skiplist.h"
@@ -19,6 +20,17 @@ static long __ulong_compare(
     return i1 - i2;
 }
 
+/* counts its calls in udata, so tests can count comparisons whether or not
+ * SKIPLIST_STATS is on */
+static long __counting_compare(
+    const void *e1,
+    const void *e2,
+    const void* udata)
+{
+    (*(unsigned long *) udata)++;
+    return __ulong_compare(e1, e2, NULL);
+}
+
 void TestSkiplist_new(CuTest * tc)
 {
     skiplist_t *d;
@@ -146,23 +158,6 @@ void Testskiplist_RemoveHandlesCollision(
     skiplist_freeall(d);
 }
 
-#if 0
-void T_estskiplist_PutEntry(
-    CuTest * tc
-)
-{
-    skiplist_t *d;
-    skiplist_entry_t entry;
-
-    d = skiplist_new(__ulong_compare, NULL);
-    entry.k = (void *) 50;
-    entry.v = (void *) 92;
-    skiplist_put_entry(d, &entry);
-    CuAssertTrue(tc, 1 == skiplist_count(d));
-    skiplist_freeall(d);
-}
-#endif
-
 void Testskiplist_Get(
     CuTest * tc
 )
@@ -312,13 +307,166 @@ void Testskiplist_ClearHandlesCollision(
     skiplist_freeall(d);
 }
 
+void Testskiplist_ClearAndFreeReleaseEveryNode(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    size_t empty;
+    unsigned long i;
+
+    /* the pool counts what's in use whether or not SKIPLIST_STATS is on */
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    empty = skiplist_pool_bytes(p) - skiplist_pool_slack(p);
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    skiplist_clear(d);
+
+    /* only nil is left */
+    CuAssertTrue(tc, empty == skiplist_pool_bytes(p) - skiplist_pool_slack(p));
+
+    skiplist_put(d, (void *) 1, (void *) 1);
+    CuAssertTrue(tc, (void *) 1 == skiplist_get(d, (void *) 1));
+    skiplist_free(d);
+    CuAssertTrue(tc, skiplist_pool_bytes(p) == skiplist_pool_slack(p));
+    free(d);
+    skiplist_pool_free(p);
+}
+
+static void __free_value(
+    skiplist_entry_t *ety,
+    void *udata
+)
+{
+    (*(int *)udata)++;
+    free(ety->v);
+}
+
+void Testskiplist_ClearCbGetsEveryItem(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    unsigned long i;
+    int freed = 0;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, malloc(8));
+    skiplist_clear_cb(d, __free_value, &freed);
+    CuAssertTrue(tc, 100 == freed);
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_FreeLeavesSharedNodesToOtherVersions(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *c, *e;
+    unsigned long i;
+    int freed = 0;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    c = skiplist_clone(d);
+    e = skiplist_clone(d);
+    skiplist_freeall(d);
+    CuAssertTrue(tc, 0 == skiplist_validate(c, NULL));
+    CuAssertTrue(tc, (void *) 50 == skiplist_get(c, (void *) 50));
+
+    /* items c still has are none of e's business */
+    skiplist_clear_cb(e, __free_value, &freed);
+    CuAssertTrue(tc, 0 == freed);
+    CuAssertTrue(tc, 100 == skiplist_count(c));
+    skiplist_freeall(e);
+    skiplist_freeall(c);
+}
+
+void Testskiplist_LevelsAreBoundedByMaxLevels(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .max_levels = 3 };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    CuAssertTrue(tc, 1000 == skiplist_count(d));
+    CuAssertTrue(tc, d->levels <= 3);
+    CuAssertTrue(tc, (void *) 777 == skiplist_get(d, (void *) 777));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_MaxLevelsDerivedFromCapacity(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .capacity = 1024 };
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    CuAssertTrue(tc, 11 == d->max_levels);
+    skiplist_freeall(d);
+
+    d = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, SKIPLIST_MAX_LEVELS == d->max_levels);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_LevelsAreBoundedByLogOfCount(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 8; i++)
+    {
+        skiplist_put(d, (void *) i, (void *) i);
+        /* log2(8) + 1 */
+        CuAssertTrue(tc, d->levels <= 4);
+    }
+    skiplist_freeall(d);
+}
+
+void Testskiplist_PutGetRemoveMany(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 0; i < 1000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 1000 + 1), (void *) (i + 1));
+    CuAssertTrue(tc, 1000 == skiplist_count(d));
+    for (i = 0; i < 1000; i++)
+        CuAssertTrue(tc, (void *) (i + 1) ==
+                     skiplist_get(d, (void *) ((i * 7919) % 1000 + 1)));
+    for (i = 1; i <= 1000; i += 2)
+        CuAssertTrue(tc, NULL != skiplist_remove(d, (void *) i));
+    CuAssertTrue(tc, 500 == skiplist_count(d));
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, (i % 2 == 0) == skiplist_contains_key(d, (void *) i));
+    skiplist_freeall(d);
+}
+
 #if 0
 // TODO special case for removing highest value
 
 #endif
 
-#if 0
-void T_estskiplist_DoesNotHaveNextForEmptyIterator(
+void Testskiplist_DoesNotHaveNextForEmptyIterator(
     CuTest * tc
 )
 {
@@ -331,7 +479,7 @@ void T_estskiplist_DoesNotHaveNextForEmptyIterator(
     skiplist_freeall(d);
 }
 
-void T_estskiplist_RemoveItemDoesNotHaveNextForEmptyIterator(
+void Testskiplist_RemoveItemDoesNotHaveNextForEmptyIterator(
     CuTest * tc
 )
 {
@@ -346,7 +494,7 @@ void T_estskiplist_RemoveItemDoesNotHaveNextForEmptyIterator(
     skiplist_freeall(d);
 }
 
-void T_estskiplist_Iterate(
+void Testskiplist_Iterate(
     CuTest * tc
 )
 {
@@ -386,9 +534,10 @@ void T_estskiplist_Iterate(
     /*  check if the skiplist is empty */
     CuAssertTrue(tc, 0 == skiplist_count(d2));
     skiplist_freeall(d);
+    skiplist_freeall(d2);
 }
 
-void T_estskiplist_IterateHandlesCollisions(
+void Testskiplist_IterateHandlesCollisions(
     CuTest * tc
 )
 {
@@ -398,8 +547,8 @@ void T_estskiplist_IterateHandlesCollisions(
 
     void *key;
 
-    d = skiplist_new(__uint_hash, __ulong_compare, 4);
-    d2 = skiplist_new(__uint_hash, __ulong_compare, 4);
+    d = skiplist_new(__ulong_compare, NULL);
+    d2 = skiplist_new(__ulong_compare, NULL);
 
     skiplist_put(d, (void *) 1, (void *) 92);
     skiplist_put(d, (void *) 5, (void *) 91);
@@ -420,9 +569,10 @@ void T_estskiplist_IterateHandlesCollisions(
     /*  check if the skiplist is empty */
     CuAssertTrue(tc, 0 == skiplist_count(d2));
     skiplist_freeall(d);
+    skiplist_freeall(d2);
 }
 
-void T_estskiplist_IterateAndRemoveDoesntBreakIteration(
+void Testskiplist_IterateAndRemoveDoesntBreakIteration(
     CuTest * tc
 )
 {
@@ -471,4 +621,1739 @@ void T_estskiplist_IterateAndRemoveDoesntBreakIteration(
     skiplist_freeall(d2);
 }
 
+void Testskiplist_IterateInKeyOrder(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_iterator_t iter;
+    unsigned long key, prev = 0;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(d, (void *) 5, (void *) 91);
+    skiplist_put(d, (void *) 1, (void *) 92);
+    skiplist_put(d, (void *) 9, (void *) 90);
+
+    skiplist_iterator(d, &iter);
+    while ((key = (unsigned long) skiplist_iterator_next(d, &iter)))
+    {
+        CuAssertTrue(tc, prev < key);
+        prev = key;
+    }
+    CuAssertTrue(tc, 9 == prev);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_MultimapKeepsDuplicates(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    CuAssertTrue(tc, NULL == skiplist_put(d, (void *) 50, (void *) 92));
+    CuAssertTrue(tc, NULL == skiplist_put(d, (void *) 50, (void *) 23));
+    CuAssertTrue(tc, 2 == skiplist_count(d));
+    CuAssertTrue(tc, 2 == skiplist_count_equal(d, (void *) 50));
+    CuAssertTrue(tc, 0 == skiplist_count_equal(d, (void *) 51));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_MultimapGetReturnsFirstPut(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    /* enough duplicates that some end up on express lines */
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) (i % 3 + 1), (void *) i);
+    CuAssertTrue(tc, (void *) 3 == skiplist_get(d, (void *) 1));
+    CuAssertTrue(tc, (void *) 1 == skiplist_get(d, (void *) 2));
+    CuAssertTrue(tc, (void *) 2 == skiplist_get(d, (void *) 3));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_MultimapIterateEqualInInsertionOrder(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    skiplist_iterator_t iter;
+    unsigned long i, val;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) (i % 4 + 1), (void *) i);
+
+    i = 2;
+    skiplist_iterator_equal(d, (void *) 3, &iter);
+    while ((val = (unsigned long) skiplist_iterator_next_value(d, &iter)))
+    {
+        CuAssertTrue(tc, val == i);
+        i += 4;
+    }
+    CuAssertTrue(tc, 102 == i);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_MultimapRemoveTakesFirstPut(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_put(d, (void *) 1, (void *) 10);
+    skiplist_put(d, (void *) 2, (void *) 20);
+    skiplist_put(d, (void *) 2, (void *) 21);
+    skiplist_put(d, (void *) 3, (void *) 30);
+
+    CuAssertTrue(tc, (void *) 20 == skiplist_remove(d, (void *) 2));
+    CuAssertTrue(tc, (void *) 21 == skiplist_get(d, (void *) 2));
+    CuAssertTrue(tc, 3 == skiplist_count(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_MultimapRemoveAll(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) (i % 4 + 1), (void *) i);
+
+    CuAssertTrue(tc, 25 == skiplist_remove_all(d, (void *) 2));
+    CuAssertTrue(tc, 75 == skiplist_count(d));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 2));
+    CuAssertTrue(tc, 25 == skiplist_count_equal(d, (void *) 3));
+    CuAssertTrue(tc, 0 == skiplist_remove_all(d, (void *) 2));
+    skiplist_freeall(d);
+}
+
+static int __is_ordered(skiplist_t *d)
+{
+    skiplist_iterator_t iter;
+    unsigned long key, prev = 0;
+    int n = 0;
+
+    skiplist_iterator(d, &iter);
+    while ((key = (unsigned long) skiplist_iterator_next(d, &iter)))
+    {
+        if (key < prev)
+            return 0;
+        prev = key;
+        n++;
+    }
+    return n == skiplist_count(d);
+}
+
+void Testskiplist_Split(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *upper;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    upper = skiplist_split(d, (void *) 31);
+    CuAssertTrue(tc, 30 == skiplist_count(d));
+    CuAssertTrue(tc, 70 == skiplist_count(upper));
+    CuAssertTrue(tc, __is_ordered(d));
+    CuAssertTrue(tc, __is_ordered(upper));
+    CuAssertTrue(tc, (void *) 30 == skiplist_get(d, (void *) 30));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 31));
+    CuAssertTrue(tc, (void *) 31 == skiplist_get(upper, (void *) 31));
+    CuAssertTrue(tc, NULL == skiplist_get(upper, (void *) 30));
+
+    /* both halves are still fully usable */
+    skiplist_put(d, (void *) 200, (void *) 200);
+    CuAssertTrue(tc, (void *) 200 == skiplist_get(d, (void *) 200));
+    CuAssertTrue(tc, (void *) 100 == skiplist_remove(upper, (void *) 100));
+    skiplist_freeall(d);
+    skiplist_freeall(upper);
+}
+
+void Testskiplist_SplitAtEnds(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *upper;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 10; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    upper = skiplist_split(d, (void *) 11);
+    CuAssertTrue(tc, 10 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_count(upper));
+    skiplist_freeall(upper);
+
+    upper = skiplist_split(d, (void *) 1);
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    CuAssertTrue(tc, 10 == skiplist_count(upper));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 5));
+    skiplist_freeall(d);
+    skiplist_freeall(upper);
+}
+
+void Testskiplist_Join(
+    CuTest * tc
+)
+{
+    skiplist_t *a, *b;
+    unsigned long i;
+
+    a = skiplist_new(__ulong_compare, NULL);
+    b = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 50; i++)
+        skiplist_put(a, (void *) i, (void *) i);
+    for (i = 51; i <= 200; i++)
+        skiplist_put(b, (void *) i, (void *) i);
+
+    CuAssertTrue(tc, 0 == skiplist_join(a, b));
+    CuAssertTrue(tc, 200 == skiplist_count(a));
+    CuAssertTrue(tc, 0 == skiplist_count(b));
+    CuAssertTrue(tc, __is_ordered(a));
+    for (i = 1; i <= 200; i++)
+        CuAssertTrue(tc, (void *) i == skiplist_get(a, (void *) i));
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+}
+
+void Testskiplist_JoinRefusesOverlap(
+    CuTest * tc
+)
+{
+    skiplist_t *a, *b;
+
+    a = skiplist_new(__ulong_compare, NULL);
+    b = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(a, (void *) 1, (void *) 1);
+    skiplist_put(a, (void *) 5, (void *) 5);
+    skiplist_put(b, (void *) 3, (void *) 3);
+
+    CuAssertTrue(tc, -1 == skiplist_join(a, b));
+    CuAssertTrue(tc, 2 == skiplist_count(a));
+    CuAssertTrue(tc, 1 == skiplist_count(b));
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+}
+
+void Testskiplist_MergeInterleaved(
+    CuTest * tc
+)
+{
+    skiplist_t *a, *b;
+    unsigned long i;
+
+    a = skiplist_new(__ulong_compare, NULL);
+    b = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 200; i++)
+        skiplist_put(i % 2 ? a : b, (void *) i, (void *) i);
+    /* overlap */
+    skiplist_put(b, (void *) 7, (void *) 700);
+
+    CuAssertTrue(tc, 0 == skiplist_merge(a, b));
+    CuAssertTrue(tc, 200 == skiplist_count(a));
+    CuAssertTrue(tc, 0 == skiplist_count(b));
+    CuAssertTrue(tc, __is_ordered(a));
+    CuAssertTrue(tc, (void *) 700 == skiplist_get(a, (void *) 7));
+    for (i = 8; i <= 200; i++)
+        CuAssertTrue(tc, (void *) i == skiplist_get(a, (void *) i));
+
+    /* still fully usable */
+    for (i = 1; i <= 200; i++)
+        CuAssertTrue(tc, NULL != skiplist_remove(a, (void *) i));
+    CuAssertTrue(tc, 0 == skiplist_count(a));
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+}
+
+void Testskiplist_MultimapMergeKeepsBoth(
+    CuTest * tc
+)
+{
+    skiplist_t *a, *b;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+
+    a = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    b = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_put(a, (void *) 1, (void *) 10);
+    skiplist_put(a, (void *) 3, (void *) 30);
+    skiplist_put(b, (void *) 1, (void *) 11);
+    skiplist_put(b, (void *) 2, (void *) 20);
+
+    skiplist_merge(a, b);
+    CuAssertTrue(tc, 4 == skiplist_count(a));
+    CuAssertTrue(tc, 2 == skiplist_count_equal(a, (void *) 1));
+    CuAssertTrue(tc, (void *) 10 == skiplist_get(a, (void *) 1));
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+}
+
+static void __sum_values(skiplist_entry_t *ety, void *udata)
+{
+    *(unsigned long *) udata += (unsigned long) ety->v;
+}
+
+void Testskiplist_RemoveRange(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    unsigned long i, sum = 0;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    CuAssertTrue(tc, 11 == skiplist_remove_range(d, (void *) 20, (void *) 30,
+                                                 __sum_values, &sum));
+    CuAssertTrue(tc, 275 == sum);
+    CuAssertTrue(tc, 89 == skiplist_count(d));
+    CuAssertTrue(tc, __is_ordered(d));
+    for (i = 1; i <= 100; i++)
+        CuAssertTrue(tc, (i < 20 || 30 < i) == skiplist_contains_key(d, (void *) i));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_RemoveRangeWithNoItemsInside(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(d, (void *) 10, (void *) 10);
+    skiplist_put(d, (void *) 20, (void *) 20);
+
+    CuAssertTrue(tc, 0 == skiplist_remove_range(d, (void *) 11, (void *) 19,
+                                                NULL, NULL));
+    CuAssertTrue(tc, 0 == skiplist_remove_range(d, (void *) 30, (void *) 20,
+                                                NULL, NULL));
+    CuAssertTrue(tc, 2 == skiplist_count(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_RemoveRangeEverything(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    CuAssertTrue(tc, 100 == skiplist_remove_range(d, (void *) 1, (void *) 100,
+                                                  NULL, NULL));
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    CuAssertTrue(tc, 1 == d->levels);
+    skiplist_put(d, (void *) 5, (void *) 5);
+    CuAssertTrue(tc, (void *) 5 == skiplist_get(d, (void *) 5));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_StatsCountHotPath(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_stats_t stats;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    skiplist_remove(d, (void *) 50);
+    skiplist_get(d, (void *) 70);
+
+#ifdef SKIPLIST_STATS
+    CuAssertTrue(tc, 0 == skiplist_stats(d, &stats));
+    CuAssertTrue(tc, 102 == stats.ops);
+    CuAssertTrue(tc, 0 < stats.cmps);
+    CuAssertTrue(tc, 0 < stats.visits);
+    /* nil too */
+    CuAssertTrue(tc, 101 == stats.allocs);
+    CuAssertTrue(tc, 1 == stats.frees);
+
+    skiplist_stats_reset(d);
+    skiplist_stats(d, &stats);
+    CuAssertTrue(tc, 0 == stats.ops);
+    CuAssertTrue(tc, 0 == stats.cmps);
+#else
+    /* only the histograms are worked out */
+    CuAssertTrue(tc, -1 == skiplist_stats(d, &stats));
+    CuAssertTrue(tc, 99 == stats.nodes_per_level[0]);
 #endif
+    skiplist_freeall(d);
+}
+
+static void *__getter(void *d)
+{
+    unsigned long i;
+
+    for (i = 1; i <= 10000; i++)
+        skiplist_get(d, (void *) (i % 100 + 1));
+    return NULL;
+}
+
+void Testskiplist_StatsCountConcurrentGets(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_stats_t stats;
+    pthread_t threads[4];
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    skiplist_stats_reset(d);
+    for (i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, __getter, d);
+    for (i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+
+    /* no counts are lost to the other threads */
+    if (0 == skiplist_stats(d, &stats))
+        CuAssertTrue(tc, 4 * 10000 == stats.ops);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_StatsHistograms(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_stats_t stats;
+    unsigned long i;
+    unsigned int lvl, sum = 0;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    skiplist_stats(d, &stats);
+    CuAssertTrue(tc, 100 == stats.nodes_per_level[0]);
+    for (lvl = 0; lvl < SKIPLIST_MAX_LEVELS; lvl++)
+    {
+        sum += stats.heights[lvl];
+        if (lvl < d->levels)
+            CuAssertTrue(tc, 0 < stats.nodes_per_level[lvl]);
+        else
+            CuAssertTrue(tc, 0 == stats.nodes_per_level[lvl]);
+    }
+    CuAssertTrue(tc, 100 == sum);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_ValidateIntactList(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_health_t health;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, &health));
+    CuAssertTrue(tc, 0 == health.search_cost);
+
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 1000 + 1), (void *) i);
+    for (i = 1; i <= 1000; i += 3)
+        skiplist_remove(d, (void *) i);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, &health));
+    CuAssertTrue(tc, 0 < health.search_cost);
+    CuAssertTrue(tc, 0 < health.expected_cost);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_ValidateCatchesDisorder(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    void *k;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(d, (void *) 1, (void *) 1);
+    skiplist_put(d, (void *) 2, (void *) 2);
+    skiplist_put(d, (void *) 3, (void *) 3);
+
+    k = d->nil->next[0]->ety.k;
+    d->nil->next[0]->ety.k = d->nil->next[0]->next[0]->ety.k;
+    d->nil->next[0]->next[0]->ety.k = k;
+    CuAssertTrue(tc, -1 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_ValidateCatchesBadCount(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(d, (void *) 1, (void *) 1);
+    d->count = 2;
+    CuAssertTrue(tc, -1 == skiplist_validate(d, NULL));
+    d->count = 1;
+    skiplist_freeall(d);
+}
+
+void Testskiplist_RebuildIsBalanced(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_health_t health;
+    skiplist_stats_t stats;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 1024; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    CuAssertTrue(tc, 1 == skiplist_rebuild(d, 0));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, &health));
+    CuAssertTrue(tc, health.search_cost <= health.expected_cost);
+    CuAssertTrue(tc, 11 == d->levels);
+
+    skiplist_stats(d, &stats);
+    CuAssertTrue(tc, 512 == stats.nodes_per_level[1]);
+    CuAssertTrue(tc, 1 == stats.nodes_per_level[10]);
+
+    for (i = 1; i <= 1024; i++)
+        CuAssertTrue(tc, (void *) i == skiplist_get(d, (void *) i));
+
+    /* balanced lists don't need rebuilding */
+    CuAssertTrue(tc, 0 == skiplist_rebuild(d, 1.0));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_DeterministicKeepsGapsBounded(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_DETERMINISTIC };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    /* ascending keys are the worst case for a lot of balancing schemes */
+    for (i = 1; i <= 1000; i++)
+    {
+        skiplist_put(d, (void *) i, (void *) i);
+        CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    }
+    CuAssertTrue(tc, d->levels <= 11);
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, (void *) i == skiplist_get(d, (void *) i));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_DeterministicRemove(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_DETERMINISTIC };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 1000 + 1), (void *) i);
+
+    for (i = 1; i <= 1000; i++)
+    {
+        unsigned long k = (i * 389) % 1000 + 1;
+        CuAssertTrue(tc, NULL != skiplist_remove(d, (void *) k));
+        CuAssertTrue(tc, NULL == skiplist_get(d, (void *) k));
+        CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    }
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    CuAssertTrue(tc, 1 == d->levels);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_DeterministicRemoveKeepsValues(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_DETERMINISTIC };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 200; i++)
+        skiplist_put(d, (void *) i, (void *) (i + 1000));
+
+    /* removing tall nodes moves items between nodes */
+    for (i = 2; i <= 200; i += 2)
+        CuAssertTrue(tc, (void *) (i + 1000) == skiplist_remove(d, (void *) i));
+    for (i = 1; i <= 200; i += 2)
+        CuAssertTrue(tc, (void *) (i + 1000) == skiplist_get(d, (void *) i));
+    CuAssertTrue(tc, __is_ordered(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_DeterministicBulkOpsStayBalanced(
+    CuTest * tc
+)
+{
+    skiplist_t *a, *b, *upper;
+    skiplist_opts_t opts = { .flags = SKIPLIST_DETERMINISTIC };
+    unsigned long i;
+
+    a = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    b = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 300; i++)
+        skiplist_put(i % 3 ? a : b, (void *) i, (void *) i);
+
+    skiplist_merge(a, b);
+    CuAssertTrue(tc, 0 == skiplist_validate(a, NULL));
+    CuAssertTrue(tc, 300 == skiplist_count(a));
+
+    CuAssertTrue(tc, 51 == skiplist_remove_range(a, (void *) 100, (void *) 150,
+                                                 NULL, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(a, NULL));
+
+    upper = skiplist_split(a, (void *) 200);
+    CuAssertTrue(tc, 0 == skiplist_validate(a, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(upper, NULL));
+    CuAssertTrue(tc, 0 == skiplist_join(a, upper));
+    CuAssertTrue(tc, 0 == skiplist_validate(a, NULL));
+    CuAssertTrue(tc, 249 == skiplist_count(a));
+
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+    skiplist_freeall(upper);
+}
+
+void Testskiplist_DeterministicWorstCaseComparisons(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_DETERMINISTIC };
+    unsigned long i, cmps = 0, worst = 0;
+
+    d = skiplist_new_opts(__counting_compare, &cmps, &opts);
+    for (i = 1; i <= 4096; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    for (i = 1; i <= 4096; i++)
+    {
+        cmps = 0;
+        skiplist_get(d, (void *) i);
+        if (worst < cmps)
+            worst = cmps;
+    }
+    /* at most 4 comparisons on each line */
+    CuAssertTrue(tc, worst <= 4 * d->levels);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_GetMinAndMax(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, NULL == skiplist_get_min(d));
+    CuAssertTrue(tc, NULL == skiplist_get_max(d));
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) ((i * 37) % 100 + 1), (void *) i);
+    CuAssertTrue(tc, skiplist_get(d, (void *) 1) == skiplist_get_min(d));
+    CuAssertTrue(tc, skiplist_get(d, (void *) 100) == skiplist_get_max(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_PopMinPopsInPriorityOrder(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 200; i++)
+        skiplist_put(d, (void *) (i % 10 + 1), (void *) i);
+
+    /* equal priorities come out in insertion order */
+    for (i = 1; i <= 200; i++)
+    {
+        unsigned long v = (unsigned long)skiplist_pop_min(d);
+        unsigned long prio = (i - 1) / 20 + 1;
+        CuAssertTrue(tc, prio == v % 10 + 1);
+        CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    }
+    CuAssertTrue(tc, NULL == skiplist_pop_min(d));
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_RemoveItemKeepsOrderOfEqualKeys(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    skiplist_iterator_t iter;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_put(d, (void *) 5, (void *) 1);
+    skiplist_put(d, (void *) 5, (void *) 2);
+    skiplist_put(d, (void *) 5, (void *) 3);
+    skiplist_put(d, (void *) 5, (void *) 4);
+
+    CuAssertTrue(tc, 0 == skiplist_remove_item(d, (void *) 5, (void *) 9));
+    CuAssertTrue(tc, 1 == skiplist_remove_item(d, (void *) 5, (void *) 3));
+    CuAssertTrue(tc, 3 == skiplist_count(d));
+
+    skiplist_iterator_equal(d, (void *) 5, &iter);
+    CuAssertTrue(tc, (void *) 1 == skiplist_iterator_next_value(d, &iter));
+    CuAssertTrue(tc, (void *) 2 == skiplist_iterator_next_value(d, &iter));
+    CuAssertTrue(tc, (void *) 4 == skiplist_iterator_next_value(d, &iter));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_ChangeKeyIsDecreaseKey(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 50; i++)
+        skiplist_put(d, (void *) (i + 10), (void *) i);
+
+    CuAssertTrue(tc, -1 == skiplist_change_key(d, (void *) 40, (void *) 1,
+                                               (void *) 1));
+    CuAssertTrue(tc, 0 == skiplist_change_key(d, (void *) 40, (void *) 30,
+                                              (void *) 1));
+    CuAssertTrue(tc, 50 == skiplist_count(d));
+    CuAssertTrue(tc, (void *) 30 == skiplist_pop_min(d));
+    CuAssertTrue(tc, (void *) 1 == skiplist_pop_min(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_DeterministicPriorityQueue(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = {
+        .flags = SKIPLIST_MULTIMAP | SKIPLIST_DETERMINISTIC };
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 300; i++)
+        skiplist_put(d, (void *) (i % 7 + 1), (void *) i);
+    for (i = 1; i <= 300; i += 3)
+        CuAssertTrue(tc, 0 == skiplist_change_key(d, (void *) (i % 7 + 1),
+                                                  (void *) i, (void *) 9));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    for (i = 0; i < 300; i++)
+        CuAssertTrue(tc, NULL != skiplist_pop_min(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_FloorCeilingLowerHigher(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, NULL == skiplist_floor(d, (void *) 5));
+    for (i = 10; i <= 100; i += 10)
+        skiplist_put(d, (void *) i, (void *) (i + 1));
+
+    CuAssertTrue(tc, (void *) 50 == skiplist_floor(d, (void *) 50)->k);
+    CuAssertTrue(tc, (void *) 50 == skiplist_floor(d, (void *) 55)->k);
+    CuAssertTrue(tc, (void *) 50 == skiplist_ceiling(d, (void *) 50)->k);
+    CuAssertTrue(tc, (void *) 60 == skiplist_ceiling(d, (void *) 55)->k);
+    CuAssertTrue(tc, (void *) 40 == skiplist_lower(d, (void *) 50)->k);
+    CuAssertTrue(tc, (void *) 60 == skiplist_higher(d, (void *) 50)->k);
+    CuAssertTrue(tc, (void *) 51 == skiplist_floor(d, (void *) 50)->v);
+
+    CuAssertTrue(tc, NULL == skiplist_floor(d, (void *) 5));
+    CuAssertTrue(tc, NULL == skiplist_lower(d, (void *) 10));
+    CuAssertTrue(tc, NULL == skiplist_ceiling(d, (void *) 105));
+    CuAssertTrue(tc, NULL == skiplist_higher(d, (void *) 100));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_ReverseIteration(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_iterator_t iter;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) ((i * 37) % 100 + 1), (void *) i);
+
+    skiplist_iterator_reverse(d, NULL, NULL, &iter);
+    for (i = 100; 1 <= i; i--)
+        CuAssertTrue(tc, (void *) i == skiplist_iterator_prev(d, &iter));
+    CuAssertTrue(tc, !skiplist_iterator_has_prev(d, &iter));
+    CuAssertTrue(tc, NULL == skiplist_iterator_prev(d, &iter));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_PreviousNItemsBeforeKey(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_iterator_t iter;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 2; i <= 200; i += 2)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    /* a page of 5 items before 51, down to no further than 44 */
+    skiplist_iterator_reverse(d, (void *) 51, (void *) 44, &iter);
+    CuAssertTrue(tc, (void *) 50 == skiplist_iterator_prev_value(d, &iter));
+    CuAssertTrue(tc, (void *) 48 == skiplist_iterator_prev(d, &iter));
+    CuAssertTrue(tc, (void *) 46 == skiplist_iterator_prev(d, &iter));
+    CuAssertTrue(tc, (void *) 44 == skiplist_iterator_prev(d, &iter));
+    CuAssertTrue(tc, NULL == skiplist_iterator_prev(d, &iter));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_ReverseIterationSurvivesRemoval(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP };
+    skiplist_iterator_t iter;
+    unsigned long i;
+    void *k;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) (i % 10 + 1), (void *) i);
+
+    /* equal keys come out in reverse insertion order */
+    skiplist_iterator_reverse(d, (void *) 3, (void *) 3, &iter);
+    CuAssertTrue(tc, (void *) 92 == skiplist_iterator_prev_value(d, &iter));
+    CuAssertTrue(tc, (void *) 82 == skiplist_iterator_prev_value(d, &iter));
+    skiplist_freeall(d);
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    skiplist_iterator_reverse(d, NULL, NULL, &iter);
+    while ((k = skiplist_iterator_prev(d, &iter)))
+        skiplist_remove(d, k);
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_BacklinksSurviveBulkOps(
+    CuTest * tc
+)
+{
+    skiplist_t *a, *b, *upper;
+    skiplist_iterator_t iter;
+    unsigned long i;
+
+    a = skiplist_new(__ulong_compare, NULL);
+    b = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 300; i++)
+        skiplist_put(i % 3 ? a : b, (void *) i, (void *) i);
+    skiplist_merge(a, b);
+    skiplist_remove_range(a, (void *) 100, (void *) 150, NULL, NULL);
+    skiplist_pop_min(a);
+    upper = skiplist_split(a, (void *) 200);
+    CuAssertTrue(tc, 0 == skiplist_validate(upper, NULL));
+    skiplist_join(a, upper);
+    CuAssertTrue(tc, 0 == skiplist_validate(a, NULL));
+
+    skiplist_iterator_reverse(a, NULL, NULL, &iter);
+    for (i = 300; 2 <= i; i--)
+        if (i < 100 || 150 < i)
+            CuAssertTrue(tc, (void *) i == skiplist_iterator_prev(a, &iter));
+    CuAssertTrue(tc, NULL == skiplist_iterator_prev(a, &iter));
+
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+    skiplist_freeall(upper);
+}
+
+void Testskiplist_CloneSharesUntilChanged(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *c;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    c = skiplist_clone(d);
+    CuAssertTrue(tc, NULL != c);
+    CuAssertTrue(tc, c->nil == d->nil);
+    CuAssertTrue(tc, 100 == skiplist_count(c));
+    CuAssertTrue(tc, (void *) 50 == skiplist_get(c, (void *) 50));
+
+    /* speculative changes to the clone */
+    skiplist_put(c, (void *) 50, (void *) 5000);
+    skiplist_remove(c, (void *) 1);
+    skiplist_put(c, (void *) 101, (void *) 101);
+    CuAssertTrue(tc, c->nil != d->nil);
+    CuAssertTrue(tc, 0 == skiplist_validate(c, NULL));
+    CuAssertTrue(tc, (void *) 5000 == skiplist_get(c, (void *) 50));
+    CuAssertTrue(tc, NULL == skiplist_get(c, (void *) 1));
+
+    /* the original didn't see any of it */
+    CuAssertTrue(tc, 100 == skiplist_count(d));
+    CuAssertTrue(tc, (void *) 50 == skiplist_get(d, (void *) 50));
+    CuAssertTrue(tc, (void *) 1 == skiplist_get(d, (void *) 1));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 101));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_CloneSurvivesChangesToOriginal(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *v1, *v2;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    v1 = skiplist_clone(d);
+    v2 = skiplist_clone(d);
+
+    skiplist_remove_range(d, (void *) 1, (void *) 100, NULL, NULL);
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    CuAssertTrue(tc, 100 == skiplist_count(v1));
+    CuAssertTrue(tc, v1->nil == v2->nil);
+
+    /* v2 is the last one holding the nodes, so it takes them over */
+    skiplist_freeall(v1);
+    skiplist_put(v2, (void *) 7, (void *) 70);
+    CuAssertTrue(tc, NULL == v2->shared);
+    CuAssertTrue(tc, (void *) 70 == skiplist_get(v2, (void *) 7));
+    CuAssertTrue(tc, 0 == skiplist_validate(v2, NULL));
+
+    skiplist_freeall(v2);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_ClearedCloneLeavesOriginal(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *c;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 10; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    c = skiplist_clone(d);
+    skiplist_clear(c);
+    CuAssertTrue(tc, 0 == skiplist_count(c));
+    CuAssertTrue(tc, NULL == skiplist_get(c, (void *) 5));
+    CuAssertTrue(tc, (void *) 5 == skiplist_get(d, (void *) 5));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+}
+
+static uint64_t __ulong_prefix(
+    const void *key,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)key;
+}
+
+static long __str_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused))
+)
+{
+    return strcmp(k1, k2);
+}
+
+/* first 8 bytes, big-endian, so that integer order is string order */
+static uint64_t __str_prefix(
+    const void *key,
+    const void *udata __attribute__((unused))
+)
+{
+    const unsigned char *s = key;
+    uint64_t p = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        p = p << 8 | *s;
+        if (*s)
+            s++;
+    }
+    return p;
+}
+
+void Testskiplist_PrefixSkipsComparator(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    unsigned long i, cmps = 0;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.prefix = __ulong_prefix;
+    d = skiplist_new_opts(__counting_compare, &cmps, &opts);
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 1000 + 1), (void *) i);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    cmps = 0;
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, NULL != skiplist_get(d, (void *) i));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 1001));
+
+    /* prefixes are the whole key, so the only calls are on a hit */
+    CuAssertTrue(tc, 1000 == cmps);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_PrefixTiesFallBackToComparator(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    skiplist_iterator_t iter;
+    char *keys[500], *prev = NULL, *k;
+    int i;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.prefix = __str_prefix;
+    d = skiplist_new_opts(__str_compare, NULL, &opts);
+
+    /* every key shares its first 8 bytes with a lot of others */
+    for (i = 0; i < 500; i++)
+    {
+        keys[i] = malloc(32);
+        sprintf(keys[i], "%s/%05d", i % 2 ? "/usr/lib" : "/a", (i * 37) % 500);
+        skiplist_put(d, keys[i], keys[i]);
+    }
+    CuAssertTrue(tc, 500 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    for (i = 0; i < 500; i++)
+        CuAssertTrue(tc, keys[i] == skiplist_get(d, keys[i]));
+    CuAssertTrue(tc, NULL == skiplist_get(d, "/usr/lib/x"));
+    CuAssertTrue(tc, NULL == skiplist_get(d, "/a"));
+
+    skiplist_iterator(d, &iter);
+    while ((k = skiplist_iterator_next(d, &iter)))
+    {
+        CuAssertTrue(tc, !prev || strcmp(prev, k) < 0);
+        prev = k;
+    }
+
+    for (i = 0; i < 500; i += 2)
+        CuAssertTrue(tc, keys[i] == skiplist_remove(d, keys[i]));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+    for (i = 0; i < 500; i++)
+        free(keys[i]);
+}
+
+void Testskiplist_DeterministicWithPrefix(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    unsigned long i;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.prefix = __ulong_prefix;
+    opts.flags = SKIPLIST_DETERMINISTIC;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    /* removing tall nodes swaps items between nodes */
+    for (i = 2; i <= 1000; i += 2)
+        skiplist_remove(d, (void *) i);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    for (i = 1; i <= 1000; i += 2)
+        CuAssertTrue(tc, (void *) i == skiplist_get(d, (void *) i));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_PartitionCoversListOnceInOrder(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_iterator_t cursors[8];
+    unsigned long i, expect = 1;
+    void *k;
+    int n, c;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 10000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 10000 + 1), (void *) i);
+
+    n = skiplist_partition(d, 8, cursors);
+    CuAssertTrue(tc, 8 == n);
+    for (c = 0; c < n; c++)
+    {
+        unsigned long len = 0;
+        while ((k = skiplist_iterator_next(d, &cursors[c])))
+        {
+            CuAssertTrue(tc, expect++ == (unsigned long)k);
+            len++;
+        }
+        /* splitters are only roughly evenly spaced */
+        CuAssertTrue(tc, 0 < len && len < 4 * 10000 / 8);
+    }
+    CuAssertTrue(tc, 10001 == expect);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_PartitionOfShortList(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_iterator_t cursors[8];
+
+    d = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, 0 == skiplist_partition(d, 8, cursors));
+    skiplist_put(d, (void *) 1, (void *) 1);
+    skiplist_put(d, (void *) 2, (void *) 2);
+    skiplist_put(d, (void *) 3, (void *) 3);
+
+    CuAssertTrue(tc, 3 == skiplist_partition(d, 8, cursors));
+    CuAssertTrue(tc, (void *) 2 == skiplist_iterator_next(d, &cursors[1]));
+    CuAssertTrue(tc, NULL == skiplist_iterator_next(d, &cursors[1]));
+
+    CuAssertTrue(tc, 1 == skiplist_partition(d, 1, cursors));
+    CuAssertTrue(tc, (void *) 1 == skiplist_iterator_next(d, &cursors[0]));
+    CuAssertTrue(tc, (void *) 2 == skiplist_iterator_next(d, &cursors[0]));
+    CuAssertTrue(tc, (void *) 3 == skiplist_iterator_next(d, &cursors[0]));
+    CuAssertTrue(tc, 0 == skiplist_iterator_has_next(d, &cursors[0]));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_FingerGetFindsKeysInAnyOrder(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_finger_t f;
+    unsigned long i, k;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 2; i <= 2000; i += 2)
+        skiplist_put(d, (void *) i, (void *) (i + 1));
+
+    skiplist_finger_init(&f);
+    /* forwards, backwards, jumping about, and keys that aren't there */
+    for (i = 0; i < 5000; i++)
+    {
+        k = i < 2100 ? i : i < 4200 ? 4200 - i : (i * 7919) % 2100;
+        CuAssertTrue(tc, skiplist_get(d, (void *) k) ==
+                     skiplist_finger_get(d, &f, (void *) k));
+    }
+    skiplist_freeall(d);
+}
+
+void Testskiplist_FingerGetOfNearbyKeyIsCheap(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_finger_t f;
+    unsigned long i, cmps = 0;
+
+    d = skiplist_new(__counting_compare, &cmps);
+    for (i = 1; i <= 100000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    skiplist_finger_init(&f);
+    skiplist_finger_get(d, &f, (void *) 1);
+    cmps = 0;
+    for (i = 2; i <= 100000; i++)
+        skiplist_finger_get(d, &f, (void *) i);
+
+    /* a plain get makes about 2 * log2(n), ie. 30 or so, comparisons */
+    CuAssertTrue(tc, cmps < 100000 * 10);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_FingerPutKeepsListIntact(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_finger_t f;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    skiplist_finger_init(&f);
+    for (i = 1; i <= 5000; i++)
+        CuAssertTrue(tc, NULL ==
+                     skiplist_finger_put(d, &f, (void *) (i * 2), (void *) i));
+    /* fill in the gaps going backwards, then replace some */
+    for (i = 5000; 1 <= i; i--)
+        skiplist_finger_put(d, &f, (void *) (i * 2 - 1), (void *) i);
+    CuAssertTrue(tc, (void *) 7 ==
+                 skiplist_finger_put(d, &f, (void *) 14, (void *) 70));
+
+    CuAssertTrue(tc, 10000 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, (void *) 70 == skiplist_finger_get(d, &f, (void *) 14));
+    CuAssertTrue(tc, (void *) 5000 == skiplist_get(d, (void *) 9999));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_FingerSurvivesOtherChanges(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *c;
+    skiplist_finger_t f;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    skiplist_finger_init(&f);
+    CuAssertTrue(tc, (void *) 500 == skiplist_finger_get(d, &f, (void *) 500));
+
+    /* the path ran through nodes that have since been freed */
+    skiplist_remove_range(d, (void *) 400, (void *) 600, NULL, NULL);
+    CuAssertTrue(tc, NULL == skiplist_finger_get(d, &f, (void *) 500));
+    CuAssertTrue(tc, (void *) 601 == skiplist_finger_get(d, &f, (void *) 601));
+
+    /* the put has to take its own copy of the nodes */
+    c = skiplist_clone(d);
+    skiplist_finger_put(d, &f, (void *) 500, (void *) 5);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, (void *) 5 == skiplist_finger_get(d, &f, (void *) 500));
+    CuAssertTrue(tc, NULL == skiplist_get(c, (void *) 500));
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_IterateFromKey(
+    CuTest * tc
+)
+{
+    skiplist_t *d;
+    skiplist_iterator_t iter;
+    unsigned long i;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 10; i <= 100; i += 10)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    skiplist_iterator_from(d, (void *) 35, &iter);
+    for (i = 40; i <= 100; i += 10)
+        CuAssertTrue(tc, (void *) i == skiplist_iterator_next(d, &iter));
+    CuAssertTrue(tc, 0 == skiplist_iterator_has_next(d, &iter));
+
+    skiplist_iterator_from(d, (void *) 50, &iter);
+    CuAssertTrue(tc, (void *) 50 == skiplist_iterator_next(d, &iter));
+
+    skiplist_iterator_from(d, (void *) 101, &iter);
+    CuAssertTrue(tc, 0 == skiplist_iterator_has_next(d, &iter));
+
+    skiplist_iterator_from(d, NULL, &iter);
+    CuAssertTrue(tc, (void *) 10 == skiplist_iterator_next(d, &iter));
+    skiplist_freeall(d);
+}
+
+#ifdef SKIPLIST_TTL
+static uint64_t __now;
+
+static uint64_t __fake_clock(
+    const void *udata __attribute__((unused)))
+{
+    return __now;
+}
+
+static void __count_expired(
+    skiplist_entry_t *ety __attribute__((unused)),
+    void *udata)
+{
+    (*(int *) udata)++;
+}
+#endif
+
+void Testskiplist_GetEvictsExpiredItem(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_TTL
+    skiplist_opts_t opts = { .clock = __fake_clock,
+                             .on_expire = __count_expired };
+    skiplist_t *d;
+    int expired = 0;
+
+    opts.expire_udata = &expired;
+    __now = 100;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_put_expiry(d, (void *) 1, (void *) 10, 150);
+    skiplist_put(d, (void *) 2, (void *) 20);
+
+    CuAssertTrue(tc, (void *) 10 == skiplist_get(d, (void *) 1));
+    __now = 150;
+    CuAssertTrue(tc, 2 == skiplist_count(d));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 1));
+    CuAssertTrue(tc, 1 == expired);
+    CuAssertTrue(tc, 1 == skiplist_count(d));
+    CuAssertTrue(tc, (void *) 20 == skiplist_get(d, (void *) 2));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+void Testskiplist_PutReplacesExpiry(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_TTL
+    skiplist_opts_t opts = { .clock = __fake_clock };
+    skiplist_t *d;
+
+    __now = 0;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_put_expiry(d, (void *) 1, (void *) 10, 10);
+    CuAssertTrue(tc, (void *) 10 ==
+                 skiplist_put_expiry(d, (void *) 1, (void *) 11, 20));
+    skiplist_put_expiry(d, (void *) 2, (void *) 20, 10);
+    skiplist_put(d, (void *) 2, (void *) 21);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    __now = 15;
+    CuAssertTrue(tc, (void *) 11 == skiplist_get(d, (void *) 1));
+    __now = 1000;
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 1));
+    CuAssertTrue(tc, (void *) 21 == skiplist_get(d, (void *) 2));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+#ifdef SKIPLIST_TTL
+static void __record_key(
+    skiplist_entry_t *ety,
+    void *udata)
+{
+    unsigned long **k = udata;
+    *(*k)++ = (unsigned long) ety->k;
+}
+#endif
+
+void Testskiplist_ExpireIsBoundedAndInTimeOrder(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_TTL
+    skiplist_opts_t opts = { .clock = __fake_clock,
+                             .on_expire = __record_key };
+    unsigned long keys[100], *k = keys, i;
+    skiplist_t *d;
+
+    opts.expire_udata = &k;
+    __now = 0;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    /* key i expires at 100 - i, so keys expire in reverse order */
+    for (i = 1; i <= 100; i++)
+        skiplist_put_expiry(d, (void *) i, (void *) i, 101 - i);
+
+    __now = 50;
+    CuAssertTrue(tc, 0 == skiplist_expire(d, 0));
+    CuAssertTrue(tc, 10 == skiplist_expire(d, 10));
+    CuAssertTrue(tc, 40 == skiplist_expire(d, 1000));
+    CuAssertTrue(tc, 0 == skiplist_expire(d, 1000));
+    CuAssertTrue(tc, 50 == skiplist_count(d));
+    for (i = 0; i < 50; i++)
+        CuAssertTrue(tc, 100 - i == keys[i]);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+void Testskiplist_ExpireTakesTheItemThatExpired(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_TTL
+    skiplist_opts_t opts = { .flags = SKIPLIST_MULTIMAP,
+                             .clock = __fake_clock };
+    skiplist_iterator_t iter;
+    skiplist_t *d;
+
+    __now = 0;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    /* equal keys and values, told apart only by when they expire */
+    skiplist_put_expiry(d, (void *) 1, (void *) 10, 200);
+    skiplist_put_expiry(d, (void *) 1, (void *) 10, 100);
+    skiplist_put(d, (void *) 1, (void *) 20);
+
+    __now = 100;
+    CuAssertTrue(tc, 1 == skiplist_expire(d, 1000));
+    CuAssertTrue(tc, 2 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_iterator(d, &iter);
+    CuAssertTrue(tc, (void *) 10 == skiplist_iterator_next_value(d, &iter));
+    CuAssertTrue(tc, (void *) 20 == skiplist_iterator_next_value(d, &iter));
+
+    /* the one left still expires when it should */
+    __now = 199;
+    CuAssertTrue(tc, 0 == skiplist_expire(d, 1000));
+    __now = 200;
+    CuAssertTrue(tc, 1 == skiplist_expire(d, 1000));
+    CuAssertTrue(tc, (void *) 20 == skiplist_get(d, (void *) 1));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+void Testskiplist_IteratorsSkipExpiredItems(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_TTL
+    skiplist_opts_t opts = { .clock = __fake_clock };
+    skiplist_iterator_t iter;
+    skiplist_t *d;
+    unsigned long i;
+
+    __now = 0;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    /* odd keys expire */
+    for (i = 1; i <= 10; i++)
+        skiplist_put_expiry(d, (void *) i, (void *) i, i % 2 ? 5 : 0);
+    __now = 5;
+
+    skiplist_iterator(d, &iter);
+    for (i = 2; i <= 10; i += 2)
+        CuAssertTrue(tc, (void *) i == skiplist_iterator_next(d, &iter));
+    CuAssertTrue(tc, 0 == skiplist_iterator_has_next(d, &iter));
+
+    skiplist_iterator_reverse(d, NULL, NULL, &iter);
+    for (i = 10; 2 <= i; i -= 2)
+        CuAssertTrue(tc, (void *) i == skiplist_iterator_prev(d, &iter));
+    CuAssertTrue(tc, 0 == skiplist_iterator_has_prev(d, &iter));
+
+    /* skipping over them leaves them be */
+    CuAssertTrue(tc, 10 == skiplist_count(d));
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+void Testskiplist_GetOnSharedVersionLeavesExpiredItems(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_TTL
+    skiplist_opts_t opts = { .clock = __fake_clock,
+                             .flags = SKIPLIST_MULTIMAP };
+    skiplist_finger_t f;
+    skiplist_t *d, *c;
+    unsigned long i;
+
+    __now = 0;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 100; i++)
+        skiplist_put_expiry(d, (void *) i, (void *) i, 10);
+    /* an equal key behind an expired one */
+    skiplist_put(d, (void *) 50, (void *) 500);
+    c = skiplist_clone(d);
+    __now = 10;
+
+    skiplist_finger_init(&f);
+    CuAssertTrue(tc, NULL == skiplist_get(c, (void *) 1));
+    CuAssertTrue(tc, NULL == skiplist_finger_get(c, &f, (void *) 100));
+    CuAssertTrue(tc, (void *) 500 == skiplist_get(c, (void *) 50));
+    CuAssertTrue(tc, (void *) 500 == skiplist_finger_get(d, &f, (void *) 50));
+
+    /* neither version took a copy */
+    CuAssertTrue(tc, c->nil == d->nil);
+    CuAssertTrue(tc, 101 == skiplist_count(c));
+
+    /* removing them is a change, so it does copy */
+    CuAssertTrue(tc, 100 == skiplist_expire(c, 1000));
+    CuAssertTrue(tc, c->nil != d->nil);
+    CuAssertTrue(tc, 101 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(c, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+void Testskiplist_ExpiryFollowsItemsBetweenLists(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_TTL
+    skiplist_opts_t opts = { .clock = __fake_clock };
+    skiplist_t *d, *upper, *c, *e;
+    unsigned long i;
+
+    __now = 0;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    e = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 100; i++)
+        skiplist_put_expiry(d, (void *) i, (void *) i, i % 3 ? 0 : 10);
+    for (i = 50; i <= 60; i++)
+        skiplist_put_expiry(e, (void *) i, (void *) (i * 10), 20);
+
+    c = skiplist_clone(d);
+    upper = skiplist_split(d, (void *) 50);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(upper, NULL));
+    CuAssertTrue(tc, 0 == skiplist_join(d, upper));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_merge(d, e);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(c, NULL));
+
+    /* merged keys took other's expiry along with its value */
+    __now = 15;
+    CuAssertTrue(tc, 33 - 4 == skiplist_expire(d, 1000));
+    CuAssertTrue(tc, (void *) 510 == skiplist_get(d, (void *) 51));
+    CuAssertTrue(tc, (void *) 540 == skiplist_get(d, (void *) 54));
+    CuAssertTrue(tc, 33 == skiplist_expire(c, 1000));
+    __now = 20;
+    CuAssertTrue(tc, 11 == skiplist_expire(d, 1000));
+    CuAssertTrue(tc, 100 - 40 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(upper);
+    skiplist_freeall(e);
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+static void __increment(
+    skiplist_entry_t *ety,
+    int found,
+    void *udata __attribute__((unused)))
+{
+    ety->v = (void *) ((found ? (unsigned long) ety->v : 0) + 1);
+}
+
+void Testskiplist_UpsertCountsInOneDescent(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *e;
+    unsigned long i, cmps = 0, upsert_cmps;
+
+    d = skiplist_new(__counting_compare, &cmps);
+    for (i = 0; i < 5000; i++)
+        CuAssertTrue(tc, (i < 500) ==
+                     skiplist_upsert(d, (void *) (i % 500 + 1), __increment,
+                                     NULL));
+    upsert_cmps = cmps;
+    CuAssertTrue(tc, 500 == skiplist_count(d));
+    for (i = 1; i <= 500; i++)
+        CuAssertTrue(tc, (void *) 10 == skiplist_get(d, (void *) i));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    /* the same counting with a get and a put */
+    cmps = 0;
+    e = skiplist_new(__counting_compare, &cmps);
+    for (i = 0; i < 5000; i++)
+    {
+        void *k = (void *) (i % 500 + 1);
+        skiplist_put(e, k, (void *) ((unsigned long) skiplist_get(e, k) + 1));
+    }
+    CuAssertTrue(tc, upsert_cmps * 3 < cmps * 2);
+    skiplist_freeall(e);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_UpsertCountsOneOp(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_STATS
+    skiplist_opts_t opts = { .flags = 0 };
+    skiplist_stats_t stats;
+    skiplist_t *d;
+    unsigned long i;
+    int det;
+
+    for (det = 0; det < 2; det++)
+    {
+        opts.flags = det ? SKIPLIST_DETERMINISTIC : 0;
+        d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+        for (i = 0; i < 1000; i++)
+            skiplist_upsert(d, (void *) (i % 100 + 1), __increment, NULL);
+        skiplist_stats(d, &stats);
+        CuAssertTrue(tc, 1000 == stats.ops);
+        skiplist_freeall(d);
+    }
+
+#ifdef SKIPLIST_TTL
+    /* having to evict first doesn't count the upsert again; the remove that
+     * evicts counts once */
+    opts.clock = __fake_clock;
+    for (det = 0; det < 2; det++)
+    {
+        opts.flags = det ? SKIPLIST_DETERMINISTIC : 0;
+        __now = 0;
+        d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+        skiplist_put_expiry(d, (void *) 1, (void *) 1, 5);
+        __now = 5;
+        skiplist_stats_reset(d);
+        CuAssertTrue(tc, 1 == skiplist_upsert(d, (void *) 1, __increment,
+                                              NULL));
+        skiplist_stats(d, &stats);
+        CuAssertTrue(tc, 2 == stats.ops);
+        skiplist_freeall(d);
+    }
+#endif
+#else
+    (void) tc;
+#endif
+}
+
+void Testskiplist_UpsertDeterministicAndMultimap(
+    CuTest * tc
+)
+{
+    skiplist_opts_t opts = { .flags = SKIPLIST_DETERMINISTIC };
+    skiplist_t *d;
+    unsigned long i;
+
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 0; i < 3000; i++)
+        skiplist_upsert(d, (void *) (i % 1000 + 1), __increment, NULL);
+    CuAssertTrue(tc, 1000 == skiplist_count(d));
+    CuAssertTrue(tc, (void *) 3 == skiplist_get(d, (void *) 999));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    skiplist_freeall(d);
+
+    /* only the first of a run of equal keys is counted on */
+    opts.flags = SKIPLIST_MULTIMAP;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_put(d, (void *) 1, (void *) 5);
+    skiplist_put(d, (void *) 1, (void *) 7);
+    CuAssertTrue(tc, 0 == skiplist_upsert(d, (void *) 1, __increment, NULL));
+    CuAssertTrue(tc, (void *) 6 == skiplist_pop_min(d));
+    CuAssertTrue(tc, (void *) 7 == skiplist_pop_min(d));
+    skiplist_freeall(d);
+}
+
+void Testskiplist_PutIfAbsentKeepsFirstValue(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *c;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, NULL == skiplist_put_if_absent(d, (void *) 1, (void *) 10));
+    c = skiplist_clone(d);
+    CuAssertTrue(tc, (void *) 10 ==
+                 skiplist_put_if_absent(d, (void *) 1, (void *) 11));
+    CuAssertTrue(tc, NULL == skiplist_put_if_absent(d, (void *) 2, (void *) 20));
+    CuAssertTrue(tc, (void *) 10 == skiplist_get(d, (void *) 1));
+    CuAssertTrue(tc, 2 == skiplist_count(d));
+    CuAssertTrue(tc, 1 == skiplist_count(c));
+    CuAssertTrue(tc, NULL == skiplist_put_if_absent(d, NULL, (void *) 1));
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+}
+
+void Testskiplist_CompareAndReplace(
+    CuTest * tc
+)
+{
+    skiplist_t *d, *c;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(d, (void *) 1, (void *) 10);
+    c = skiplist_clone(d);
+
+    CuAssertTrue(tc, -1 == skiplist_compare_and_replace(d, (void *) 1,
+                                                        (void *) 11,
+                                                        (void *) 12));
+    CuAssertTrue(tc, 0 == skiplist_compare_and_replace(d, (void *) 1,
+                                                       (void *) 10,
+                                                       (void *) 12));
+    CuAssertTrue(tc, (void *) 12 == skiplist_get(d, (void *) 1));
+    /* a clone's copy isn't touched */
+    CuAssertTrue(tc, (void *) 10 == skiplist_get(c, (void *) 1));
+
+    /* nothing to replace, so nothing is put */
+    CuAssertTrue(tc, -1 == skiplist_compare_and_replace(d, (void *) 2, NULL,
+                                                        (void *) 20));
+    CuAssertTrue(tc, 1 == skiplist_count(d));
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+}
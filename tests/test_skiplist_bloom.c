@@ -0,0 +1,209 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "CuTest.h"
+
+#include "skiplist.h"
+#include "skiplist_bloom.h"
+
+static long __ulong_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)k1 - (unsigned long)k2;
+}
+
+static uint64_t __ulong_hash(
+    const void *key,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)key;
+}
+
+static skiplist_t *__new(unsigned int flags)
+{
+    skiplist_opts_t opts;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.hash = __ulong_hash;
+    opts.flags = flags;
+    return skiplist_new_opts(__ulong_compare, NULL, &opts);
+}
+
+void Testskiplist_bloom_NoFalseNegatives(
+    CuTest * tc
+)
+{
+    skiplist_bloom_t *b;
+    uint64_t i;
+
+    b = skiplist_bloom_new(1000);
+    CuAssertTrue(tc, 1000 <= b->capacity);
+    for (i = 1; i <= 1000; i++)
+        skiplist_bloom_add(b, i);
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, 1 == skiplist_bloom_maybe(b, i));
+    skiplist_bloom_free(b);
+}
+
+void Testskiplist_bloom_FewFalsePositivesAtCapacity(
+    CuTest * tc
+)
+{
+    skiplist_bloom_t *b;
+    uint64_t i;
+    int fp = 0;
+
+    b = skiplist_bloom_new(10000);
+    for (i = 1; i <= b->capacity; i++)
+        skiplist_bloom_add(b, i);
+    for (i = 1000000; i < 1100000; i++)
+        fp += skiplist_bloom_maybe(b, i);
+
+    /* about 0.1% in theory; blocking costs a little */
+    CuAssertTrue(tc, fp < 500);
+    skiplist_bloom_free(b);
+}
+
+void Testskiplist_bloom_RemoveUndoesAdd(
+    CuTest * tc
+)
+{
+    skiplist_bloom_t *b, *c;
+    uint64_t i;
+
+    b = skiplist_bloom_new(100);
+    for (i = 1; i <= 100; i++)
+        skiplist_bloom_add(b, i);
+    c = skiplist_bloom_copy(b);
+    for (i = 1; i <= 100; i++)
+        skiplist_bloom_remove(b, i);
+    for (i = 1; i <= 100; i++)
+        CuAssertTrue(tc, 0 == skiplist_bloom_maybe(b, i));
+
+    /* the copy has its own counters */
+    for (i = 1; i <= 100; i++)
+        CuAssertTrue(tc, 1 == skiplist_bloom_maybe(c, i));
+    skiplist_bloom_clear(c);
+    CuAssertTrue(tc, 0 == skiplist_bloom_maybe(c, 1));
+    skiplist_bloom_free(b);
+    skiplist_bloom_free(c);
+}
+
+void Testskiplist_bloom_StuckCountersNeverGoFalseNegative(
+    CuTest * tc
+)
+{
+    skiplist_bloom_t *b;
+    int i;
+
+    /* one block, so the counters saturate */
+    b = skiplist_bloom_new(1);
+    for (i = 1; i <= 500; i++)
+        skiplist_bloom_add(b, i);
+    for (i = 2; i <= 500; i++)
+        skiplist_bloom_remove(b, i);
+    CuAssertTrue(tc, 1 == skiplist_bloom_maybe(b, 1));
+    skiplist_bloom_free(b);
+}
+
+void Testskiplist_bloom_GetSkipsSearchForMissingKeys(
+    CuTest * tc
+)
+{
+#ifdef SKIPLIST_STATS
+    skiplist_t *d = __new(0);
+    skiplist_stats_t stats;
+    unsigned long i;
+
+    for (i = 1; i <= 5000; i++)
+        skiplist_put(d, (void *) (i * 2), (void *) i);
+    CuAssertTrue(tc, d->bloom->capacity >= 5000);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    skiplist_stats_reset(d);
+    for (i = 1; i <= 5000; i++)
+    {
+        CuAssertTrue(tc, (void *) i == skiplist_get(d, (void *) (i * 2)));
+        CuAssertTrue(tc, NULL == skiplist_get(d, (void *) (i * 2 + 1)));
+    }
+    skiplist_stats(d, &stats);
+    CuAssertTrue(tc, 4900 < stats.filtered);
+
+    /* removed keys are filtered out too */
+    for (i = 2; i <= 5000; i++)
+        skiplist_remove(d, (void *) (i * 2));
+    skiplist_stats_reset(d);
+    for (i = 2; i <= 5000; i++)
+        CuAssertTrue(tc, NULL == skiplist_get(d, (void *) (i * 2)));
+    skiplist_stats(d, &stats);
+    CuAssertTrue(tc, 4999 == stats.filtered);
+    skiplist_freeall(d);
+#else
+    (void) tc;
+#endif
+}
+
+void Testskiplist_bloom_FollowsSplitJoinAndMerge(
+    CuTest * tc
+)
+{
+    skiplist_t *d = __new(0), *e = __new(0), *upper;
+    unsigned long i;
+
+    for (i = 1; i <= 1000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    upper = skiplist_split(d, (void *) 501);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(upper, NULL));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 700));
+    CuAssertTrue(tc, (void *) 700 == skiplist_get(upper, (void *) 700));
+
+    CuAssertTrue(tc, 0 == skiplist_join(d, upper));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, NULL == skiplist_get(upper, (void *) 700));
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, (void *) i == skiplist_get(d, (void *) i));
+
+    for (i = 500; i <= 1500; i++)
+        skiplist_put(e, (void *) i, (void *) i);
+    skiplist_merge(d, e);
+    CuAssertTrue(tc, 1500 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, (void *) 1200 == skiplist_get(d, (void *) 1200));
+
+    skiplist_remove_range(d, (void *) 100, (void *) 1400, NULL, NULL);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 1200));
+    skiplist_freeall(d);
+    skiplist_freeall(e);
+    skiplist_freeall(upper);
+}
+
+void Testskiplist_bloom_ClonesKeepTheirOwnFilter(
+    CuTest * tc
+)
+{
+    skiplist_t *d = __new(SKIPLIST_DETERMINISTIC), *c;
+    unsigned long i;
+
+    for (i = 1; i <= 100; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    c = skiplist_clone(d);
+    skiplist_remove(c, (void *) 50);
+    skiplist_put(c, (void *) 500, (void *) 500);
+    CuAssertTrue(tc, d->bloom != c->bloom);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(c, NULL));
+    CuAssertTrue(tc, (void *) 50 == skiplist_get(d, (void *) 50));
+    CuAssertTrue(tc, NULL == skiplist_get(c, (void *) 50));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 500));
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+}
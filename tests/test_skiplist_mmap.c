@@ -0,0 +1,213 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "CuTest.h"
+
+#include "skiplist_mmap.h"
+
+static void __tmpfile(char *path)
+{
+    strcpy(path, "/tmp/skiplist_mmap_XXXXXX");
+    int fd = mkstemp(path);
+    close(fd);
+    /* an empty file is initialised on open */
+    truncate(path, 0);
+}
+
+void Testskiplist_mmap_PutThenGet(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_mmap_t *m;
+    size_t vlen;
+
+    __tmpfile(path);
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    CuAssertTrue(tc, NULL != m);
+
+    CuAssertTrue(tc, 0 == skiplist_mmap_put(m, "abc", 3, "92", 3));
+    CuAssertTrue(tc, 1 == skiplist_mmap_count(m));
+    CuAssertStrEquals(tc, "92", skiplist_mmap_get(m, "abc", 3, &vlen));
+    CuAssertTrue(tc, 3 == vlen);
+    CuAssertTrue(tc, NULL == skiplist_mmap_get(m, "ab", 2, NULL));
+
+    skiplist_mmap_close(m);
+    unlink(path);
+}
+
+void Testskiplist_mmap_DoublePutReplacesValue(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_mmap_t *m;
+
+    __tmpfile(path);
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    skiplist_mmap_put(m, "abc", 3, "92", 3);
+    skiplist_mmap_put(m, "abc", 3, "23", 3);
+    CuAssertTrue(tc, 1 == skiplist_mmap_count(m));
+    CuAssertStrEquals(tc, "23", skiplist_mmap_get(m, "abc", 3, NULL));
+
+    skiplist_mmap_close(m);
+    unlink(path);
+}
+
+void Testskiplist_mmap_Remove(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_mmap_t *m;
+
+    __tmpfile(path);
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    skiplist_mmap_put(m, "a", 1, "1", 2);
+    skiplist_mmap_put(m, "b", 1, "2", 2);
+    CuAssertTrue(tc, 0 == skiplist_mmap_remove(m, "c", 1));
+    CuAssertTrue(tc, 1 == skiplist_mmap_remove(m, "a", 1));
+    CuAssertTrue(tc, 1 == skiplist_mmap_count(m));
+    CuAssertTrue(tc, NULL == skiplist_mmap_get(m, "a", 1, NULL));
+    CuAssertStrEquals(tc, "2", skiplist_mmap_get(m, "b", 1, NULL));
+
+    skiplist_mmap_close(m);
+    unlink(path);
+}
+
+void Testskiplist_mmap_ReopenKeepsEverything(
+    CuTest * tc
+)
+{
+    char path[64], k[16], v[16];
+    skiplist_mmap_t *m;
+    int i;
+
+    __tmpfile(path);
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    /* enough to grow the file a few times */
+    for (i = 0; i < 2000; i++)
+    {
+        sprintf(k, "key%05d", (i * 7919) % 2000);
+        sprintf(v, "%d", i);
+        CuAssertTrue(tc, 0 == skiplist_mmap_put(m, k, strlen(k), v, strlen(v) + 1));
+    }
+    skiplist_mmap_close(m);
+
+    m = skiplist_mmap_open(path, 0);
+    CuAssertTrue(tc, NULL != m);
+    CuAssertTrue(tc, 2000 == skiplist_mmap_count(m));
+    for (i = 0; i < 2000; i++)
+    {
+        sprintf(k, "key%05d", (i * 7919) % 2000);
+        sprintf(v, "%d", i);
+        CuAssertStrEquals(tc, v, skiplist_mmap_get(m, k, strlen(k), NULL));
+    }
+    skiplist_mmap_close(m);
+    unlink(path);
+}
+
+void Testskiplist_mmap_ReaderSeesWritersGrowth(
+    CuTest * tc
+)
+{
+    char path[64], k[16];
+    skiplist_mmap_t *w, *r;
+    int i;
+
+    __tmpfile(path);
+    w = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    r = skiplist_mmap_open(path, SKIPLIST_MMAP_RDONLY);
+    CuAssertTrue(tc, NULL != r);
+    CuAssertTrue(tc, -1 == skiplist_mmap_put(r, "a", 1, "1", 2));
+
+    for (i = 0; i < 1000; i++)
+    {
+        sprintf(k, "key%05d", i);
+        skiplist_mmap_put(w, k, strlen(k), "x", 2);
+    }
+    CuAssertStrEquals(tc, "x", skiplist_mmap_get(r, "key00999", 8, NULL));
+
+    skiplist_mmap_close(r);
+    skiplist_mmap_close(w);
+    unlink(path);
+}
+
+void Testskiplist_mmap_ValidateRepairsHeaderAfterCrash(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_mmap_t *m;
+
+    __tmpfile(path);
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    skiplist_mmap_put(m, "a", 1, "1", 2);
+    skiplist_mmap_put(m, "b", 1, "2", 2);
+
+    /* as if we died after linking "b" in but before the header caught up */
+    ((skiplist_mmap_header_t*)m->base)->count = 1;
+    skiplist_mmap_close(m);
+
+    m = skiplist_mmap_open(path, 0);
+    CuAssertTrue(tc, NULL != m);
+    CuAssertTrue(tc, 2 == skiplist_mmap_count(m));
+    skiplist_mmap_close(m);
+    unlink(path);
+}
+
+void Testskiplist_mmap_OpenRejectsCorruptList(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_mmap_t *m;
+    skiplist_mmap_header_t *h;
+
+    __tmpfile(path);
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    skiplist_mmap_put(m, "a", 1, "1", 2);
+    h = (skiplist_mmap_header_t*)m->base;
+    h->nil[0] = m->size + 8;
+    CuAssertTrue(tc, -1 == skiplist_mmap_validate(m));
+    skiplist_mmap_close(m);
+
+    CuAssertTrue(tc, NULL == skiplist_mmap_open(path, 0));
+
+    /* without the walk, only validate finds out */
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_NOCHECK);
+    CuAssertTrue(tc, NULL != m);
+    CuAssertTrue(tc, -1 == skiplist_mmap_validate(m));
+    skiplist_mmap_close(m);
+    unlink(path);
+}
+
+void Testskiplist_mmap_PutFailsPastLastOffset(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_mmap_t *m;
+    skiplist_mmap_header_t *h;
+    uint64_t used;
+
+    __tmpfile(path);
+    m = skiplist_mmap_open(path, SKIPLIST_MMAP_CREATE);
+    CuAssertTrue(tc, 0 == skiplist_mmap_put(m, "a", 1, "1", 2));
+
+    /* pretend the region is nearly as big as offsets can reach */
+    h = (skiplist_mmap_header_t*)m->base;
+    used = h->used;
+    h->used = (skiplist_off_t)-1 - 64;
+    if (sizeof(skiplist_off_t) < sizeof(uint64_t))
+        CuAssertTrue(tc, -1 == skiplist_mmap_put(m, "b", 1, "2", 2));
+    h->used = used;
+    CuAssertTrue(tc, 0 == skiplist_mmap_put(m, "b", 1, "2", 2));
+    CuAssertTrue(tc, 0 == skiplist_mmap_validate(m));
+    skiplist_mmap_close(m);
+    unlink(path);
+}
@@ -0,0 +1,427 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "CuTest.h"
+
+#include "skiplist.h"
+#include "skiplist_pool.h"
+
+static long __ulong_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)k1 - (unsigned long)k2;
+}
+
+void Testskiplist_pool_AllocIsZeroedAndReused(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    char *a, *b;
+
+    p = skiplist_pool_new(0, -1);
+    a = skiplist_pool_alloc(p, 40);
+    CuAssertTrue(tc, NULL != a);
+    CuAssertTrue(tc, 0 == a[0] && 0 == a[39]);
+    memset(a, 0xff, 40);
+    skiplist_pool_release(p, a, 40);
+
+    /* same size class */
+    b = skiplist_pool_alloc(p, 33);
+    CuAssertTrue(tc, a == b);
+    CuAssertTrue(tc, 0 == b[0] && 0 == b[32]);
+    CuAssertTrue(tc, SKIPLIST_POOL_SLAB == skiplist_pool_bytes(p));
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_GrowsBySlab(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    int i;
+
+    p = skiplist_pool_new(0, -1);
+    for (i = 0; i < SKIPLIST_POOL_SLAB / 256 + 1; i++)
+        CuAssertTrue(tc, NULL != skiplist_pool_alloc(p, 256));
+    CuAssertTrue(tc, 2 * SKIPLIST_POOL_SLAB == skiplist_pool_bytes(p));
+
+    /* too big for a size class */
+    void *big = skiplist_pool_alloc(p, 4096);
+    CuAssertTrue(tc, NULL != big);
+    skiplist_pool_release(p, big, 4096);
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_ResetFreesBigAllocations(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    char *a, *b, *c;
+    int i;
+
+    /* the leak checker catches any of these that reset and free miss */
+    p = skiplist_pool_new(0, -1);
+    a = skiplist_pool_alloc(p, 4096);
+    b = skiplist_pool_carve(p, 4096);
+    c = skiplist_pool_alloc(p, 4096);
+    CuAssertTrue(tc, NULL != a && NULL != b && NULL != c);
+    for (i = 0; i < 4096; i++)
+        CuAssertTrue(tc, 0 == a[i] && 0 == b[i] && 0 == c[i]);
+    skiplist_pool_release(p, b, 4096);
+    skiplist_pool_reset(p);
+
+    CuAssertTrue(tc, NULL != skiplist_pool_alloc(p, 4096));
+    CuAssertTrue(tc, NULL != skiplist_pool_alloc(p, 4096));
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_SlabsAreAligned(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    char *a;
+    int i, j;
+
+    /* huge pages can only back a slab that starts on a slab boundary */
+    p = skiplist_pool_new(SKIPLIST_POOL_HUGEPAGES, -1);
+    for (i = 0; i < 3; i++)
+    {
+        /* the first carve from each slab follows its header */
+        a = skiplist_pool_carve(p, 512);
+        CuAssertTrue(tc, NULL != a);
+        CuAssertTrue(tc, 0 == ((unsigned long)a - SKIPLIST_POOL_GRAIN) %
+                     SKIPLIST_POOL_SLAB);
+        for (j = 1; j < (SKIPLIST_POOL_SLAB - SKIPLIST_POOL_GRAIN) / 512; j++)
+            skiplist_pool_carve(p, 512);
+    }
+    CuAssertTrue(tc, 3 * SKIPLIST_POOL_SLAB == skiplist_pool_bytes(p));
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_ListUsesPool(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    unsigned long i;
+
+    /* falls back to ordinary pages if no huge pages are reserved */
+    p = skiplist_pool_new(SKIPLIST_POOL_HUGEPAGES, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+
+    for (i = 1; i <= 5000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 5000 + 1), (void *) i);
+    for (i = 1; i <= 5000; i += 2)
+        skiplist_remove(d, (void *) i);
+    CuAssertTrue(tc, 2500 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, 1 == skiplist_rebuild(d, 0));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    for (i = 2; i <= 5000; i += 2)
+        CuAssertTrue(tc, NULL != skiplist_get(d, (void *) i));
+    CuAssertTrue(tc, 0 < skiplist_pool_bytes(p));
+
+    skiplist_freeall(d);
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_DeterministicListUsesPool(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    unsigned long i;
+
+    p = skiplist_pool_new(0, 0);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    opts.flags = SKIPLIST_DETERMINISTIC;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+
+    /* raising nodes grows their towers inside the pool */
+    for (i = 1; i <= 2000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    for (i = 1; i <= 2000; i += 3)
+        skiplist_remove(d, (void *) i);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    /* removes lower nodes; their towers still go back whole */
+    skiplist_freeall(d);
+    CuAssertTrue(tc, skiplist_pool_bytes(p) == skiplist_pool_slack(p));
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_JoinNeedsSamePool(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *a, *b;
+    skiplist_opts_t opts;
+
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    a = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    b = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(a, (void *) 1, (void *) 1);
+    skiplist_put(b, (void *) 2, (void *) 2);
+    CuAssertTrue(tc, -1 == skiplist_join(a, b));
+    CuAssertTrue(tc, -1 == skiplist_merge(a, b));
+    CuAssertTrue(tc, 1 == skiplist_count(a));
+    CuAssertTrue(tc, 1 == skiplist_count(b));
+
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_DropResetsPool(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    unsigned long i;
+
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 100000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    CuAssertTrue(tc, SKIPLIST_POOL_SLAB < skiplist_pool_bytes(p));
+    skiplist_drop(d);
+    CuAssertTrue(tc, 0 == skiplist_pool_bytes(p));
+
+    /* the pool is as good as new */
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    skiplist_put(d, (void *) 1, (void *) 1);
+    CuAssertTrue(tc, (void *) 1 == skiplist_get(d, (void *) 1));
+    skiplist_drop(d);
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_MemoryUsageAddsUp(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    skiplist_memory_t mem;
+    unsigned long i;
+
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 5000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    for (i = 1; i <= 5000; i += 2)
+        skiplist_remove(d, (void *) i);
+
+    /* every slab byte is a node, a tower, nil, or slack */
+    skiplist_memory_usage(d, &mem);
+    CuAssertTrue(tc, 2500 * sizeof(node_t) <= mem.nodes);
+    CuAssertTrue(tc, 2500 * sizeof(node_t*) <= mem.towers);
+    CuAssertTrue(tc, 0 < mem.pool_slack);
+    CuAssertTrue(tc, skiplist_pool_bytes(p) ==
+                 mem.nodes + mem.towers + mem.sentinel - sizeof(skiplist_t) +
+                 mem.pool_slack);
+    CuAssertTrue(tc, mem.total == skiplist_pool_bytes(p) + sizeof(skiplist_t));
+    skiplist_freeall(d);
+
+    /* without a pool, just what was asked for */
+    d = skiplist_new(__ulong_compare, NULL);
+    skiplist_put(d, (void *) 1, (void *) 1);
+    skiplist_memory_usage(d, &mem);
+    CuAssertTrue(tc, sizeof(node_t) == mem.nodes);
+    CuAssertTrue(tc, 0 == mem.pool_slack);
+    CuAssertTrue(tc, -1 == skiplist_compact(d, 10));
+    skiplist_freeall(d);
+    skiplist_pool_free(p);
+}
+
+/**
+ * @return number of nodes that aren't at a higher address than the node
+ *  before them, or that are more than a node and tower past it */
+static int __jumps(skiplist_t * d)
+{
+    node_t *n, *p = NULL;
+    int jumps = 0;
+
+    for (n = d->nil->next[0]; n; p = n, n = n->next[0])
+        if (p && ((char *) n < (char *) p ||
+                  (char *) p + 80 + sizeof(node_t*) * p->levels < (char *) n))
+            jumps++;
+    return jumps;
+}
+
+/**
+ * @return sum of the nodes' addresses, which changes if any node moves */
+static uintptr_t __where(skiplist_t * d)
+{
+    node_t *n;
+    uintptr_t sum = 0;
+
+    for (n = d->nil->next[0]; n; n = n->next[0])
+        sum += (uintptr_t) n;
+    return sum;
+}
+
+void Testskiplist_pool_CompactPacksInKeyOrder(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    unsigned long i;
+    uintptr_t where;
+    int r;
+
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+
+    /* churn leaves nodes scattered over the free lists */
+    for (i = 1; i <= 10000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 10000), (void *) i);
+    for (i = 0; i < 10000; i += 3)
+        skiplist_remove(d, (void *) i);
+    for (i = 0; i < 10000; i += 3)
+        skiplist_put(d, (void *) ((i * 7919) % 10000 * 2 + 20000),
+                     (void *) i);
+    CuAssertTrue(tc, 1000 < __jumps(d));
+
+    while (0 == (r = skiplist_compact(d, 100)));
+    CuAssertTrue(tc, 1 == r);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    /* one jump per slab at most */
+    CuAssertTrue(tc, __jumps(d) <= 2);
+
+    /* a packed list has nothing left to move */
+    where = __where(d);
+    CuAssertTrue(tc, 1 == skiplist_compact(d, 100000));
+    CuAssertTrue(tc, where == __where(d));
+    CuAssertTrue(tc, (void *) 1 == skiplist_get(d, (void *) 7919));
+
+    skiplist_freeall(d);
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_CompactSurvivesChangesBetweenSteps(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d, *c;
+    skiplist_opts_t opts;
+    unsigned long i, k = 0;
+    int r;
+
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    opts.flags = SKIPLIST_MULTIMAP;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 3000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 1000 + 1), (void *) i);
+    c = skiplist_clone(d);
+
+    do
+    {
+        r = skiplist_compact(d, 50);
+        CuAssertTrue(tc, 0 <= r);
+        /* take out whatever the pass would have moved next */
+        if (d->compact_next)
+            skiplist_remove(d, d->compact_next->ety.k);
+        skiplist_put(d, (void *) (k++ * 37 % 1000 + 1), NULL);
+    }
+    while (0 == r);
+
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(c, NULL));
+    CuAssertTrue(tc, 3000 == skiplist_count(c));
+    skiplist_freeall(c);
+    skiplist_freeall(d);
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_RebuildKeepsAccountsStraight(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *d;
+    skiplist_opts_t opts;
+    skiplist_memory_t mem;
+    unsigned long i;
+
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 3000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+
+    /* rebuilding lowers some towers and raises others */
+    CuAssertTrue(tc, 1 == skiplist_rebuild(d, 0));
+    CuAssertTrue(tc, 1 == skiplist_rebuild(d, 0));
+    skiplist_memory_usage(d, &mem);
+    CuAssertTrue(tc, skiplist_pool_bytes(p) ==
+                 mem.nodes + mem.towers + mem.sentinel - sizeof(skiplist_t) +
+                 mem.pool_slack);
+
+    /* every tower goes back at the size it was taken at */
+    skiplist_freeall(d);
+    CuAssertTrue(tc, skiplist_pool_bytes(p) == skiplist_pool_slack(p));
+    skiplist_pool_free(p);
+}
+
+void Testskiplist_pool_MergeIntoShorterTowers(
+    CuTest * tc
+)
+{
+    skiplist_pool_t *p;
+    skiplist_t *a, *b;
+    skiplist_opts_t opts;
+    unsigned long i;
+
+    p = skiplist_pool_new(0, -1);
+    memset(&opts, 0, sizeof(opts));
+    opts.pool = p;
+    opts.max_levels = 3;
+    a = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    opts.max_levels = 0;
+    b = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    for (i = 1; i <= 2000; i++)
+        skiplist_put(i % 2 ? a : b, (void *) i, (void *) i);
+
+    /* b's towers are cut down to a's height */
+    CuAssertTrue(tc, 0 == skiplist_merge(a, b));
+    CuAssertTrue(tc, 2000 == skiplist_count(a));
+    CuAssertTrue(tc, 0 == skiplist_validate(a, NULL));
+    skiplist_freeall(a);
+    skiplist_freeall(b);
+    CuAssertTrue(tc, skiplist_pool_bytes(p) == skiplist_pool_slack(p));
+    skiplist_pool_free(p);
+}
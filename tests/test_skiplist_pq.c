@@ -0,0 +1,121 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "CuTest.h"
+
+#include "skiplist_pq.h"
+
+static long __ulong_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)k1 - (unsigned long)k2;
+}
+
+void Testskiplist_pq_OneShardPopsInOrder(
+    CuTest * tc
+)
+{
+    skiplist_pq_t *q;
+    unsigned long i;
+    void *k;
+
+    q = skiplist_pq_new(__ulong_compare, NULL, 1);
+    for (i = 1; i <= 100; i++)
+        CuAssertTrue(tc, 0 == skiplist_pq_put(q, (void *) ((i * 37) % 100 + 1),
+                                              (void *) i));
+    CuAssertTrue(tc, 100 == skiplist_pq_count(q));
+
+    for (i = 1; i <= 100; i++)
+    {
+        CuAssertTrue(tc, NULL != skiplist_pq_pop_min(q, &k));
+        CuAssertTrue(tc, (void *) i == k);
+    }
+    CuAssertTrue(tc, NULL == skiplist_pq_pop_min(q, NULL));
+    skiplist_pq_free(q);
+}
+
+void Testskiplist_pq_PopsEverythingApproximatelyInOrder(
+    CuTest * tc
+)
+{
+    skiplist_pq_t *q;
+    unsigned long i;
+    long late = 0;
+    void *k;
+
+    q = skiplist_pq_new(__ulong_compare, NULL, 4);
+    for (i = 1; i <= 1000; i++)
+        skiplist_pq_put(q, (void *) i, (void *) i);
+
+    for (i = 1; i <= 1000; i++)
+    {
+        CuAssertTrue(tc, NULL != skiplist_pq_pop_min(q, &k));
+        /* how far from the true minimum we were */
+        if (late < (long)k - (long)i)
+            late = (long)k - (long)i;
+    }
+    CuAssertTrue(tc, NULL == skiplist_pq_pop_min(q, NULL));
+    CuAssertTrue(tc, late < 100);
+    skiplist_pq_free(q);
+}
+
+void Testskiplist_pq_RejectsNulls(
+    CuTest * tc
+)
+{
+    skiplist_pq_t *q;
+
+    q = skiplist_pq_new(__ulong_compare, NULL, 2);
+    CuAssertTrue(tc, -1 == skiplist_pq_put(q, NULL, (void *) 1));
+    CuAssertTrue(tc, -1 == skiplist_pq_put(q, (void *) 1, NULL));
+    CuAssertTrue(tc, 0 == skiplist_pq_count(q));
+    skiplist_pq_free(q);
+    CuAssertTrue(tc, NULL == skiplist_pq_new(__ulong_compare, NULL, 0));
+}
+
+static void *__producer_consumer(void *arg)
+{
+    skiplist_pq_t *q = arg;
+    unsigned long i, popped = 0;
+
+    for (i = 1; i <= 5000; i++)
+    {
+        skiplist_pq_put(q, (void *) i, (void *) i);
+        if (i % 2 && skiplist_pq_pop_min(q, NULL))
+            popped++;
+    }
+    return (void *) popped;
+}
+
+void Testskiplist_pq_ConcurrentPutsAndPopsLoseNothing(
+    CuTest * tc
+)
+{
+    skiplist_pq_t *q;
+    pthread_t threads[4];
+    unsigned long popped = 0;
+    void *ret;
+    int i;
+
+    q = skiplist_pq_new(__ulong_compare, NULL, 8);
+    for (i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, __producer_consumer, q);
+    for (i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], &ret);
+        popped += (unsigned long)ret;
+    }
+    CuAssertTrue(tc, 4 * 5000 == popped + skiplist_pq_count(q));
+
+    while (skiplist_pq_pop_min(q, NULL))
+        popped++;
+    CuAssertTrue(tc, 4 * 5000 == popped);
+    skiplist_pq_free(q);
+}
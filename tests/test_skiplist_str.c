@@ -0,0 +1,182 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "CuTest.h"
+
+#include "skiplist_str.h"
+
+static void __url(char *buf, int i)
+{
+    sprintf(buf, "https://example.com/static/images/2014/%05d.png", i);
+}
+
+void Testskiplist_str_PutThenGet(
+    CuTest * tc
+)
+{
+    skiplist_str_t *m;
+
+    m = skiplist_str_new();
+    CuAssertTrue(tc, NULL == skiplist_str_get(m, "abc", 3));
+    CuAssertTrue(tc, NULL == skiplist_str_put(m, "abc", 3, (void *) 1));
+    CuAssertTrue(tc, NULL == skiplist_str_put(m, "ab", 2, (void *) 2));
+    CuAssertTrue(tc, 2 == skiplist_str_count(m));
+    CuAssertTrue(tc, (void *) 1 == skiplist_str_get(m, "abc", 3));
+    CuAssertTrue(tc, (void *) 2 == skiplist_str_get(m, "ab", 2));
+    CuAssertTrue(tc, NULL == skiplist_str_get(m, "a", 1));
+    CuAssertTrue(tc, NULL == skiplist_str_get(m, "abcd", 4));
+    skiplist_str_free(m);
+}
+
+void Testskiplist_str_DoublePutReplacesValue(
+    CuTest * tc
+)
+{
+    skiplist_str_t *m;
+
+    m = skiplist_str_new();
+    skiplist_str_put(m, "abc", 3, (void *) 1);
+    CuAssertTrue(tc, (void *) 1 == skiplist_str_put(m, "abc", 3, (void *) 2));
+    CuAssertTrue(tc, 1 == skiplist_str_count(m));
+    CuAssertTrue(tc, (void *) 2 == skiplist_str_get(m, "abc", 3));
+    skiplist_str_free(m);
+}
+
+void Testskiplist_str_ManySharedPrefixes(
+    CuTest * tc
+)
+{
+    skiplist_str_t *m;
+    char k[64];
+    size_t raw = 0;
+    int i;
+
+    m = skiplist_str_new();
+    /* enough to split blocks many times, in an order that hits every block */
+    for (i = 0; i < 5000; i++)
+    {
+        __url(k, (i * 7919) % 5000);
+        skiplist_str_put(m, k, strlen(k), (void *) (long) ((i * 7919) % 5000 + 1));
+        raw += strlen(k) + sizeof(void *);
+    }
+    CuAssertTrue(tc, 5000 == skiplist_str_count(m));
+
+    for (i = 0; i < 5000; i++)
+    {
+        __url(k, i);
+        CuAssertTrue(tc, (void *) (long) (i + 1) == skiplist_str_get(m, k, strlen(k)));
+    }
+
+    /* the keys alone would take more room uncompressed */
+    CuAssertTrue(tc, skiplist_str_bytes(m) < raw);
+    skiplist_str_free(m);
+}
+
+void Testskiplist_str_Remove(
+    CuTest * tc
+)
+{
+    skiplist_str_t *m;
+    char k[64];
+    int i;
+
+    m = skiplist_str_new();
+    for (i = 0; i < 1000; i++)
+    {
+        __url(k, i);
+        skiplist_str_put(m, k, strlen(k), (void *) (long) (i + 1));
+    }
+
+    CuAssertTrue(tc, NULL == skiplist_str_remove(m, "x", 1));
+    for (i = 0; i < 1000; i += 2)
+    {
+        __url(k, i);
+        CuAssertTrue(tc, (void *) (long) (i + 1) == skiplist_str_remove(m, k, strlen(k)));
+    }
+    CuAssertTrue(tc, 500 == skiplist_str_count(m));
+    for (i = 0; i < 1000; i++)
+    {
+        __url(k, i);
+        CuAssertTrue(tc, (i % 2 ? (void *) (long) (i + 1) : NULL) ==
+                     skiplist_str_get(m, k, strlen(k)));
+    }
+
+    for (i = 1; i < 1000; i += 2)
+    {
+        __url(k, i);
+        skiplist_str_remove(m, k, strlen(k));
+    }
+    CuAssertTrue(tc, 0 == skiplist_str_count(m));
+    CuAssertTrue(tc, 0 == skiplist_count(m->list));
+    skiplist_str_free(m);
+}
+
+void Testskiplist_str_IterateInOrder(
+    CuTest * tc
+)
+{
+    skiplist_str_t *m;
+    skiplist_str_iterator_t iter;
+    char k[64];
+    const char *key;
+    size_t klen;
+    void *v;
+    int i;
+
+    m = skiplist_str_new();
+    for (i = 0; i < 500; i++)
+    {
+        __url(k, (i * 37) % 500);
+        skiplist_str_put(m, k, strlen(k), (void *) (long) ((i * 37) % 500 + 1));
+    }
+
+    CuAssertTrue(tc, 0 == skiplist_str_iterator(m, NULL, 0, &iter));
+    for (i = 0; i < 500; i++)
+    {
+        __url(k, i);
+        CuAssertTrue(tc, skiplist_str_iterator_next(&iter, &key, &klen, &v));
+        CuAssertTrue(tc, klen == strlen(k) && 0 == memcmp(k, key, klen));
+        CuAssertTrue(tc, (void *) (long) (i + 1) == v);
+    }
+    CuAssertTrue(tc, !skiplist_str_iterator_next(&iter, &key, &klen, &v));
+    skiplist_str_iterator_done(&iter);
+    skiplist_str_free(m);
+}
+
+void Testskiplist_str_IterateFromKey(
+    CuTest * tc
+)
+{
+    skiplist_str_t *m;
+    skiplist_str_iterator_t iter;
+    char k[64];
+    void *v;
+    int i;
+
+    m = skiplist_str_new();
+    for (i = 0; i < 500; i += 2)
+    {
+        __url(k, i);
+        skiplist_str_put(m, k, strlen(k), (void *) (long) (i + 1));
+    }
+
+    /* start between two keys */
+    __url(k, 301);
+    skiplist_str_iterator(m, k, strlen(k), &iter);
+    for (i = 302; i < 500; i += 2)
+    {
+        CuAssertTrue(tc, skiplist_str_iterator_next(&iter, NULL, NULL, &v));
+        CuAssertTrue(tc, (void *) (long) (i + 1) == v);
+    }
+    CuAssertTrue(tc, !skiplist_str_iterator_next(&iter, NULL, NULL, &v));
+    skiplist_str_iterator_done(&iter);
+
+    /* past the end */
+    skiplist_str_iterator(m, "zzz", 3, &iter);
+    CuAssertTrue(tc, !skiplist_str_iterator_next(&iter, NULL, NULL, &v));
+    skiplist_str_iterator_done(&iter);
+    skiplist_str_free(m);
+}
@@ -0,0 +1,271 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "CuTest.h"
+
+#include "skiplist.h"
+#include "skiplist_tpool.h"
+
+static long __ulong_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)k1 - (unsigned long)k2;
+}
+
+static uint64_t __ulong_hash(
+    const void *key,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)key;
+}
+
+static skiplist_entry_t *__items(unsigned int n)
+{
+    skiplist_entry_t *items = malloc(n * sizeof(skiplist_entry_t));
+    unsigned long i;
+
+    for (i = 0; i < n; i++)
+    {
+        items[i].k = (void *) (i * 2 + 2);
+        items[i].v = (void *) (i + 1);
+    }
+    return items;
+}
+
+static void __mark(void *arg)
+{
+    __atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+}
+
+void Testskiplist_tpool_RunsEveryTaskOnce(
+    CuTest * tc
+)
+{
+    skiplist_tpool_t *tp;
+    int done[1000], i, batch;
+
+    tp = skiplist_tpool_new(4);
+    CuAssertTrue(tc, 4 == skiplist_tpool_threads(tp));
+
+    /* a few batches, to be sure the threads wake up for each */
+    for (batch = 0; batch < 3; batch++)
+    {
+        memset(done, 0, sizeof(done));
+        skiplist_tpool_run(tp, __mark, done, sizeof(int), 1000);
+        for (i = 0; i < 1000; i++)
+            CuAssertTrue(tc, 1 == done[i]);
+    }
+    skiplist_tpool_free(tp);
+}
+
+void Testskiplist_tpool_SingleThreadRunsOnCaller(
+    CuTest * tc
+)
+{
+    skiplist_tpool_t *tp;
+    int done[10] = { 0 }, i;
+
+    tp = skiplist_tpool_new(1);
+    skiplist_tpool_run(tp, __mark, done, sizeof(int), 10);
+    for (i = 0; i < 10; i++)
+        CuAssertTrue(tc, 1 == done[i]);
+    CuAssertTrue(tc, NULL == skiplist_tpool_new(0));
+    skiplist_tpool_free(tp);
+}
+
+void Testskiplist_tpool_LoadBuildsBalancedList(
+    CuTest * tc
+)
+{
+    skiplist_tpool_t *tp = skiplist_tpool_new(4);
+    skiplist_entry_t *items = __items(100000);
+    skiplist_opts_t opts;
+    skiplist_health_t health;
+    skiplist_t *d;
+    unsigned long i;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = SKIPLIST_DETERMINISTIC;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    CuAssertTrue(tc, 0 == skiplist_load(d, items, 100000, tp));
+    CuAssertTrue(tc, 100000 == skiplist_count(d));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, &health));
+    CuAssertTrue(tc, health.search_cost <= health.expected_cost);
+    for (i = 0; i < 100000; i += 7)
+        CuAssertTrue(tc, items[i].v == skiplist_get(d, items[i].k));
+    CuAssertTrue(tc, NULL == skiplist_get(d, (void *) 3));
+
+    /* still an ordinary list afterwards */
+    skiplist_put(d, (void *) 3, (void *) 3);
+    skiplist_remove(d, (void *) 2);
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    /* only into an empty list */
+    CuAssertTrue(tc, -1 == skiplist_load(d, items, 10, tp));
+    skiplist_freeall(d);
+    skiplist_tpool_free(tp);
+    free(items);
+}
+
+void Testskiplist_tpool_LoadRejectsUnsortedItems(
+    CuTest * tc
+)
+{
+    skiplist_tpool_t *tp = skiplist_tpool_new(3);
+    skiplist_entry_t *items = __items(1000);
+    skiplist_t *d;
+
+    d = skiplist_new(__ulong_compare, NULL);
+
+    /* out of order where two segments meet, then inside one */
+    items[500].k = (void *) 1;
+    CuAssertTrue(tc, -1 == skiplist_load(d, items, 1000, tp));
+    CuAssertTrue(tc, 0 == skiplist_count(d));
+    items[500].k = items[501].k;
+    CuAssertTrue(tc, -1 == skiplist_load(d, items, 1000, NULL));
+    CuAssertTrue(tc, 0 == skiplist_validate(d, NULL));
+
+    /* equal keys are fine in a multimap */
+    d->flags |= SKIPLIST_MULTIMAP;
+    CuAssertTrue(tc, 0 == skiplist_load(d, items, 1000, tp));
+    CuAssertTrue(tc, 2 == skiplist_count_equal(d, items[501].k));
+    skiplist_freeall(d);
+    skiplist_tpool_free(tp);
+    free(items);
+}
+
+void Testskiplist_tpool_LoadFillsBloomFilter(
+    CuTest * tc
+)
+{
+    skiplist_tpool_t *tp = skiplist_tpool_new(2);
+    skiplist_entry_t *items = __items(5000);
+    skiplist_opts_t opts;
+    skiplist_t *d;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.hash = __ulong_hash;
+    d = skiplist_new_opts(__ulong_compare, NULL, &opts);
+    CuAssertTrue(tc, 0 == skiplist_load(d, items, 5000, tp));
+    CuAssertTrue(tc, 5000 <= d->bloom->capacity);
+    CuAssertTrue(tc, 0 == skiplist_validate_par(d, tp));
+    skiplist_freeall(d);
+    skiplist_tpool_free(tp);
+    free(items);
+}
+
+typedef struct {
+    unsigned long sum, min, max, n;
+} agg_t;
+
+static void __agg(
+    skiplist_entry_t *ety,
+    void *udata
+)
+{
+    agg_t *a = udata;
+    unsigned long k = (unsigned long)ety->k;
+
+    a->sum += k;
+    if (0 == a->n++)
+        a->min = k;
+    a->max = k;
+}
+
+void Testskiplist_tpool_ScanSplitsRangeIntoOrderedRuns(
+    CuTest * tc
+)
+{
+    skiplist_tpool_t *tp = skiplist_tpool_new(4);
+    agg_t aggs[8];
+    void *udata[8];
+    skiplist_t *d;
+    unsigned long i, sum = 0, n = 0;
+    int runs, r;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 20000; i++)
+        skiplist_put(d, (void *) i, (void *) i);
+    for (r = 0; r < 8; r++)
+        udata[r] = &aggs[r];
+
+    memset(aggs, 0, sizeof(aggs));
+    runs = skiplist_scan(d, (void *) 1001, (void *) 15000, __agg, udata, 8, tp);
+    CuAssertTrue(tc, 8 == runs);
+    for (r = 0; r < runs; r++)
+    {
+        CuAssertTrue(tc, 0 < aggs[r].n);
+        CuAssertTrue(tc, 0 == r || aggs[r - 1].max + 1 == aggs[r].min);
+        sum += aggs[r].sum;
+        n += aggs[r].n;
+    }
+    CuAssertTrue(tc, 1001 == aggs[0].min);
+    CuAssertTrue(tc, 15000 == aggs[runs - 1].max);
+    CuAssertTrue(tc, 14000 == n);
+    CuAssertTrue(tc, (1001 + 15000) * 14000 / 2 == sum);
+
+    /* fewer items than runs */
+    memset(aggs, 0, sizeof(aggs));
+    runs = skiplist_scan(d, (void *) 10, (void *) 12, __agg, udata, 8, tp);
+    CuAssertTrue(tc, 3 == runs);
+    CuAssertTrue(tc, 10 + 11 + 12 == aggs[0].sum + aggs[1].sum + aggs[2].sum);
+
+    /* the whole list, on this thread */
+    memset(aggs, 0, sizeof(aggs));
+    CuAssertTrue(tc, 1 == skiplist_scan(d, NULL, NULL, __agg, udata, 8, NULL));
+    CuAssertTrue(tc, 20000 == aggs[0].n);
+    CuAssertTrue(tc, 0 == skiplist_scan(d, (void *) 30000, NULL, __agg, udata, 8, tp));
+    skiplist_freeall(d);
+    skiplist_tpool_free(tp);
+}
+
+void Testskiplist_tpool_ValidateParFindsDamage(
+    CuTest * tc
+)
+{
+    skiplist_tpool_t *tp = skiplist_tpool_new(4);
+    skiplist_t *d;
+    node_t *n;
+    unsigned long i;
+    void *k;
+
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 20000; i++)
+        skiplist_put(d, (void *) ((i * 7919) % 20000 + 1), (void *) i);
+    CuAssertTrue(tc, 0 == skiplist_validate_par(d, tp));
+
+    /* swap two keys far down the bottom line */
+    for (n = d->nil->next[0], i = 0; i < 12345; i++)
+        n = n->next[0];
+    k = n->ety.k;
+    n->ety.k = n->next[0]->ety.k;
+    n->next[0]->ety.k = k;
+    CuAssertTrue(tc, -1 == skiplist_validate_par(d, tp));
+    CuAssertTrue(tc, -1 == skiplist_validate(d, NULL));
+    n->next[0]->ety.k = n->ety.k;
+    n->ety.k = k;
+
+    /* drop a node from the bottom line only */
+    d->count--;
+    CuAssertTrue(tc, -1 == skiplist_validate_par(d, tp));
+    d->count++;
+    CuAssertTrue(tc, 0 == skiplist_validate_par(d, tp));
+
+#ifdef SKIPLIST_TTL
+    /* an expiry time the expiry index doesn't know about */
+    n->expires = 1;
+    CuAssertTrue(tc, -1 == skiplist_validate_par(d, tp));
+    CuAssertTrue(tc, -1 == skiplist_validate(d, NULL));
+    n->expires = 0;
+    CuAssertTrue(tc, 0 == skiplist_validate_par(d, tp));
+#endif
+    skiplist_freeall(d);
+    skiplist_tpool_free(tp);
+}
@@ -0,0 +1,299 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "CuTest.h"
+
+#include "skiplist.h"
+#include "skiplist_wal.h"
+
+static long __ulong_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused))
+)
+{
+    return (unsigned long)k1 - (unsigned long)k2;
+}
+
+/* counts its calls in udata */
+static long __counting_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata
+)
+{
+    (*(unsigned long *) udata)++;
+    return __ulong_compare(k1, k2, NULL);
+}
+
+static long __str_compare(
+    const void *k1,
+    const void *k2,
+    const void *udata __attribute__((unused))
+)
+{
+    return strcmp(k1, k2);
+}
+
+static void __tmpfile(char *path)
+{
+    strcpy(path, "/tmp/skiplist_wal_XXXXXX");
+    int fd = mkstemp(path);
+    close(fd);
+}
+
+/* keys and values are logged as the integers themselves */
+static int __decode_ulong(
+    const void *key,
+    size_t klen __attribute__((unused)),
+    const void *val,
+    size_t vlen __attribute__((unused)),
+    skiplist_entry_t *ety,
+    void *udata __attribute__((unused))
+)
+{
+    unsigned long k, v = 0;
+
+    memcpy(&k, key, sizeof(k));
+    if (val)
+        memcpy(&v, val, sizeof(v));
+    ety->k = (void *) k;
+    ety->v = (void *) v;
+    return 0;
+}
+
+static int64_t __put(skiplist_wal_t *w, skiplist_t *d, unsigned long k,
+                     unsigned long v)
+{
+    int64_t lsn = skiplist_wal_put(w, &k, sizeof(k), &v, sizeof(v));
+    skiplist_put(d, (void *) k, (void *) v);
+    return lsn;
+}
+
+static int64_t __remove(skiplist_wal_t *w, skiplist_t *d, unsigned long k)
+{
+    int64_t lsn = skiplist_wal_remove(w, &k, sizeof(k));
+    skiplist_remove(d, (void *) k);
+    return lsn;
+}
+
+void Testskiplist_wal_ReplayRebuildsList(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_wal_t *w;
+    skiplist_t *d, *e;
+    unsigned long i;
+    int64_t lsn = 0;
+
+    __tmpfile(path);
+    w = skiplist_wal_open(path, 0);
+    CuAssertTrue(tc, NULL != w);
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 1000; i++)
+        __put(w, d, (i * 7919) % 1000 + 1, i);
+    for (i = 1; i <= 1000; i += 3)
+        __put(w, d, i, i + 5000);
+    for (i = 2; i <= 1000; i += 5)
+        lsn = __remove(w, d, i);
+    CuAssertTrue(tc, 0 < lsn);
+    CuAssertTrue(tc, 0 == skiplist_wal_sync(w, lsn));
+    CuAssertTrue(tc, 0 == skiplist_wal_close(w));
+
+    e = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, 1000 + 334 + 200 ==
+                 skiplist_wal_replay(path, e, __decode_ulong, NULL, NULL));
+    CuAssertTrue(tc, skiplist_count(d) == skiplist_count(e));
+    CuAssertTrue(tc, 0 == skiplist_validate(e, NULL));
+    for (i = 1; i <= 1000; i++)
+        CuAssertTrue(tc, skiplist_get(d, (void *) i) ==
+                     skiplist_get(e, (void *) i));
+    skiplist_freeall(d);
+    skiplist_freeall(e);
+    unlink(path);
+}
+
+void Testskiplist_wal_SortedLogIsLoadedInBulk(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_wal_t *w;
+    skiplist_t *d, *e;
+    unsigned long i, cmps = 0;
+
+    __tmpfile(path);
+    w = skiplist_wal_open(path, 0);
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 10000; i++)
+        __put(w, d, i, i);
+    CuAssertTrue(tc, 0 == skiplist_wal_close(w));
+
+    e = skiplist_new(__counting_compare, &cmps);
+    CuAssertTrue(tc, 10000 ==
+                 skiplist_wal_replay(path, e, __decode_ulong, NULL, NULL));
+    CuAssertTrue(tc, 10000 == skiplist_count(e));
+    CuAssertTrue(tc, 0 == skiplist_validate(e, NULL));
+
+    /* a comparison per neighbouring pair, rather than a search per put */
+    CuAssertTrue(tc, cmps < 2 * 10000 * 2);
+    skiplist_freeall(d);
+    skiplist_freeall(e);
+    unlink(path);
+}
+
+void Testskiplist_wal_TornTailIsDropped(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_wal_t *w;
+    skiplist_t *d, *e;
+    unsigned long i;
+    int fd;
+
+    __tmpfile(path);
+    w = skiplist_wal_open(path, 0);
+    d = skiplist_new(__ulong_compare, NULL);
+    for (i = 1; i <= 10; i++)
+        __put(w, d, i, i);
+    skiplist_wal_close(w);
+
+    /* as if we died halfway through writing a record */
+    fd = open(path, O_WRONLY | O_APPEND);
+    CuAssertTrue(tc, 7 == write(fd, "\x01\x02\x03\x04\x01\x00\x00", 7));
+    close(fd);
+
+    /* reopening cuts it off, so new records follow on from the good ones */
+    w = skiplist_wal_open(path, 0);
+    __put(w, d, 11, 11);
+    CuAssertTrue(tc, 0 == skiplist_wal_close(w));
+
+    e = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, 11 ==
+                 skiplist_wal_replay(path, e, __decode_ulong, NULL, NULL));
+    CuAssertTrue(tc, (void *) 11 == skiplist_get(e, (void *) 11));
+    skiplist_freeall(d);
+    skiplist_freeall(e);
+    unlink(path);
+}
+
+typedef struct {
+    skiplist_wal_t *w;
+    unsigned long base;
+    int err;
+} writer_t;
+
+static void *__writer(void *arg)
+{
+    writer_t *wr = arg;
+    unsigned long i;
+
+    for (i = 0; i < 200; i++)
+    {
+        unsigned long k = wr->base + i;
+        int64_t lsn = skiplist_wal_put(wr->w, &k, sizeof(k), &k, sizeof(k));
+        if (lsn < 0 || skiplist_wal_sync(wr->w, lsn))
+            wr->err = 1;
+    }
+    return NULL;
+}
+
+void Testskiplist_wal_WritersShareSyncs(
+    CuTest * tc
+)
+{
+    char path[64];
+    pthread_t threads[4];
+    writer_t writers[4];
+    skiplist_t *e;
+    int i;
+
+    __tmpfile(path);
+    skiplist_wal_t *w = skiplist_wal_open(path, 100);
+    for (i = 0; i < 4; i++)
+    {
+        writers[i].w = w;
+        writers[i].base = 1 + i * 1000;
+        writers[i].err = 0;
+        pthread_create(&threads[i], NULL, __writer, &writers[i]);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CuAssertTrue(tc, 0 == writers[i].err);
+    }
+    /* a failed put's LSN is never durable */
+    CuAssertTrue(tc, -1 == skiplist_wal_sync(w, -1));
+    CuAssertTrue(tc, 0 == skiplist_wal_close(w));
+
+    e = skiplist_new(__ulong_compare, NULL);
+    CuAssertTrue(tc, 800 ==
+                 skiplist_wal_replay(path, e, __decode_ulong, NULL, NULL));
+    CuAssertTrue(tc, 800 == skiplist_count(e));
+    CuAssertTrue(tc, (void *) 3199 == skiplist_get(e, (void *) 3199));
+    skiplist_freeall(e);
+    unlink(path);
+}
+
+static int __decode_str(
+    const void *key,
+    size_t klen,
+    const void *val,
+    size_t vlen,
+    skiplist_entry_t *ety,
+    void *udata __attribute__((unused))
+)
+{
+    ety->k = strndup(key, klen);
+    ety->v = val ? strndup(val, vlen) : NULL;
+    return 0;
+}
+
+static void __free_entry(
+    skiplist_entry_t *ety,
+    void *udata
+)
+{
+    (*(int *)udata)++;
+    free(ety->k);
+    free(ety->v);
+}
+
+void Testskiplist_wal_ReplayDropsWhatItDoesntKeep(
+    CuTest * tc
+)
+{
+    char path[64];
+    skiplist_wal_t *w;
+    skiplist_t *e;
+    int dropped = 0;
+
+    __tmpfile(path);
+    w = skiplist_wal_open(path, 0);
+    skiplist_wal_put(w, "b", 1, "1", 1);
+    skiplist_wal_put(w, "a", 1, "2", 1);
+    skiplist_wal_put(w, "b", 1, "3", 1);
+    skiplist_wal_remove(w, "a", 1);
+    skiplist_wal_remove(w, "z", 1);
+    CuAssertTrue(tc, 0 == skiplist_wal_close(w));
+
+    e = skiplist_new(__str_compare, NULL);
+    CuAssertTrue(tc, 5 == skiplist_wal_replay(path, e, __decode_str,
+                                              __free_entry, &dropped));
+    CuAssertTrue(tc, 1 == skiplist_count(e));
+    CuAssertStrEquals(tc, "3", skiplist_get(e, "b"));
+
+    /* the replaced value, the removed item and both removes' keys */
+    CuAssertTrue(tc, 4 == dropped);
+    skiplist_clear_cb(e, __free_entry, &dropped);
+    skiplist_freeall(e);
+    unlink(path);
+}